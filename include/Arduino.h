@@ -107,10 +107,17 @@ uint64_t micros();
 //IO functions
 void pinMode(const pin_t, const uint8_t);
 void digitalWrite(pin_t, uint8_t);
+// Writes several pins at one timestamp, bit n of mask and value drives pins[n]
+void digitalWritePort(const pin_t* pins, uint8_t count, uint32_t mask, uint32_t value);
 bool digitalRead(pin_t);
 void analogWrite(pin_t, int);
+// PWM frequency in Hz used by the following analogWrite() calls on the pin
+void analogWriteFrequency(pin_t, uint32_t);
 uint16_t analogRead(pin_t);
 
+// fastio style mapping for parallel buses, PINS is an array of pin_t
+#define WRITE_PORT(PINS, MASK, VALUE) digitalWritePort(PINS, sizeof(PINS) / sizeof(*(PINS)), MASK, VALUE)
+
 int32_t random(int32_t);
 int32_t random(int32_t, int32_t);
 void randomSeed(uint32_t);
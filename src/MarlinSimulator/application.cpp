@@ -5,12 +5,18 @@
 #include "user_interface.h"
 #include "application.h"
 #include "logger.h"
+#include "serial_capture.h"
+#include "pin_export.h"
+#include "signal_pyramid.h"
+#include "signal_decoders.h"
+#include "trigger_capture.h"
+#include "hardware/bus/spi.h"
 
 #include "../HAL.h"
 #include <src/MarlinCore.h>
 #include <src/pins/pinsDebug.h>
 #include <fstream>
-#include <vcd_writer.h>
+#include <map>
 #include <regex>
 
 Application::Application() {
@@ -67,6 +73,235 @@ Application::Application() {
   user_interface.addElement<SerialMonitor>("Serial Monitor(3)");
   user_interface.addElement<SerialController>("SerialHost");
 
+  user_interface.addElement<UiWindow>("Serial Capture", [this](UiWindow* window){
+    if (!serial_capture::active()) {
+      if (ImGui::Button("Start Capture")) {
+        IGFD::FileDialogConfig config { "." };
+        config.flags |= ImGuiFileDialogFlags_Modal;
+        ImGuiFileDialog::Instance()->OpenDialog("SerialCaptureDlgKey", "Choose File", "Serial Capture (*.msc){.msc},.*", config);
+      }
+    } else if (ImGui::Button("Stop Capture")) {
+      serial_capture::stop();
+    }
+
+    if (ImGuiFileDialog::Instance()->Display("SerialCaptureDlgKey", ImGuiWindowFlags_NoDocking)) {
+      if (ImGuiFileDialog::Instance()->IsOk()) {
+        serial_capture::start(ImGuiFileDialog::Instance()->GetFilePathName(), Kernel::TimeControl::frequency);
+      }
+      ImGuiFileDialog::Instance()->Close();
+    }
+
+    auto stats = serial_capture::statistics();
+    ImGui::Text("Captured: %llu bytes", (unsigned long long)stats.captured);
+    ImGui::Text("Dropped: %llu bytes", (unsigned long long)stats.dropped);
+    ImGui::Text("File: %.2f MiB", stats.written / (1024.0 * 1024.0));
+  });
+
+  user_interface.addElement<UiWindow>("Triggered Capture", [this](UiWindow* window){
+    static auto settings = TriggerCapture::settings();
+    static auto triggers = TriggerCapture::triggers();
+    static bool edited = false;
+    // until edited, show the armed states and fire counts handed back by the capture
+    if (!edited) triggers = TriggerCapture::triggers();
+
+    auto pin_name = [](pin_type pin) -> std::string {
+      auto info = std::find_if(std::begin(pin_array), std::end(pin_array), [&](auto& p){ return p.pin == pin; });
+      return info != std::end(pin_array) ? info->name : "pin " + std::to_string(pin);
+    };
+    auto pin_combo = [&](const char* label, int16_t& pin) {
+      bool changed = false;
+      if (ImGui::BeginCombo(label, pin >= 0 ? pin_name(pin).c_str() : "-")) {
+        for (auto p : pin_array) {
+          if (ImGui::Selectable(p.name, p.pin == pin)) {
+            pin = p.pin;
+            changed = true;
+          }
+        }
+        ImGui::EndCombo();
+      }
+      return changed;
+    };
+
+    ImGui::PushItemWidth(200);
+    float pre_window = settings.pre_window / 1e6f, post_window = settings.post_window / 1e6f;
+    int ring_size = int(settings.ring_size / 1024), max_snapshots = int(settings.max_snapshots);
+    if (ImGui::InputFloat("Pre-trigger (ms)", &pre_window, 0, 0, "%.3f")) { settings.pre_window = uint64_t(std::max(pre_window, 0.0f) * 1e6); edited = true; }
+    if (ImGui::InputFloat("Post-trigger (ms)", &post_window, 0, 0, "%.3f")) { settings.post_window = uint64_t(std::max(post_window, 0.0f) * 1e6); edited = true; }
+    if (ImGui::InputInt("Ring size (k events)", &ring_size)) { settings.ring_size = std::size_t(std::max(ring_size, 1)) * 1024; edited = true; }
+    if (ImGui::InputInt("Snapshots kept", &max_snapshots)) { settings.max_snapshots = std::size_t(std::max(max_snapshots, 1)); edited = true; }
+
+    static int trigger_kind = TriggerCapture::Trigger::EDGE;
+    ImGui::Combo("##TriggerKind", &trigger_kind, TriggerCapture::Trigger::kind_names, TriggerCapture::Trigger::KIND_COUNT);
+    ImGui::SameLine();
+    if (ImGui::Button("Add trigger")) {
+      TriggerCapture::Trigger trigger;
+      trigger.kind = TriggerCapture::Trigger::Kind(trigger_kind);
+      triggers.push_back(trigger);
+      edited = true;
+    }
+
+    for (std::size_t i = 0; i < triggers.size();) {
+      auto& trigger = triggers[i];
+      ImGui::PushID(int(i));
+      ImGui::Separator();
+      bool remove = ImGui::SmallButton("x");
+      ImGui::SameLine();
+      ImGui::Text("%s, fired %llu", TriggerCapture::Trigger::kind_names[trigger.kind], (unsigned long long)trigger.fired);
+      edited |= ImGui::Checkbox("Armed", &trigger.armed);
+      ImGui::SameLine();
+      edited |= ImGui::Checkbox("Re-arm", &trigger.rearm);
+      switch (trigger.kind) {
+        case TriggerCapture::Trigger::EDGE: {
+          edited |= pin_combo("Pin", trigger.pin);
+          int edge = trigger.edge;
+          if (ImGui::Combo("Edge", &edge, "Rising\0Falling\0Any\0")) { trigger.edge = TriggerCapture::Trigger::Edge(edge); edited = true; }
+        } break;
+        case TriggerCapture::Trigger::PATTERN:
+          for (std::size_t entry = 0; entry < trigger.pattern.size();) {
+            ImGui::PushID(int(entry));
+            bool remove_entry = ImGui::SmallButton("x");
+            ImGui::SameLine();
+            edited |= pin_combo("##PatternPin", trigger.pattern[entry].first);
+            ImGui::SameLine();
+            bool high = trigger.pattern[entry].second;
+            if (ImGui::Checkbox("High", &high)) { trigger.pattern[entry].second = high; edited = true; }
+            ImGui::PopID();
+            if (remove_entry) {
+              trigger.pattern.erase(trigger.pattern.begin() + entry);
+              edited = true;
+            } else entry++;
+          }
+          if (ImGui::Button("Add pin")) { trigger.pattern.push_back({-1, 1}); edited = true; }
+          break;
+        case TriggerCapture::Trigger::PULSE_WIDTH: {
+          edited |= pin_combo("Pin", trigger.pin);
+          bool high = trigger.level;
+          if (ImGui::Checkbox("High pulse", &high)) { trigger.level = high; edited = true; }
+          edited |= ImGui::InputScalar("Shorter than (ns)", ImGuiDataType_U64, &trigger.min_width);
+          edited |= ImGui::InputScalar("Longer than (ns)", ImGuiDataType_U64, &trigger.max_width);
+        } break;
+        case TriggerCapture::Trigger::SERIAL_MATCH: {
+          char expression[256];
+          snprintf(expression, sizeof(expression), "%s", trigger.expression.c_str());
+          if (ImGui::InputText("Line regex", expression, sizeof(expression))) { trigger.expression = expression; edited = true; }
+        } break;
+        case TriggerCapture::Trigger::ISR_TIMING:
+          edited |= ImGui::InputScalar("Above (ns)", ImGuiDataType_U64, &trigger.threshold);
+          break;
+        default: break;
+      }
+      ImGui::PopID();
+      if (remove) {
+        triggers.erase(triggers.begin() + i);
+        edited = true;
+      } else i++;
+    }
+    ImGui::PopItemWidth();
+    ImGui::Separator();
+
+    ImGui::BeginDisabled(!edited);
+    if (ImGui::Button("Apply")) {
+      TriggerCapture::configure(settings, triggers);
+      edited = false;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Revert")) {
+      settings = TriggerCapture::settings();
+      triggers = TriggerCapture::triggers();
+      edited = false;
+    }
+    ImGui::EndDisabled();
+    ImGui::SameLine();
+    ImGui::TextUnformatted(TriggerCapture::capturing() ? "Capturing post-trigger window" : TriggerCapture::active() ? "Armed" : "Idle");
+
+    // the selected snapshot's events split per pin, each run starting with the pin level at the start of the window
+    static std::shared_ptr<const TriggerCapture::Snapshot> selected;
+    static std::vector<std::pair<pin_type, std::vector<pin_log_data>>> runs;
+    auto snapshots = TriggerCapture::snapshots();
+    if (ImGui::Button("Clear snapshots")) {
+      TriggerCapture::clear_snapshots();
+      selected.reset();
+      runs.clear();
+    }
+    for (auto snapshot = snapshots.rbegin(); snapshot != snapshots.rend(); ++snapshot) {
+      char label[256];
+      snprintf(label, sizeof(label), "%.6f s: %s, %zu events%s##%p", (*snapshot)->trigger_time / 1e9, (*snapshot)->trigger.c_str(), (*snapshot)->events.size(), (*snapshot)->truncated ? " (pre-trigger truncated)" : "", (void*)snapshot->get());
+      if (ImGui::Selectable(label, *snapshot == selected) && *snapshot != selected) {
+        selected = *snapshot;
+        std::map<pin_type, std::vector<pin_log_data>> pins;
+        for (auto& event : selected->events) {
+          auto& run = pins[event.pin];
+          if (run.empty()) run.push_back({selected->start, event.previous});
+          run.push_back({event.timestamp, event.value});
+        }
+        runs.assign(pins.begin(), pins.end());
+      }
+    }
+
+    if (selected && runs.size()) {
+      static PinExport exporter;
+      ImGui::BeginDisabled(exporter.busy());
+      if (ImGui::Button("Export snapshot to file")) {
+        IGFD::FileDialogConfig config { "." };
+        config.flags |= ImGuiFileDialogFlags_Modal;
+        ImGuiFileDialog::Instance()->OpenDialog("SnapshotExportDlgKey", "Choose File", "Value Change Dump (*.vcd){.vcd},.*", config);
+      }
+      ImGui::EndDisabled();
+      auto status = exporter.status();
+      if (status.size()) {
+        ImGui::SameLine();
+        ImGui::TextUnformatted(status.c_str());
+      }
+      if (ImGuiFileDialog::Instance()->Display("SnapshotExportDlgKey", ImGuiWindowFlags_NoDocking)) {
+        if (ImGuiFileDialog::Instance()->IsOk()) {
+          std::vector<PinExport::Signal> signals;
+          std::vector<std::vector<pin_log_data>> events;
+          for (auto& [pin, run] : runs) {
+            signals.push_back({pin, pin_name(pin)});
+            events.push_back(run);
+          }
+          exporter.export_events(ImGuiFileDialog::Instance()->GetFilePathName(), signals, events);
+        }
+        ImGuiFileDialog::Instance()->Close();
+      }
+
+      constexpr double lane_height = 1.5;
+      std::vector<std::string> names;
+      std::vector<double> lane_ticks;
+      for (std::size_t i = 0; i < runs.size(); i++) {
+        names.push_back(pin_name(runs[i].first));
+        lane_ticks.push_back((runs.size() - 1 - i) * lane_height + 0.5);
+      }
+      std::vector<const char*> lane_labels;
+      for (auto& name : names) lane_labels.push_back(name.c_str());
+
+      // time relative to the trigger, in ms
+      if (ImPlot::BeginPlot("##Snapshot", ImVec2(-1, 110 + 40 * runs.size()))) {
+        ImPlot::SetupAxes("ms", NULL, 0, ImPlotAxisFlags_LockMin);
+        ImPlot::SetupAxisLimits(ImAxis_X1, -(double(selected->trigger_time - selected->start) / 1e6), double(selected->end - selected->trigger_time) / 1e6, ImGuiCond_Appearing);
+        ImPlot::SetupAxisLimits(ImAxis_Y1, 0, runs.size() * lane_height - 0.1, ImGuiCond_Always);
+        ImPlot::SetupAxisTicks(ImAxis_Y1, lane_ticks.data(), int(lane_ticks.size()), lane_labels.data());
+        static std::vector<SignalPyramid::Point> points;
+        for (std::size_t i = 0; i < runs.size(); i++) {
+          auto info = std::find_if(std::begin(pin_array), std::end(pin_array), [&](auto& pin){ return pin.pin == runs[i].first; });
+          double scale = info == std::end(pin_array) || info->is_digital ? 1.0 : 1.0 / 4095.0;
+          double offset = (runs.size() - 1 - i) * lane_height;
+          points.clear();
+          for (auto& event : runs[i].second) {
+            double x = (double(event.timestamp) - double(selected->trigger_time)) / 1e6;
+            if (points.size()) points.push_back({x, points.back().y});
+            points.push_back({x, event.value * scale + offset});
+          }
+          points.push_back({double(selected->end - selected->trigger_time) / 1e6, points.back().y});
+          ImPlot::PlotLine(names[i].c_str(), &points[0].x, &points[0].y, int(points.size()), 0, 0, sizeof(SignalPyramid::Point));
+        }
+        double trigger_x = 0;
+        ImPlot::PlotInfLines("Trigger", &trigger_x, 1);
+        ImPlot::EndPlot();
+      }
+    }
+  });
+
   user_interface.addElement<UiWindow>("Debug", [this](UiWindow* window){ this->sim.ui_info_callback(window); });
 
   user_interface.addElement<UiWindow>("Components", [this](UiWindow* window){ this->sim.testPrinter.ui_widgets(); });
@@ -114,15 +349,237 @@ Application::Application() {
   });
 
   user_interface.addElement<UiWindow>("Pin List", [this](UiWindow* window){
-    for (auto p : pin_array) {
-      bool value = Gpio::get_pin_value(p.pin);
-      if(ImGui::Checkbox((std::string("##") + p.name).c_str(), &value)) {
-        Gpio::set(p.pin, value);
+    bool collecting = Gpio::isStatisticsEnabled();
+    if (ImGui::Checkbox("Collect Statistics", &collecting)) Gpio::setStatisticsEnabled(collecting);
+    ImGui::SameLine();
+    if (ImGui::Button("Reset##PinStatistics")) Gpio::resetStatistics();
+    ImGui::SameLine();
+    if (ImGui::Button("Export CSV##PinStatistics")) {
+      IGFD::FileDialogConfig config { "." };
+      config.flags |= ImGuiFileDialogFlags_Modal;
+      ImGuiFileDialog::Instance()->OpenDialog("PinStatisticsExportDlgKey", "Choose File", "Comma Separated Values (*.csv){.csv},.*", config);
+    }
+    if (ImGuiFileDialog::Instance()->Display("PinStatisticsExportDlgKey", ImGuiWindowFlags_NoDocking)) {
+      if (ImGuiFileDialog::Instance()->IsOk()) {
+        auto filename = ImGuiFileDialog::Instance()->GetFilePathName();
+        FILE* fp = fopen(filename.c_str(), "w");
+        if (fp == nullptr) {
+          logger::error("Unable to export pin statistics to %s", filename.c_str());
+        } else {
+          fprintf(fp, "# simulated_ns=%llu host_ns=%llu\n", (unsigned long long)Gpio::statisticsSimulatedTime(), (unsigned long long)Gpio::statisticsHostTime());
+          fprintf(fp, "pin,name,changes,rise,fall,set_value,setm,setd,get_value,port,callbacks,callback_ns\n");
+          for (auto& p : pin_array) {
+            auto stats = Gpio::statistics(p.pin);
+            fprintf(fp, "%d,%s,%llu", p.pin, p.name, (unsigned long long)stats.changes);
+            for (auto type : {GpioEvent::RISE, GpioEvent::FALL, GpioEvent::SET_VALUE, GpioEvent::SETM, GpioEvent::SETD, GpioEvent::GET_VALUE, GpioEvent::PORT}) {
+              fprintf(fp, ",%llu", (unsigned long long)stats.events[type]);
+            }
+            fprintf(fp, ",%llu,%llu\n", (unsigned long long)stats.callbacks, (unsigned long long)stats.callback_ns);
+          }
+          fclose(fp);
+        }
       }
-      ImGui::SameLine();
-      ImGui::Text("[%04d]", Gpio::get_pin_value(p.pin));
-      ImGui::SameLine();
-      ImGui::Text("%s (%d)", p.name, p.pin);
+      ImGuiFileDialog::Instance()->Close();
+    }
+
+    // rates per simulated second, callback time as a share of host time
+    double seconds = Gpio::statisticsSimulatedTime() / double(Kernel::TimeControl::ONE_BILLION);
+    double host_ns = std::max<double>(Gpio::statisticsHostTime(), 1);
+    enum Column { NAME, VALUE, CHANGES, EVENTS, RISE, FALL, GET, CALLBACKS, LOAD, COLUMN_COUNT };
+    struct Row {
+      const char* name;
+      pin_type pin;
+      double values[COLUMN_COUNT];
+    };
+    std::vector<Row> rows;
+    double peak[COLUMN_COUNT] = {};
+    for (auto& p : pin_array) {
+      auto stats = Gpio::statistics(p.pin);
+      uint64_t events = 0;
+      for (auto count : stats.events) events += count;
+      Row row {p.name, p.pin, {0, double(Gpio::get_pin_value(p.pin))}};
+      if (seconds > 0) {
+        row.values[CHANGES] = stats.changes / seconds;
+        row.values[EVENTS] = events / seconds;
+        row.values[RISE] = stats.events[GpioEvent::RISE] / seconds;
+        row.values[FALL] = stats.events[GpioEvent::FALL] / seconds;
+        row.values[GET] = stats.events[GpioEvent::GET_VALUE] / seconds;
+        row.values[CALLBACKS] = stats.callbacks / seconds;
+      }
+      row.values[LOAD] = stats.callback_ns * 100.0 / host_ns;
+      for (int i = CHANGES; i < COLUMN_COUNT; i++) peak[i] = std::max(peak[i], row.values[i]);
+      rows.push_back(row);
+    }
+
+    static const char* headers[COLUMN_COUNT] = {"Pin", "Value", "Changes/s", "Events/s", "Rise/s", "Fall/s", "Get/s", "Callbacks/s", "Callback %"};
+    if (ImGui::BeginTable("##PinList", COLUMN_COUNT, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY | ImGuiTableFlags_Sortable | ImGuiTableFlags_SizingFixedFit)) {
+      ImGui::TableSetupScrollFreeze(0, 1);
+      for (int i = 0; i < COLUMN_COUNT; i++) ImGui::TableSetupColumn(headers[i], i == NAME ? ImGuiTableColumnFlags_DefaultSort : ImGuiTableColumnFlags_PreferSortDescending);
+      ImGui::TableHeadersRow();
+
+      if (auto sort = ImGui::TableGetSortSpecs(); sort && sort->SpecsCount) {
+        int column = sort->Specs[0].ColumnIndex;
+        bool ascending = sort->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+        std::stable_sort(rows.begin(), rows.end(), [&](const Row& a, const Row& b) {
+          if (column == NAME) return ascending ? strcmp(a.name, b.name) < 0 : strcmp(a.name, b.name) > 0;
+          return ascending ? a.values[column] < b.values[column] : a.values[column] > b.values[column];
+        });
+      }
+
+      for (auto& row : rows) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%s (%d)", row.name, row.pin);
+        ImGui::TableNextColumn();
+        bool value = row.values[VALUE];
+        if (ImGui::Checkbox((std::string("##") + row.name).c_str(), &value)) {
+          Gpio::set(row.pin, value);
+        }
+        ImGui::SameLine();
+        ImGui::Text("[%04d]", int(row.values[VALUE]));
+        for (int i = CHANGES; i < COLUMN_COUNT; i++) {
+          ImGui::TableNextColumn();
+          // heat on a log scale so the busiest pins stand out without flattening the rest
+          if (row.values[i] > 0 && peak[i] > 0) {
+            float heat = std::log1p(row.values[i]) / std::log1p(peak[i]);
+            ImGui::TableSetBgColor(ImGuiTableBgTarget_CellBg, ImGui::GetColorU32(ImVec4(0.9f, 0.3f, 0.1f, 0.15f + 0.6f * heat)));
+          }
+          ImGui::Text(i == LOAD ? "%.3f" : "%.0f", row.values[i]);
+        }
+      }
+      ImGui::EndTable();
+    }
+  });
+
+  user_interface.addElement<UiWindow>("SPI Buses", [this](UiWindow* window){
+    auto& buses = SpiBus::instances();
+    // rolling utilisation, wire time as a share of each 100ms of simulated time
+    struct Rolling {
+      uint64_t last_wire_ns = 0;
+      bool primed = false;
+      std::vector<float> values;
+      std::size_t offset = 0;
+    };
+    static std::map<const void*, Rolling> history;
+    static uint64_t last_sample = 0;
+    constexpr uint64_t sample_period = 100 * Kernel::TimeControl::ONE_MILLION;
+    constexpr std::size_t history_size = 300;
+
+    bool collecting = SpiBus::isStatisticsEnabled();
+    if (ImGui::Checkbox("Collect Statistics", &collecting)) SpiBus::setStatisticsEnabled(collecting);
+    ImGui::SameLine();
+    if (ImGui::Button("Reset##SpiStatistics")) {
+      SpiBus::resetStatistics();
+      history.clear();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Export CSV##SpiStatistics")) {
+      IGFD::FileDialogConfig config { "." };
+      config.flags |= ImGuiFileDialogFlags_Modal;
+      ImGuiFileDialog::Instance()->OpenDialog("SpiStatisticsExportDlgKey", "Choose File", "Comma Separated Values (*.csv){.csv},.*", config);
+    }
+    if (ImGuiFileDialog::Instance()->Display("SpiStatisticsExportDlgKey", ImGuiWindowFlags_NoDocking)) {
+      if (ImGuiFileDialog::Instance()->IsOk()) {
+        auto filename = ImGuiFileDialog::Instance()->GetFilePathName();
+        FILE* fp = fopen(filename.c_str(), "w");
+        if (fp == nullptr) {
+          logger::error("Unable to export SPI statistics to %s", filename.c_str());
+        } else {
+          fprintf(fp, "# simulated_ns=%llu host_ns=%llu\n", (unsigned long long)SpiBus::statisticsSimulatedTime(), (unsigned long long)SpiBus::statisticsHostTime());
+          fprintf(fp, "bus,device,clock_hz,bytes,transfers,transactions,selected_ns,wire_ns");
+          for (std::size_t context = 0; context < SpiBus::context_count; context++) fprintf(fp, ",%s host_ns", SpiBus::context_name(context));
+          fprintf(fp, "\n");
+          auto row = [fp](std::size_t bus, const char* device, uint32_t clock, const SpiBus::Statistics& stats) {
+            fprintf(fp, "%zu,%s,%u,%llu,%llu,%llu,%llu,%llu", bus, device, clock, (unsigned long long)stats.bytes, (unsigned long long)stats.transfers,
+              (unsigned long long)stats.transactions, (unsigned long long)stats.selected_ns, (unsigned long long)stats.wire_ns);
+          };
+          for (std::size_t b = 0; b < buses.size(); b++) {
+            row(b, "(bus)", buses[b]->clock(), buses[b]->statistics());
+            for (std::size_t context = 0; context < SpiBus::context_count; context++) fprintf(fp, ",%llu", (unsigned long long)buses[b]->context_host_ns(context));
+            fprintf(fp, "\n");
+            for (auto device : buses[b]->attached_devices()) {
+              row(b, device->device_name().c_str(), buses[b]->clock(), SpiBus::statistics(device->counters));
+              fprintf(fp, "\n");
+            }
+          }
+          fclose(fp);
+        }
+      }
+      ImGuiFileDialog::Instance()->Close();
+    }
+
+    uint64_t now = Kernel::SimulationRuntime::nanos();
+    if (collecting && now >= last_sample + sample_period) {
+      double elapsed = double(now - last_sample);
+      auto sample = [&](const void* key, uint64_t wire_ns) {
+        auto& rolling = history[key];
+        float value = rolling.primed && wire_ns >= rolling.last_wire_ns ? float((wire_ns - rolling.last_wire_ns) * 100.0 / elapsed) : 0.0f;
+        rolling.last_wire_ns = wire_ns;
+        rolling.primed = true;
+        if (rolling.values.size() < history_size) rolling.values.push_back(value);
+        else {
+          rolling.values[rolling.offset] = value;
+          rolling.offset = (rolling.offset + 1) % history_size;
+        }
+      };
+      for (auto bus : buses) {
+        sample(bus, bus->statistics().wire_ns);
+        for (auto device : bus->attached_devices()) sample(device, SpiBus::statistics(device->counters).wire_ns);
+      }
+      last_sample = now;
+    }
+
+    // rates per simulated second, time shares of simulated time, host time in transfers as a share of host time
+    double seconds = SpiBus::statisticsSimulatedTime() / double(Kernel::TimeControl::ONE_BILLION);
+    double simulated_ns = std::max<double>(SpiBus::statisticsSimulatedTime(), 1);
+    double host_ns = std::max<double>(SpiBus::statisticsHostTime(), 1);
+    for (std::size_t b = 0; b < buses.size(); b++) {
+      auto bus = buses[b];
+      if (bus->attached_devices().empty()) continue;
+      char label[64];
+      snprintf(label, sizeof(label), "SPI%zu, %.3f MHz", b, bus->clock() / 1e6);
+      if (!ImGui::CollapsingHeader(label, ImGuiTreeNodeFlags_DefaultOpen)) continue;
+      ImGui::PushID(int(b));
+
+      if (ImGui::BeginTable("##SpiDevices", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+        for (auto header : {"Device", "Bytes", "KiB/s", "Transactions/s", "Selected %", "Wire %"}) ImGui::TableSetupColumn(header);
+        ImGui::TableHeadersRow();
+        auto row = [&](const char* name, const SpiBus::Statistics& stats) {
+          ImGui::TableNextRow();
+          ImGui::TableNextColumn(); ImGui::Text("%s", name);
+          ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)stats.bytes);
+          ImGui::TableNextColumn(); ImGui::Text("%.1f", seconds > 0 ? stats.bytes / 1024.0 / seconds : 0.0);
+          ImGui::TableNextColumn(); ImGui::Text("%.0f", seconds > 0 ? stats.transactions / seconds : 0.0);
+          ImGui::TableNextColumn(); ImGui::Text("%.2f", stats.selected_ns * 100.0 / simulated_ns);
+          ImGui::TableNextColumn(); ImGui::Text("%.2f", stats.wire_ns * 100.0 / simulated_ns);
+        };
+        for (auto device : bus->attached_devices()) row(device->device_name().c_str(), SpiBus::statistics(device->counters));
+        row("Bus", bus->statistics());
+        ImGui::EndTable();
+      }
+
+      ImGui::Text("Host time in transfers:");
+      for (std::size_t context = 0; context < SpiBus::context_count; context++) {
+        if (!bus->context_host_ns(context)) continue;
+        ImGui::SameLine();
+        ImGui::Text("%s %.3f%%", SpiBus::context_name(context), bus->context_host_ns(context) * 100.0 / host_ns);
+      }
+
+      if (ImPlot::BeginPlot("##SpiUtilisation", ImVec2(-1, 160))) {
+        ImPlot::SetupAxes("s", "Wire %", ImPlotAxisFlags_AutoFit, 0);
+        ImPlot::SetupAxisLimits(ImAxis_Y1, 0, 100, ImGuiCond_Always);
+        auto plot = [&](const char* name, const void* key) {
+          auto entry = history.find(key);
+          if (entry == history.end() || entry->second.values.empty()) return;
+          auto& rolling = entry->second;
+          double start = -double(rolling.values.size()) * sample_period / Kernel::TimeControl::ONE_BILLION;
+          ImPlot::PlotLine(name, rolling.values.data(), int(rolling.values.size()), double(sample_period) / Kernel::TimeControl::ONE_BILLION, start, 0, int(rolling.offset));
+        };
+        for (auto device : bus->attached_devices()) plot(device->device_name().c_str(), device);
+        plot("Bus", bus);
+        ImPlot::EndPlot();
+      }
+      ImGui::PopID();
     }
   });
 
@@ -141,30 +598,28 @@ Application::Application() {
         Gpio::resetLogs();
       }
 
-      struct ScrollingData {
-        int MaxSize;
-        int Offset;
-        ImVector<ImPlotPoint> Data;
-        ScrollingData() {
-            MaxSize = 100000;
-            Offset  = 0;
-            Data.reserve(MaxSize);
+      if (ImGui::TreeNode("Trace Storage")) {
+        auto stats = PinTrace::statistics();
+        ImGui::Text("%llu events, %.1f MiB in memory, %.1f MiB spilled, %llu evicted", (unsigned long long)stats.events, stats.memory / 1048576.0, stats.spilled / 1048576.0, (unsigned long long)stats.evicted);
+
+        int budget = int(PinTrace::budget() / (1024 * 1024));
+        ImGui::PushItemWidth(200);
+        if (ImGui::SliderInt("Memory budget", &budget, 16, 8192, "%d MiB", ImGuiSliderFlags_Logarithmic)) PinTrace::set_budget(std::size_t(budget) * 1024 * 1024);
+
+        static char spill_path[256] = "pin_trace.spill";
+        static int spill_size = 4096;
+        bool spill_enabled = stats.spill_size != 0;
+        ImGui::BeginDisabled(spill_enabled);
+        ImGui::InputText("Spill file", spill_path, sizeof(spill_path));
+        ImGui::SliderInt("Spill size", &spill_size, 64, 65536, "%d MiB", ImGuiSliderFlags_Logarithmic);
+        ImGui::EndDisabled();
+        ImGui::PopItemWidth();
+        if (ImGui::Checkbox("Spill to disk", &spill_enabled)) {
+          if (spill_enabled) PinTrace::enable_spill(spill_path, std::size_t(spill_size) * 1024 * 1024);
+          else PinTrace::disable_spill();
         }
-        void AddPoint(double x, double y) {
-            if (Data.size() < MaxSize)
-                Data.push_back(ImPlotPoint(x,y));
-            else {
-                Data[Offset] = ImPlotPoint(x,y);
-                Offset =  (Offset + 1) % MaxSize;
-            }
-        }
-        void Erase() {
-            if (Data.size() > 0) {
-                Data.shrink(0);
-                Offset  = 0;
-            }
-        }
-      };
+        ImGui::TreePop();
+      }
 
       static pin_type monitor_pin = X_STEP_PIN;
       static const char* label = "Select Pin";
@@ -180,95 +635,219 @@ Application::Application() {
         ImGui::EndCombo();
       }
 
-      if (Gpio::pin_map[monitor_pin].event_log.size()) {
-        ScrollingData sdata;
+      // further pins stacked under the selected one
+      static std::vector<std::pair<pin_type, const char*>> extra_pins;
+      static std::map<pin_type, SignalPyramid> pyramids;
+      ImGui::SameLine();
+      if (ImGui::Button("Add to plot") && active_label != label && std::none_of(extra_pins.begin(), extra_pins.end(), [](auto& pin){ return pin.first == monitor_pin; })) {
+        extra_pins.push_back({monitor_pin, active_label});
+      }
+      for (auto pin = extra_pins.begin(); pin != extra_pins.end();) {
+        ImGui::PushID(pin->first);
+        bool remove = ImGui::SmallButton("x");
+        ImGui::PopID();
+        ImGui::SameLine();
+        ImGui::TextUnformatted(pin->second);
+        if (remove) pin = extra_pins.erase(pin);
+        else ++pin;
+      }
+
+      std::vector<std::pair<pin_type, const char*>> plotted { {monitor_pin, active_label} };
+      for (auto& pin : extra_pins) if (pin.first != monitor_pin) plotted.push_back(pin);
+      for (auto pyramid = pyramids.begin(); pyramid != pyramids.end();) {
+        if (std::none_of(plotted.begin(), plotted.end(), [&](auto& pin){ return pin.first == pyramid->first; })) pyramid = pyramids.erase(pyramid);
+        else ++pyramid;
+      }
 
-        pin_log_data last{};
-        for (auto v : Gpio::pin_map[monitor_pin].event_log) {
-          if (last.timestamp) sdata.AddPoint(v.timestamp, last.value);
-          sdata.AddPoint(v.timestamp, v.value);
-          last = v;
+      // protocol decoders, each track is drawn as a lane under the pins
+      static std::vector<std::unique_ptr<SignalDecoder>> decoders;
+      static SignalDecoder* export_decoder = nullptr;
+      if (ImGui::TreeNode("Decoders")) {
+        static int decoder_type = SignalDecoder::SPI;
+        ImGui::PushItemWidth(200);
+        if (ImGui::BeginCombo("##DecoderType", SignalDecoder::type_name(SignalDecoder::Type(decoder_type)))) {
+          for (int type = 0; type < SignalDecoder::TYPE_COUNT; type++) {
+            if (ImGui::Selectable(SignalDecoder::type_name(SignalDecoder::Type(type)), type == decoder_type)) decoder_type = type;
+          }
+          ImGui::EndCombo();
         }
-        sdata.AddPoint(Kernel::SimulationRuntime::nanos(),  last.value);
+        ImGui::SameLine();
+        if (ImGui::Button("Add decoder")) decoders.push_back(SignalDecoder::create(SignalDecoder::Type(decoder_type)));
+
+        for (auto decoder = decoders.begin(); decoder != decoders.end();) {
+          ImGui::PushID(decoder->get());
+          bool remove = ImGui::SmallButton("x");
+          ImGui::SameLine();
+          ImGui::TextUnformatted(SignalDecoder::type_name((*decoder)->type));
+          bool changed = false;
+          for (auto& input : (*decoder)->inputs) {
+            auto selected = std::find_if(std::begin(pin_array), std::end(pin_array), [&](auto& pin){ return pin.pin == input.pin; });
+            if (ImGui::BeginCombo(input.role, input.pin >= 0 && selected != std::end(pin_array) ? selected->name : "-")) {
+              if (input.optional && ImGui::Selectable("-", input.pin < 0)) {
+                input.pin = -1;
+                changed = true;
+              }
+              for (auto p : pin_array) {
+                if (ImGui::Selectable(p.name, p.pin == input.pin)) {
+                  input.pin = p.pin;
+                  changed = true;
+                }
+              }
+              ImGui::EndCombo();
+            }
+          }
+          for (auto& parameter : (*decoder)->parameters) {
+            changed |= ImGui::InputDouble(parameter.name, &parameter.value, 0, 0, "%g", ImGuiInputTextFlags_EnterReturnsTrue);
+          }
+          if (changed) (*decoder)->reset();
+          if (ImGui::Button("Export to CSV")) {
+            export_decoder = decoder->get();
+            IGFD::FileDialogConfig config { "." };
+            config.flags |= ImGuiFileDialogFlags_Modal;
+            ImGuiFileDialog::Instance()->OpenDialog("DecoderExportDlgKey", "Choose File", "Comma Separated Values (*.csv){.csv},.*", config);
+          }
+          ImGui::PopID();
+          if (remove) {
+            if (export_decoder == decoder->get()) export_decoder = nullptr;
+            decoder = decoders.erase(decoder);
+          }
+          else ++decoder;
+        }
+        ImGui::PopItemWidth();
+        ImGui::TreePop();
+      }
+      if (ImGuiFileDialog::Instance()->Display("DecoderExportDlgKey", ImGuiWindowFlags_NoDocking)) {
+        if (ImGuiFileDialog::Instance()->IsOk() && export_decoder) export_decoder->export_csv(ImGuiFileDialog::Instance()->GetFilePathName());
+        ImGuiFileDialog::Instance()->Close();
+      }
+
+      // decoding follows the traces whether or not the tracks are in view, only new events are read
+      uint64_t decode_time = Kernel::SimulationRuntime::nanos();
+      std::vector<std::pair<SignalDecoder*, std::size_t>> decoded;
+      std::vector<std::string> decoded_names;
+      for (auto& decoder : decoders) {
+        if (!decoder->ready()) continue;
+        decoder->update(decode_time);
+        if (!decoder->complete(decode_time)) ImGui::Text("Decoding %s...", SignalDecoder::type_name(decoder->type));
+        for (std::size_t track = 0; track < decoder->tracks.size(); track++) {
+          decoded.push_back({decoder.get(), track});
+          decoded_names.push_back(std::string(SignalDecoder::type_name(decoder->type)) + " " + decoder->tracks[track].name);
+        }
+      }
 
+      if (!Gpio::trace(monitor_pin).empty()) {
         static float window = 10000000000.0f;
         ImGui::SliderFloat("Window", &window, 10.f, 100000000000.f,"%.0f ns", ImGuiSliderFlags_Logarithmic);
         static float offset = 0.0f;
         ImGui::SliderFloat("X offset", &offset, 0.f, 10000000000.f,"%.0f ns");
         ImGui::SliderFloat("X offset##2", &offset, 0.f, 100000000000.f,"%.0f ns");
-        if (ImPlot::BeginPlot("##SignalAnalyser", ImVec2(-1,150))) {
-          ImPlot::SetupAxes(NULL, NULL, ImPlotAxisFlags_NoTickLabels | ImPlotAxisFlags_LockMin, ImPlotAxisFlags_NoTickLabels | ImPlotAxisFlags_LockMin);
-          ImPlot::SetupAxisLimits(ImAxis_X1, Kernel::SimulationRuntime::nanos() - window - offset, Kernel::SimulationRuntime::nanos() - offset, ImGuiCond_Always);
-          ImPlot::SetupAxisLimits(ImAxis_Y1,0,1.4);
-          ImPlot::SetNextFillStyle(IMPLOT_AUTO_COL,0.5f);
-          ImPlot::PlotLine(active_label, &sdata.Data[0].x, &sdata.Data[0].y, sdata.Data.size(), 0, sdata.Offset, sizeof(ImPlotPoint));
+
+        uint64_t now = Kernel::SimulationRuntime::nanos();
+        uint64_t view_end = now - std::min(now, uint64_t(offset));
+        uint64_t view_start = view_end - std::min(view_end, uint64_t(window));
+        auto pixels = std::size_t(std::max(1.0f, ImGui::GetContentRegionAvail().x));
+
+        constexpr double lane_height = 1.5;
+        std::size_t lanes = plotted.size() + decoded.size();
+        std::vector<double> lane_ticks;
+        std::vector<const char*> lane_labels;
+        for (std::size_t i = 0; i < lanes; i++) {
+          lane_ticks.push_back((lanes - 1 - i) * lane_height + 0.5);
+          lane_labels.push_back(i < plotted.size() ? plotted[i].second : decoded_names[i - plotted.size()].c_str());
+        }
+
+        if (ImPlot::BeginPlot("##SignalAnalyser", ImVec2(-1, 110 + 40 * lanes))) {
+          ImPlot::SetupAxes(NULL, NULL, ImPlotAxisFlags_NoTickLabels | ImPlotAxisFlags_LockMin, ImPlotAxisFlags_LockMin);
+          ImPlot::SetupAxisLimits(ImAxis_X1, view_start, view_end, ImGuiCond_Always);
+          ImPlot::SetupAxisLimits(ImAxis_Y1, 0, lanes * lane_height - 0.1, ImGuiCond_Always);
+          ImPlot::SetupAxisTicks(ImAxis_Y1, lane_ticks.data(), int(lane_ticks.size()), lane_labels.data());
+
+          // each pin is drawn from its min/max pyramid, the cost follows the plot width rather than the event count
+          static std::vector<SignalPyramid::Point> points;
+          for (std::size_t i = 0; i < plotted.size(); i++) {
+            auto& trace = Gpio::trace(plotted[i].first);
+            auto& pyramid = pyramids[plotted[i].first];
+            pyramid.update(trace, now);
+            auto info = std::find_if(std::begin(pin_array), std::end(pin_array), [&](auto& pin){ return pin.pin == plotted[i].first; });
+            double scale = info == std::end(pin_array) || info->is_digital ? 1.0 : 1.0 / 4095.0;
+            pyramid.query(trace, view_start, std::min(view_end, now), pixels, scale, (lanes - 1 - i) * lane_height, points);
+            if (points.empty()) continue;
+            ImPlot::PlotLine(plotted[i].second, &points[0].x, &points[0].y, int(points.size()), 0, 0, sizeof(SignalPyramid::Point));
+          }
+
+          static std::vector<SignalDecoder::Point> track_points;
+          static std::vector<SignalDecoder::Text> track_texts;
+          for (std::size_t i = 0; i < decoded.size(); i++) {
+            double lane_offset = (decoded.size() - 1 - i) * lane_height;
+            decoded[i].first->query(decoded[i].second, view_start, std::min(view_end, now), pixels, lane_offset, 1.0, track_points, track_texts);
+            if (track_points.empty()) continue;
+            ImPlot::PlotLine((decoded_names[i] + "##decoder" + std::to_string(i)).c_str(), &track_points[0].x, &track_points[0].y, int(track_points.size()), 0, 0, sizeof(SignalDecoder::Point));
+            for (auto& text : track_texts) ImPlot::PlotText(text.text, text.x, lane_offset + 0.5);
+          }
           ImPlot::EndPlot();
         }
       }
 
       IGFD::FileDialogConfig config { "." };
       config.flags |= ImGuiFileDialogFlags_Modal;
-      static bool export_single_pin = false;
+      enum ExportMode { SELECTED_PIN, MATCHING_PINS, RECORD_MATCHING_PINS };
+      static ExportMode export_mode = SELECTED_PIN;
+      static PinExport exporter;
+      ImGui::BeginDisabled(exporter.busy());
       if (ImGui::Button("Export selected pin to file")) {
-        export_single_pin = true;
-
+        export_mode = SELECTED_PIN;
         ImGuiFileDialog::Instance()->OpenDialog("PulseExportDlgKey", "Choose File", "Value Change Dump (*.vcd){.vcd},.*", config);
       }
 
       if (ImGui::Button("Export pins matching regex to file")) {
-        export_single_pin = false;
+        export_mode = MATCHING_PINS;
         ImGuiFileDialog::Instance()->OpenDialog("PulseExportDlgKey", "Choose File", "Value Change Dump (*.vcd){.vcd},.*", config);
       }
+      ImGui::EndDisabled();
 
       static char export_regex[128] = "";
       ImGui::SameLine();
       ImGui::InputText("Pin regex", export_regex, sizeof(export_regex));
 
+      if (exporter.recording()) {
+        if (ImGui::Button("Stop recording")) exporter.stop();
+        ImGui::SameLine();
+        ImGui::Text("%llu changes recorded", (unsigned long long)exporter.changes());
+      } else if (exporter.busy()) {
+        ImGui::ProgressBar(exporter.progress(), ImVec2(200, 0));
+        ImGui::SameLine();
+        if (ImGui::Button("Cancel")) exporter.stop();
+      } else {
+        if (ImGui::Button("Record pins matching regex to file")) {
+          export_mode = RECORD_MATCHING_PINS;
+          ImGuiFileDialog::Instance()->OpenDialog("PulseExportDlgKey", "Choose File", "Value Change Dump (*.vcd){.vcd},.*", config);
+        }
+        auto status = exporter.status();
+        if (status.size()) {
+          ImGui::SameLine();
+          ImGui::TextUnformatted(status.c_str());
+        }
+      }
+
       if (ImGuiFileDialog::Instance()->Display("PulseExportDlgKey", ImGuiWindowFlags_NoDocking))  {
         try {
           if (ImGuiFileDialog::Instance()->IsOk()) {
             std::string image_filename = ImGuiFileDialog::Instance()->GetFilePathName();
+            std::vector<PinExport::Signal> signals;
 
-            using namespace vcd;
-
-            HeadPtr head = makeVCDHeader(static_cast<TimeScale>(50), TimeScaleUnit::ns, utils::now());
-            VCDWriter writer {image_filename, head};
-
-            if (export_single_pin) {
-              std::string pin_name(active_label);
-              auto scope = pin_name.substr(0, pin_name.find_first_of('_'));
-              auto var   = writer.register_var(scope, pin_name, VariableType::wire, 1);
-
-              if (Gpio::pin_map[monitor_pin].event_log.size() && pin_array[monitor_pin].is_digital) {
-                for (const auto& value : Gpio::pin_map[monitor_pin].event_log) {
-                  writer.change(var, value.timestamp / 50, utils::format("%u", value.value));
-                }
-              }
+            if (export_mode == SELECTED_PIN) {
+              if (pin_array[monitor_pin].is_digital) signals.push_back({monitor_pin, active_label});
             } else {
-              std::map<size_t, VarPtr> pin_to_var_map;
               std::regex expression(export_regex);
-
               for (auto pin : pin_array) {
                 std::string pin_name(pin.name);
                 bool regex_match = strlen(export_regex) == 0 || std::regex_search(pin_name, expression);
-                auto scope       = pin_name.substr(0, pin_name.find_first_of('_'));
-                if (pin.is_digital && regex_match) pin_to_var_map[pin.pin] = writer.register_var(scope, pin_name, VariableType::wire, 1);
-              }
-
-              std::multimap<uint64_t, std::pair<pin_t, uint16_t>> timestamp_pin_change_map;
-
-              for (auto pin : pin_array) {
-                if (pin.is_digital && pin_to_var_map.find(pin.pin) != pin_to_var_map.end())
-                  for (const auto& data : Gpio::pin_map[pin.pin].event_log) {
-                    timestamp_pin_change_map.emplace(std::make_pair(data.timestamp, std::make_pair(pin.pin, data.value)));
-                  }
-              }
-
-              auto timestamp_offset = timestamp_pin_change_map.begin()->first;
-              for (const auto& timestamp : timestamp_pin_change_map) {
-                writer.change(pin_to_var_map[timestamp.second.first], (timestamp.first - timestamp_offset) / 50, utils::format("%u", timestamp.second.second));
+                if (pin.is_digital && regex_match) signals.push_back({pin_type(pin.pin), pin_name});
               }
             }
+
+            if (export_mode == RECORD_MATCHING_PINS) exporter.record(image_filename, signals);
+            else exporter.export_file(image_filename, signals);
           }
         } catch (const std::exception& e) {
           logger::error("Error exporting VCD file: %s", e.what());
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cctype>
+#include <cstdlib>
+#include <map>
+#include <limits>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <algorithm>
+
+/**
+ * Host protocol response parsing and per-command round-trip tracking.
+ *
+ * Commands and responses are fed in the order they cross the simulated serial line,
+ * each `ok` is matched to the oldest outstanding command, or to the command with the
+ * matching line number when the firmware reports one (ADVANCED_OK).
+ */
+struct HostResponse {
+  enum Type {
+    UNKNOWN,
+    OK,
+    ECHO,
+    BUSY,
+    HOST_INFO,
+    POSITION,
+    TEMPERATURE,
+    RESEND,
+    ERROR
+  };
+
+  Type type = UNKNOWN;
+  int64_t line_number = -1;
+  bool has_temperature = false;  // "ok T:..." carries a temperature report as well
+
+  static bool starts_with(std::string_view value, std::string_view prefix) {
+    return value.substr(0, prefix.size()).compare(prefix) == 0;
+  }
+
+  static int64_t parse_line_number(std::string_view value, char prefix) {
+    auto index = value.find(prefix);
+    if (index == std::string_view::npos || index + 1 >= value.size() || !std::isdigit(value[index + 1])) return -1;
+    return std::strtoll(std::string(value.substr(index + 1, 20)).c_str(), nullptr, 10);
+  }
+
+  static HostResponse parse(std::string_view line) {
+    HostResponse response{};
+    while (line.size() && (line.back() == '\r' || line.back() == '\n')) line.remove_suffix(1);
+
+    if (starts_with(line, "ok")) {
+      response.type = OK;
+      if (line.size() > 2) {
+        // ADVANCED_OK: "ok N<line> P<planner> B<buffer>"
+        response.line_number = parse_line_number(line.substr(2), 'N');
+        response.has_temperature = line.find("T:") != std::string_view::npos;
+      }
+    }
+    else if (starts_with(line, "//")) response.type = HOST_INFO;
+    else if (starts_with(line, "echo:busy")) response.type = BUSY;
+    else if (starts_with(line, "echo")) response.type = ECHO;
+    else if (starts_with(line, "X:")) response.type = POSITION;
+    else if (starts_with(line, " T:") || starts_with(line, "T:")) response.type = TEMPERATURE;
+    else if (starts_with(line, "Resend:") || starts_with(line, "rs ")) {
+      response.type = RESEND;
+      response.line_number = parse_line_number(line, ':');
+      if (response.line_number < 0) response.line_number = parse_line_number(line, 'N');
+    }
+    else if (starts_with(line, "Error:")) response.type = ERROR;
+    return response;
+  }
+};
+
+class CommandLatencyTracker {
+public:
+  static constexpr std::size_t max_samples_per_code = 4096;
+  static constexpr std::size_t max_pending = 1024;
+
+  struct Sample {
+    int64_t line_number;
+    uint64_t sent, latency;  // nanoseconds of simulated time
+  };
+
+  struct CodeStatistics {
+    uint64_t count = 0, total = 0;
+    uint64_t min = std::numeric_limits<uint64_t>::max(), max = 0;
+    std::deque<Sample> samples;
+
+    void record(const Sample& sample) {
+      count++;
+      total += sample.latency;
+      min = std::min(min, sample.latency);
+      max = std::max(max, sample.latency);
+      samples.push_back(sample);
+      if (samples.size() > max_samples_per_code) samples.pop_front();
+    }
+
+    double mean() const { return count ? double(total) / count : 0.0; }
+
+    // percentile of the retained samples, 0.0 - 1.0
+    uint64_t percentile(double p) const {
+      if (samples.empty()) return 0;
+      std::vector<uint64_t> sorted;
+      sorted.reserve(samples.size());
+      for (const auto& sample : samples) sorted.push_back(sample.latency);
+      auto index = std::min(sorted.size() - 1, std::size_t(p * (sorted.size() - 1) + 0.5));
+      std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+      return sorted[index];
+    }
+  };
+
+  // Extract the command word ("G1", "M109", "T0") and optional line number from a line of G-code
+  static bool parse_command(std::string_view line, std::string& code, int64_t& line_number) {
+    auto skip_space = [&line](){ while (line.size() && std::isspace((unsigned char)line.front())) line.remove_prefix(1); };
+    line = line.substr(0, std::min(line.find(';'), line.find('*')));
+    line_number = -1;
+    skip_space();
+    if (line.size() > 1 && std::toupper((unsigned char)line.front()) == 'N' && std::isdigit((unsigned char)line[1])) {
+      std::size_t end = 1;
+      while (end < line.size() && std::isdigit((unsigned char)line[end])) end++;
+      line_number = std::strtoll(std::string(line.substr(1, end - 1)).c_str(), nullptr, 10);
+      line.remove_prefix(end);
+      skip_space();
+    }
+    if (line.empty() || !std::isalpha((unsigned char)line.front())) return false;
+
+    code.clear();
+    code.push_back(std::toupper((unsigned char)line.front()));
+    for (std::size_t i = 1; i < line.size() && (std::isdigit((unsigned char)line[i]) || line[i] == '.'); i++) code.push_back(line[i]);
+    return true;
+  }
+
+  void command_sent(std::string_view line, uint64_t timestamp) {
+    std::string code;
+    int64_t line_number = -1;
+    if (!parse_command(line, code, line_number)) return; // Marlin does not acknowledge empty or comment only lines
+
+    std::scoped_lock lock(data_mutex);
+    pending.push_back({code, line_number, timestamp});
+    if (pending.size() > max_pending) {
+      pending.pop_front();
+      dropped++;
+    }
+  }
+
+  void response_received(const HostResponse& response, uint64_t timestamp) {
+    if (response.type != HostResponse::OK) return;
+    std::scoped_lock lock(data_mutex);
+    if (pending.empty()) {
+      unmatched++;
+      return;
+    }
+
+    if (response.line_number >= 0) {
+      // drop anything older than the acknowledged line, those were lost or rejected
+      auto match = std::find_if(pending.begin(), pending.end(), [&response](const PendingCommand& cmd){ return cmd.line_number == response.line_number; });
+      if (match != pending.end()) {
+        dropped += std::distance(pending.begin(), match);
+        pending.erase(pending.begin(), match);
+      }
+    }
+
+    const auto& command = pending.front();
+    statistics[command.code].record({command.line_number, command.sent, timestamp > command.sent ? timestamp - command.sent : 0});
+    pending.pop_front();
+  }
+
+  void clear() {
+    std::scoped_lock lock(data_mutex);
+    pending.clear();
+    statistics.clear();
+    dropped = unmatched = 0;
+  }
+
+  bool export_csv(const std::string& filename) {
+    std::scoped_lock lock(data_mutex);
+    FILE* fp = fopen(filename.c_str(), "w");
+    if (fp == nullptr) return false;
+    fprintf(fp, "code,line,sent_ns,latency_ns\n");
+    for (const auto& [code, stats] : statistics) {
+      for (const auto& sample : stats.samples) {
+        fprintf(fp, "%s,%lld,%llu,%llu\n", code.c_str(), (long long)sample.line_number, (unsigned long long)sample.sent, (unsigned long long)sample.latency);
+      }
+    }
+    fclose(fp);
+    return true;
+  }
+
+  struct PendingCommand {
+    std::string code;
+    int64_t line_number;
+    uint64_t sent;
+  };
+
+  std::mutex data_mutex;
+  std::deque<PendingCommand> pending;
+  std::map<std::string, CodeStatistics> statistics;
+  uint64_t dropped = 0, unmatched = 0;
+};
@@ -0,0 +1,175 @@
+#include "emergency_latency.h"
+#include "execution_control.h"
+#include "hardware/Gpio.h"
+
+#include <algorithm>
+
+std::vector<int16_t> EmergencyLatency::step_pins, EmergencyLatency::enable_pins, EmergencyLatency::heater_pins;
+std::deque<EmergencyLatency::Injection> EmergencyLatency::pending;
+std::size_t EmergencyLatency::outstanding = 0;
+uint64_t EmergencyLatency::last_step_tick = 0;
+std::string EmergencyLatency::host_line[4], EmergencyLatency::firmware_line[4];
+std::deque<EmergencyLatency::HostCommand> EmergencyLatency::unacknowledged[4];
+uint64_t EmergencyLatency::command_sequence[4] = {};
+std::mutex EmergencyLatency::results_mutex;
+std::map<std::string, CommandLatencyTracker::CodeStatistics> EmergencyLatency::statistics;
+uint64_t EmergencyLatency::injection_count[COMMAND_COUNT] = {};
+
+void EmergencyLatency::observe(const std::vector<int16_t>& steps, const std::vector<int16_t>& enables, const std::vector<int16_t>& heaters) {
+  step_pins = steps;
+  enable_pins = enables;
+  heater_pins = heaters;
+
+  for (auto pin : step_pins) {
+    Gpio::attach(pin, [](GpioEvent& event) { last_step_tick = event.timestamp; }, GpioEvent::mask(GpioEvent::RISE));
+  }
+  for (auto pin : enable_pins) {
+    Gpio::attach(pin, [](GpioEvent& event) {
+      if (outstanding && steppers_disabled()) observed(STEPPERS_DISABLED, event.timestamp);
+    }, GpioEvent::mask(GpioEvent::RISE, GpioEvent::FALL));
+  }
+  for (auto pin : heater_pins) {
+    Gpio::attach(pin, [](GpioEvent& event) {
+      if (outstanding && heaters_off()) observed(HEATERS_OFF, event.timestamp);
+    }, GpioEvent::mask(GpioEvent::RISE, GpioEvent::FALL, GpioEvent::SET_VALUE));
+  }
+}
+
+// StepperDriver treats a low enable pin as enabled
+bool EmergencyLatency::steppers_disabled() {
+  return std::all_of(enable_pins.begin(), enable_pins.end(), [](auto pin){ return Gpio::get_pin_value(pin) != 0; });
+}
+
+bool EmergencyLatency::heaters_off() {
+  return std::all_of(heater_pins.begin(), heater_pins.end(), [](auto pin){ return Gpio::get_pin_value(pin) == 0; });
+}
+
+template <typename Callback>
+static void split_lines(std::string& working, const uint8_t* data, std::size_t length, Callback callback) {
+  for (std::size_t i = 0; i < length; i++) {
+    if (data[i] == '\n' || data[i] == '\r') {
+      if (working.size()) callback(std::string_view(working));
+      working.clear();
+    } else if (working.size() < 96) working.push_back(data[i]);
+  }
+}
+
+void EmergencyLatency::host_bytes(uint8_t port, uint64_t tick, const uint8_t* data, std::size_t length) {
+  split_lines(host_line[port & 3], data, length, [port, tick](std::string_view line) {
+    std::string code;
+    int64_t line_number = -1;
+    if (!CommandLatencyTracker::parse_command(line, code, line_number)) return;
+    if (code == "M112") inject(M112, port, tick);
+    else if (code == "M108") inject(M108, port, tick);
+    else if (code == "M410") inject(M410, port, tick);
+
+    // queued after the injection, M108 releases the command ahead of it and not itself
+    auto& commands = unacknowledged[port & 3];
+    const bool releasable = std::find(std::begin(releasable_codes), std::end(releasable_codes), code) != std::end(releasable_codes);
+    commands.push_back({++command_sequence[port & 3], line_number, releasable});
+    if (commands.size() > max_unacknowledged) commands.pop_front();
+  });
+}
+
+// Every "ok" is matched to the command it answers, an M108 outstanding or not, so the command a later M108
+// releases is known
+void EmergencyLatency::firmware_bytes(uint8_t port, uint64_t tick, const uint8_t* data, std::size_t length) {
+  split_lines(firmware_line[port & 3], data, length, [port, tick](std::string_view line) {
+    if (HostResponse::starts_with(line, "ok")) acknowledged(port, HostResponse::parse(line), tick);
+    if (outstanding && (line.find("Printer halted") != std::string_view::npos || line.find("kill()") != std::string_view::npos)) observed(KILL_REPORTED, tick);
+  });
+}
+
+void EmergencyLatency::acknowledged(uint8_t port, const HostResponse& response, uint64_t tick) {
+  auto& commands = unacknowledged[port & 3];
+  if (commands.empty()) return;
+  if (response.line_number >= 0) {
+    // anything older than the acknowledged line was lost or rejected
+    auto match = std::find_if(commands.begin(), commands.end(), [&response](const HostCommand& command){ return command.line_number == response.line_number; });
+    if (match != commands.end()) commands.erase(commands.begin(), match);
+  }
+  const uint64_t sequence = commands.front().sequence;
+  commands.pop_front();
+  if (outstanding) observed(RELEASED, tick, port, sequence);
+}
+
+void EmergencyLatency::inject(Command command, uint8_t port, uint64_t tick) {
+  Injection injection { command, port, tick, 0, 0 };
+  switch (command) {
+    case M112:
+      if (!steppers_disabled()) injection.waiting |= 1 << STEPPERS_DISABLED;
+      if (!heaters_off()) injection.waiting |= 1 << HEATERS_OFF;
+      injection.waiting |= 1 << KILL_REPORTED;
+      break;
+    case M108: {
+      // the command executing is the oldest one not yet acknowledged, nothing to release unless it waits
+      auto& commands = unacknowledged[port & 3];
+      if (commands.size() && commands.front().releasable) {
+        injection.blocking = commands.front().sequence;
+        injection.waiting |= 1 << RELEASED;
+      }
+      break;
+    }
+    case M410:
+      if (tick - std::min(tick, last_step_tick) < Kernel::TimeControl::nanosToTicks(quiet_period)) injection.waiting |= 1 << MOTION_STOPPED;
+      break;
+    default: break;
+  }
+
+  {
+    std::scoped_lock lock(results_mutex);
+    injection_count[command]++;
+  }
+  if (injection.waiting) {
+    pending.push_back(injection);
+    outstanding = pending.size();
+  }
+}
+
+void EmergencyLatency::record(const Injection& injection, Effect effect, uint64_t tick) {
+  auto name = std::string(command_names[injection.command]) + " " + effect_names[effect];
+  auto latency = Kernel::TimeControl::ticksToNanos(tick > injection.tick ? tick - injection.tick : 0);
+  std::scoped_lock lock(results_mutex);
+  statistics[name].record({-1, Kernel::TimeControl::ticksToNanos(injection.tick), latency});
+}
+
+void EmergencyLatency::observed(Effect effect, uint64_t tick, int port, uint64_t sequence) {
+  for (auto& injection : pending) {
+    if (!(injection.waiting & (1 << effect)) || (port >= 0 && injection.port != port) || tick < injection.tick) continue;
+    if (effect == RELEASED && injection.blocking != sequence) continue;
+    record(injection, effect, tick);
+    injection.waiting &= ~(1 << effect);
+  }
+  pending.erase(std::remove_if(pending.begin(), pending.end(), [](auto& injection){ return injection.waiting == 0; }), pending.end());
+  outstanding = pending.size();
+}
+
+void EmergencyLatency::resolve(uint64_t tick) {
+  const auto quiet_ticks = Kernel::TimeControl::nanosToTicks(quiet_period);
+  const auto timeout_ticks = Kernel::TimeControl::nanosToTicks(timeout);
+  for (auto& injection : pending) {
+    if ((injection.waiting & (1 << MOTION_STOPPED)) && tick - std::min(tick, last_step_tick) >= quiet_ticks) {
+      record(injection, MOTION_STOPPED, std::max(last_step_tick, injection.tick));
+      injection.waiting &= ~(1 << MOTION_STOPPED);
+    }
+    if (tick - injection.tick > timeout_ticks) injection.waiting = 0;
+  }
+  pending.erase(std::remove_if(pending.begin(), pending.end(), [](auto& injection){ return injection.waiting == 0; }), pending.end());
+  outstanding = pending.size();
+}
+
+std::map<std::string, CommandLatencyTracker::CodeStatistics> EmergencyLatency::results() {
+  std::scoped_lock lock(results_mutex);
+  return statistics;
+}
+
+uint64_t EmergencyLatency::injections(Command command) {
+  std::scoped_lock lock(results_mutex);
+  return injection_count[command];
+}
+
+void EmergencyLatency::clear() {
+  std::scoped_lock lock(results_mutex);
+  statistics.clear();
+  std::fill(std::begin(injection_count), std::end(injection_count), 0);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "command_latency.h"
+
+/**
+ * Measures how long M112, M108 and M410 take to have an effect on the simulated hardware.
+ *
+ * The clock starts when the terminating byte of the command line is written into the firmware's
+ * HalSerial::receive_buffer, and stops when the effect is first observed:
+ *   M112  steppers disabled (all enable pins inactive), heaters off (all heater pins low),
+ *         kill reported ("Printer halted" / "kill()" on the serial port)
+ *   M108  the blocking command released, the "ok" for the wait (M0/M1, M109, M190, ...) that was
+ *         executing when M108 arrived, matched by line number as CommandLatencyTracker does
+ *   M410  motion stopped, the last step pulse before no step pulse is seen for quiet_period
+ * An effect that is already true when the command arrives is not recorded.
+ *
+ * Everything except results()/clear() is called from the simulation thread.
+ */
+class EmergencyLatency {
+public:
+  enum Command : uint8_t { M112, M108, M410, COMMAND_COUNT };
+  enum Effect : uint8_t { STEPPERS_DISABLED, HEATERS_OFF, KILL_REPORTED, RELEASED, MOTION_STOPPED, EFFECT_COUNT };
+
+  static constexpr const char* command_names[COMMAND_COUNT] = {"M112", "M108", "M410"};
+  static constexpr const char* effect_names[EFFECT_COUNT] = {"steppers disabled", "heaters off", "kill reported", "released", "motion stopped"};
+
+  static constexpr uint64_t quiet_period = 5'000'000;       // ns without step pulses for motion to count as stopped
+  static constexpr uint64_t timeout = 10'000'000'000;       // ns before an unobserved effect is abandoned
+  static constexpr std::size_t max_unacknowledged = 1024;    // per port, commands sent and not yet answered with "ok"
+
+  // Commands that wait on wait_for_user or wait_for_heatup, the waits M108 ends
+  static constexpr const char* releasable_codes[] = {"M0", "M1", "M109", "M190", "M191", "M192", "M303", "M125", "M600"};
+
+  // Registered once the printer is built, the observer attaches to these pins
+  static void observe(const std::vector<int16_t>& step_pins, const std::vector<int16_t>& enable_pins, const std::vector<int16_t>& heater_pins);
+
+  // Serial hooks, host -> firmware bytes as they enter receive_buffer, firmware -> host bytes as they leave transmit_buffer
+  static void host_bytes(uint8_t port, uint64_t tick, const uint8_t* data, std::size_t length);
+  static void firmware_bytes(uint8_t port, uint64_t tick, const uint8_t* data, std::size_t length);
+
+  // Resolves time based effects, called every kernel loop, returns immediately when nothing is outstanding
+  static void poll(uint64_t tick) {
+    if (outstanding) resolve(tick);
+  }
+
+  // Snapshot for the UI, keyed "<command> <effect>"
+  static std::map<std::string, CommandLatencyTracker::CodeStatistics> results();
+  static uint64_t injections(Command command);
+  static void clear();
+
+private:
+  struct Injection {
+    Command command;
+    uint8_t port;
+    uint64_t tick;
+    uint32_t waiting;  // bitmask of effects not yet observed
+    uint64_t blocking; // M108, sequence number of the command it releases
+  };
+
+  struct HostCommand {
+    uint64_t sequence;
+    int64_t line_number;
+    bool releasable;
+  };
+
+  static void inject(Command command, uint8_t port, uint64_t tick);
+  static void observed(Effect effect, uint64_t tick, int port = -1, uint64_t sequence = 0);
+  static void acknowledged(uint8_t port, const HostResponse& response, uint64_t tick);
+  static void resolve(uint64_t tick);
+  static void record(const Injection& injection, Effect effect, uint64_t tick);
+
+  static bool steppers_disabled();
+  static bool heaters_off();
+
+  static std::vector<int16_t> step_pins, enable_pins, heater_pins;
+  static std::deque<Injection> pending;
+  static std::size_t outstanding;
+  static uint64_t last_step_tick;
+  static std::string host_line[4], firmware_line[4];
+  static std::deque<HostCommand> unacknowledged[4];
+  static uint64_t command_sequence[4];
+
+  static std::mutex results_mutex;
+  static std::map<std::string, CommandLatencyTracker::CodeStatistics> statistics;
+  static uint64_t injection_count[COMMAND_COUNT];
+};
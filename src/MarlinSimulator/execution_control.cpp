@@ -6,6 +6,11 @@
 #include "execution_control.h"
 #include "serial.h"
 #include "RawSocketSerial.h"
+#include "serial_capture.h"
+#include "emergency_latency.h"
+#include "gpio_benchmark.h"
+#include "trigger_capture.h"
+#include "hardware/pwm.h"
 
 extern RawSocketSerial net_serial;
 extern MSerialT serial_stream_0;
@@ -37,6 +42,28 @@ bool Kernel::is_initialized(bool known_state) {
   return is_running;
 }
 
+// Move pending bytes between a firmware serial port and its terminal, passing them through the terminal taps
+template <typename TransmitCallback = std::nullptr_t>
+static void serial_exchange(uint8_t port, MSerialT& stream, SerialMonitor& terminal, TransmitCallback on_transmit = nullptr) {
+  static uint8_t buffer[1024];
+  std::size_t count = 0;
+  while ((count = stream.transmit_buffer.read(buffer, std::min(std::size(buffer), terminal.serial_buffer.in.free())))) {
+    serial_capture::record(port, serial_capture::FIRMWARE_TO_HOST, Kernel::TimeControl::getTicks(), buffer, count);
+    EmergencyLatency::firmware_bytes(port, Kernel::TimeControl::getTicks(), buffer, count);
+    if (TriggerCapture::active()) TriggerCapture::serial_bytes(port, true, Kernel::SimulationRuntime::nanos(), buffer, count);
+    terminal.serial_buffer.in.write(buffer, count);
+    if constexpr (!std::is_same_v<TransmitCallback, std::nullptr_t>) on_transmit(buffer, count);
+    if (terminal.on_firmware_transmit) terminal.on_firmware_transmit(buffer, count);
+  }
+  while ((count = terminal.serial_buffer.out.read(buffer, std::min(std::size(buffer), stream.receive_buffer.free())))) {
+    stream.receive_buffer.write(buffer, count);
+    serial_capture::record(port, serial_capture::HOST_TO_FIRMWARE, Kernel::TimeControl::getTicks(), buffer, count);
+    EmergencyLatency::host_bytes(port, Kernel::TimeControl::getTicks(), buffer, count);
+    if (TriggerCapture::active()) TriggerCapture::serial_bytes(port, false, Kernel::SimulationRuntime::nanos(), buffer, count);
+    if (terminal.on_firmware_receive) terminal.on_firmware_receive(buffer, count);
+  }
+}
+
 bool Kernel::execute_loop( uint64_t max_end_ticks) {
   // Marlin often gets into reentrant loops, this is the only way to unroll out of that call stack early
   if (quit_requested) throw (std::runtime_error("Quit Requested"));
@@ -46,43 +73,35 @@ bool Kernel::execute_loop( uint64_t max_end_ticks) {
   TimeControl::realtime_sync();
 
   static auto terminal_0 = UserInterface::getElement<SerialMonitor>("Serial Monitor(0)");
-  if (terminal_0) {
-    serial_stream_0.transmit_buffer.read(terminal_0->serial_buffer.in);
-    terminal_0->serial_buffer.out.read(serial_stream_0.receive_buffer);
-  }
+  if (terminal_0) serial_exchange(0, serial_stream_0, *terminal_0);
 
   static auto terminal_1 = UserInterface::getElement<SerialMonitor>("Serial Monitor(1)");
-  if (terminal_1) {
-    serial_stream_1.transmit_buffer.read(terminal_1->serial_buffer.in);
-    terminal_1->serial_buffer.out.read(serial_stream_1.receive_buffer);
-  }
+  if (terminal_1) serial_exchange(1, serial_stream_1, *terminal_1);
 
   static auto terminal_2 = UserInterface::getElement<SerialMonitor>("Serial Monitor(2)");
-  if (terminal_2) {
-    serial_stream_2.transmit_buffer.read(terminal_2->serial_buffer.in);
-    terminal_2->serial_buffer.out.read(serial_stream_2.receive_buffer);
-  }
+  if (terminal_2) serial_exchange(2, serial_stream_2, *terminal_2);
 
   static auto terminal_3 = UserInterface::getElement<SerialMonitor>("Serial Monitor(3)");
   if (terminal_3) {
-    if (serial_stream_3.transmit_buffer.available()) {
-      static uint8_t buffer[1024];
-      auto count = serial_stream_3.transmit_buffer.read(buffer, std::size(buffer));
-      terminal_3->serial_buffer.in.write(buffer, count);
-      {
-        std::scoped_lock buffer_lock(net_serial.buffer_mutex);
-        net_serial.tx_buffer.write(buffer, count);
-      }
-    }
-    terminal_3->serial_buffer.out.read(serial_stream_3.receive_buffer);
+    serial_exchange(3, serial_stream_3, *terminal_3, [](const uint8_t* data, std::size_t count){
+      std::scoped_lock buffer_lock(net_serial.buffer_mutex);
+      net_serial.tx_buffer.write(data, count);
+    });
   }
 
   if (net_serial.available()) {
     static char buffer[1024];
     std::scoped_lock buffer_lock(net_serial.buffer_mutex);
     auto count = net_serial.readBytes(buffer, std::size(buffer));
-    serial_stream_3.receive_buffer.write((uint8_t *)buffer, count);
+    auto written = serial_stream_3.receive_buffer.write((uint8_t *)buffer, count);
+    serial_capture::record(3, serial_capture::HOST_TO_FIRMWARE, TimeControl::getTicks(), (uint8_t *)buffer, written);
+    EmergencyLatency::host_bytes(3, TimeControl::getTicks(), (uint8_t *)buffer, written);
+    if (TriggerCapture::active()) TriggerCapture::serial_bytes(3, false, SimulationRuntime::nanos(), (uint8_t *)buffer, written);
   }
+  EmergencyLatency::poll(TimeControl::getTicks());
+  GpioBenchmark::poll();
+  if (TriggerCapture::capturing()) TriggerCapture::poll(SimulationRuntime::nanos());
+  Pwm::sync(SimulationRuntime::nanos());
 
 
   uint64_t current_ticks = TimeControl::getTicks();
@@ -105,6 +124,7 @@ bool Kernel::execute_loop( uint64_t max_end_ticks) {
   if (next_isr != nullptr ) {
     if (current_ticks > lowest_isr) {
       isr_timing_error = TimeControl::ticksToNanos(current_ticks - lowest_isr);
+      if (TriggerCapture::active()) TriggerCapture::isr_timing(TimeControl::ticksToNanos(current_ticks), isr_timing_error);
       next_isr->source_offset = current_ticks; // late interrupt
     } else {
       next_isr->source_offset = next_isr->next_interrupt(TimeControl::frequency); // timer was reset when the interrupt fired
@@ -0,0 +1,105 @@
+#include "gpio_benchmark.h"
+#include "hardware/Gpio.h"
+
+#include <chrono>
+
+std::vector<GpioBenchmark::Target> GpioBenchmark::target_list;
+std::atomic<int32_t> GpioBenchmark::requested {-1};
+uint32_t GpioBenchmark::requested_pulses = 0;
+std::mutex GpioBenchmark::result_mutex;
+GpioBenchmark::Result GpioBenchmark::last_result;
+
+void GpioBenchmark::add_target(int16_t step, int16_t dir) {
+  if (Gpio::valid_pin(step) && Gpio::valid_pin(dir)) target_list.push_back({step, dir});
+}
+
+bool GpioBenchmark::request(std::size_t target, uint32_t pulses) {
+  if (target >= target_list.size() || pulses == 0 || pending() || Gpio::isLoggingEnabled()) return false;
+  requested_pulses = (pulses + 1) & ~1u;  // an even count leaves the stepper where it started
+  requested.store(int32_t(target), std::memory_order_release);
+  return true;
+}
+
+GpioBenchmark::Result GpioBenchmark::result() {
+  std::scoped_lock lock(result_mutex);
+  return last_result;
+}
+
+// The dispatch Gpio::set() used before listeners declared event types, kept here as the baseline
+static void legacy_set(const pin_type pin, const uint16_t value) {
+  uint16_t previous = Gpio::get_pin_value(pin);
+  if (value == previous) return;
+  GpioEvent::Type type = value > previous ? GpioEvent::RISE : GpioEvent::FALL;
+  Gpio::set_pin_value(pin, value);
+  GpioEvent evt(Kernel::TimeControl::getTicks(), pin, type);
+  for (auto listener : Gpio::listeners(pin)) listener.callback(evt);
+}
+
+// Every stepper pulsed in turn, as the stepper ISR does on a multi axis move, so the sets hop between pins
+// instead of hammering one, followed by the step and dir pin reads the firmware does between pulses
+void GpioBenchmark::stepper_workload(uint32_t pulses, Result& result) {
+  std::vector<uint16_t> saved;
+  for (auto& target : target_list) {
+    saved.push_back(Gpio::get_pin_value(target.step));
+    saved.push_back(Gpio::get_pin_value(target.dir));
+    Gpio::set_pin_value(target.step, 0);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < pulses; i++) {
+    for (auto& target : target_list) Gpio::set_pin_value(target.dir, i & 1);
+    for (auto& target : target_list) Gpio::set(target.step, 1);
+    for (auto& target : target_list) Gpio::set(target.step, 0);
+  }
+  auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  result.all_steppers_ns = elapsed / (pulses * 2.0 * target_list.size());
+
+  volatile uint32_t sink = 0;  // keeps the reads from being optimised away
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < pulses; i++) {
+    uint32_t sum = 0;
+    for (auto& target : target_list) sum += Gpio::get_pin_value(target.step) + Gpio::get_pin_value(target.dir);
+    sink = sink + sum;
+  }
+  elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  result.read_ns = elapsed / (pulses * 2.0 * target_list.size());
+
+  for (std::size_t i = 0; i < target_list.size(); i++) {
+    Gpio::set_pin_value(target_list[i].dir, saved[i * 2 + 1]);
+    Gpio::set_pin_value(target_list[i].step, saved[i * 2]);
+  }
+}
+
+void GpioBenchmark::run() {
+  auto target = target_list[requested.load(std::memory_order_acquire)];
+  auto pulses = requested_pulses;
+  const uint16_t step_value = Gpio::get_pin_value(target.step), dir_value = Gpio::get_pin_value(target.dir);
+
+  auto measure = [&](auto set) {
+    Gpio::set_pin_value(target.step, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < pulses; i++) {
+      Gpio::set_pin_value(target.dir, i & 1);
+      set(target.step, 1);
+      set(target.step, 0);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (pulses * 2.0);
+  };
+
+  Result result;
+  result.step = target.step;
+  result.listeners = Gpio::listeners(target.step).size();
+  result.events = uint64_t(pulses) * 2;
+  result.steppers = target_list.size();
+  result.dispatch_ns = measure([](pin_type pin, uint16_t value){ Gpio::set(pin, value); });
+  result.legacy_ns = measure(legacy_set);
+
+  Gpio::set_pin_value(target.dir, dir_value);
+  Gpio::set_pin_value(target.step, step_value);
+  stepper_workload(pulses, result);
+  {
+    std::scoped_lock lock(result_mutex);
+    last_result = result;
+  }
+  requested.store(-1, std::memory_order_release);
+}
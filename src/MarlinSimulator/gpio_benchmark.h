@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/**
+ * Microbenchmark of Gpio::set() on a stepper's step pin, with every listener the printer attached to it.
+ *
+ * The UI requests a run, the simulation thread executes it from Kernel::execute_loop so the firmware is
+ * not running while the pin is toggled. The dir pin is flipped before every rising edge so the stepper
+ * ends where it started, and both pins are restored afterwards. The same pulses are then replayed through
+ * the previous dispatch (every listener copied and called for every event) for comparison. A stepper heavy
+ * workload follows, every target pulsed round-robin the same number of times and then every step and dir
+ * pin read, which is what the pin table layout is tuned for.
+ */
+class GpioBenchmark {
+public:
+  struct Target {
+    int16_t step, dir;
+  };
+
+  struct Result {
+    int16_t step = -1;
+    std::size_t listeners = 0;
+    uint64_t events = 0;
+    double dispatch_ns = 0;  // per Gpio::set() call
+    double legacy_ns = 0;    // per event through the copying, unfiltered loop
+    std::size_t steppers = 0;
+    double all_steppers_ns = 0;  // per Gpio::set() call, stepping every target in turn
+    double read_ns = 0;          // per Gpio::get_pin_value() call over every step and dir pin
+  };
+
+  static void add_target(int16_t step, int16_t dir);
+  static const std::vector<Target>& targets() { return target_list; }
+
+  // UI thread, refused while a run is pending or pin logging is enabled (the run would pollute the logs)
+  static bool request(std::size_t target, uint32_t pulses);
+  static bool pending() { return requested.load(std::memory_order_relaxed) >= 0; }
+  static Result result();
+
+  // Simulation thread
+  static void poll() {
+    if (pending()) run();
+  }
+
+private:
+  static void run();
+  static void stepper_workload(uint32_t pulses, Result& result);
+
+  static std::vector<Target> target_list;
+  static std::atomic<int32_t> requested;
+  static uint32_t requested_pulses;
+  static std::mutex result_mutex;
+  static Result last_result;
+};
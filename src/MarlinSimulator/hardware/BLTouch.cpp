@@ -15,7 +15,7 @@
 
 void BLTouchProbe::interrupt(GpioEvent& ev) {
   if (ev.pin_id == m_servo_pin) {
-    auto angle = dutycycle_to_degrees(m_servo->pwm_duty);
+    auto angle = dutycycle_to_degrees(m_servo->duty() * std::numeric_limits<uint16_t>::max());
     if (is_close_enough(angle, BLTOUCH_DEPLOY)) {
       m_probe->enabled = true;
       m_deployed = true;
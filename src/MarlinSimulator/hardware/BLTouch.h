@@ -18,7 +18,7 @@ public:
     m_servo_pin = servo_pin;
     m_servo = add_component<PWMReader>("PWM Control Signal", servo_pin);
     m_probe = add_component<BedProbe>("Probe Signal", probe_pin, offset, position, bed);
-    Gpio::attach(servo_pin, [this](GpioEvent& event){ this->interrupt(event); });
+    Gpio::attach(servo_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::RISE, GpioEvent::FALL, GpioEvent::SET_VALUE));
   }
   virtual ~BLTouchProbe() {}
 
@@ -28,7 +28,7 @@ public:
     } else {
       ImGui::Text("Probe Stowed");
     }
-    ImGui::Text("Command Angle: %d", dutycycle_to_degrees(m_servo->pwm_duty));
+    ImGui::Text("Command Angle: %d", dutycycle_to_degrees(m_servo->duty() * std::numeric_limits<uint16_t>::max()));
   }
 
   void interrupt(GpioEvent& ev);
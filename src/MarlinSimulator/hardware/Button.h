@@ -10,7 +10,7 @@
 class Button : public VirtualPrinter::Component {
 public:
   Button(pin_type pin, bool invert_logic) : VirtualPrinter::Component("Button"), pin(pin), invert_logic(invert_logic) {
-    Gpio::attach(pin, [this](GpioEvent& ev){ this->interrupt(ev); });
+    Gpio::attach(pin, [this](GpioEvent& ev){ this->interrupt(ev); }, GpioEvent::mask(GpioEvent::GET_VALUE));
   }
   ~Button() {}
 
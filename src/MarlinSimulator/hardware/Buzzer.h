@@ -12,7 +12,7 @@
 class Buzzer : public VirtualPrinter::Component {
 public:
   Buzzer(pin_type pin, bool invert_logic) : VirtualPrinter::Component("Buzzer"), pin(pin), invert_logic(invert_logic) {
-    Gpio::attach(pin, [this](GpioEvent& ev){ this->interrupt(ev); });
+    Gpio::attach(pin, [this](GpioEvent& ev){ this->interrupt(ev); }, GpioEvent::mask(GpioEvent::RISE, GpioEvent::FALL));
 
     audio_set_sample_cb([this](void* userdata, Uint8* sample_buffer, int samples_buffer_size){
       std::scoped_lock lock(events_mutex);
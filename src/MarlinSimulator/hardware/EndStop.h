@@ -10,7 +10,7 @@
 class EndStop : public VirtualPrinter::Component {
 public:
   EndStop(pin_type endstop, bool invert_logic, std::function<bool()> triggered) : VirtualPrinter::Component("EndStop"), endstop(endstop), invert_logic(invert_logic), triggered(triggered) {
-    Gpio::attach(endstop, [this](GpioEvent& ev){ this->interrupt(ev); });
+    Gpio::attach(endstop, [this](GpioEvent& ev){ this->interrupt(ev); }, GpioEvent::mask(GpioEvent::GET_VALUE));
   }
   ~EndStop() {}
 
@@ -0,0 +1,84 @@
+#include "Gpio.h"
+
+#include <gl.h>
+#include "../renderer/renderer.h"
+
+#include "../imgui_custom.h"
+
+#include "FsmcTftDevice.h"
+
+#define DCS_READ_ID   0x04 // Read Display Identification
+#define DCS_CASET     0x2A // Column Address Set
+#define DCS_RASET     0x2B // Row Address Set
+#define DCS_RAMWR     0x2C // Memory Write
+#define DCS_READ_ID4  0xD3 // Read ID4, dummy, 0x00, then the controller id
+
+FsmcTftDevice::FsmcTftDevice(FsmcBus& fsmc_bus, SpiBus& touch_spi_bus, pin_type touch_cs, pin_type beeper, pin_type enc1, pin_type enc2, pin_type enc_but, pin_type back, pin_type kill)
+  : fsmc_bus(fsmc_bus), panel(beeper, enc1, enc2, enc_but, back, kill) {
+  touch = add_component<XPT2046Device>("Touch", touch_spi_bus, touch_cs);
+  fsmc_bus.attach(this);
+}
+
+FsmcTftDevice::~FsmcTftDevice() {
+  fsmc_bus.detach(this);
+}
+
+void FsmcTftDevice::process_command() {
+  if (command == DCS_CASET && data.size() >= 4) {
+    framebuffer.set_columns((data[0] << 8) + data[1], (data[2] << 8) + data[3]);
+  }
+  else if (command == DCS_RASET && data.size() >= 4) {
+    framebuffer.set_rows((data[0] << 8) + data[1], (data[2] << 8) + data[3]);
+  }
+}
+
+void FsmcTftDevice::update() {
+  framebuffer.upload();
+}
+
+// A register write ends the previous command, so its parameters are complete
+void FsmcTftDevice::write_register(uint16_t value) {
+  process_command();
+  data.clear();
+  read_queue.clear();
+  command = value & 0xFF;
+  switch (command) {
+    case DCS_RAMWR:
+      framebuffer.start_write();
+      break;
+    case DCS_READ_ID:
+      read_queue = {0x00, 0x00, 0x00, 0x00};
+      break;
+    case DCS_READ_ID4:
+      read_queue = {0x00, 0x00, 0x77, 0x96};
+      break;
+    default:
+      break;
+  }
+}
+
+void FsmcTftDevice::write_data(uint16_t value) {
+  if (command == DCS_RAMWR) framebuffer.write_pixels(&value, 1);
+  else data.push_back(value & 0xFF);
+}
+
+void FsmcTftDevice::write_block(const uint16_t* _data, size_t count, bool increment) {
+  if (command != DCS_RAMWR) return FsmcBus::Device::write_block(_data, count, increment);
+  if (increment) framebuffer.write_pixels(_data, count);
+  else framebuffer.fill(*_data, count);
+}
+
+uint16_t FsmcTftDevice::read_data() {
+  if (read_queue.empty()) return 0;
+  auto value = read_queue.front();
+  read_queue.pop_front();
+  return value;
+}
+
+void FsmcTftDevice::ui_init() {
+  framebuffer.ui_init();
+}
+
+void FsmcTftDevice::ui_widget() {
+  panel.ui_widget("FsmcTftDevice", framebuffer, *touch);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <SDL2/SDL.h>
+#include "../user_interface.h"
+
+#include <deque>
+#include <vector>
+#include "Gpio.h"
+#include "bus/fsmc.h"
+#include "bus/spi.h"
+
+#include "../virtual_printer.h"
+#include "XPT2046Device.h"
+#include "tft_framebuffer.h"
+#include "tft_front_panel.h"
+
+#ifndef TFT_WIDTH
+  #define TFT_WIDTH 480
+#endif
+#ifndef TFT_HEIGHT
+  #define TFT_HEIGHT 320
+#endif
+
+/**
+ * An ST7796 class MIPI DCS controller on a 16 bit FSMC bank. Commands arrive as register writes and their
+ * parameters as data writes, one byte in the low half of each word. After RAMWR every data word is a
+ * pixel, block writes go to the framebuffer in one call with no per-word bus event.
+ */
+class FsmcTftDevice: public VirtualPrinter::Component, public FsmcBus::Device {
+public:
+  FsmcTftDevice(FsmcBus& fsmc_bus, SpiBus& touch_spi_bus, pin_type touch_cs, pin_type beeper, pin_type enc1, pin_type enc2, pin_type enc_but, pin_type back, pin_type kill);
+  virtual ~FsmcTftDevice();
+  void process_command();
+  void update();
+
+  void ui_init() override;
+  void ui_widget() override;
+
+  void write_register(uint16_t value) override;
+  void write_data(uint16_t value) override;
+  void write_block(const uint16_t* data, size_t count, bool increment) override;
+  uint16_t read_data() override;
+
+  static constexpr uint32_t width = TFT_WIDTH, height = TFT_HEIGHT;
+
+  FsmcBus& fsmc_bus;
+  TftFrontPanel panel;
+
+  uint16_t command = 0;
+  std::vector<uint8_t> data;
+  std::deque<uint16_t> read_queue;
+
+  TftFramebuffer framebuffer {width, height};
+
+  std::shared_ptr<XPT2046Device> touch;
+};
@@ -1,4 +1,54 @@
+#include <chrono>
+
 #include "Gpio.h"
 
-pin_data Gpio::pin_map[Gpio::pin_count] = {};
+Gpio::PinState Gpio::pin_state[Gpio::pin_count] = {};
+std::unique_ptr<std::vector<pin_data::Listener>> Gpio::pin_listeners[Gpio::pin_count];
+std::unique_ptr<PinTrace> Gpio::traces[Gpio::pin_count];
+Gpio::PinCounters Gpio::counters[Gpio::pin_count] = {};
+uint64_t Gpio::statistics_since = 0, Gpio::statistics_host_since = 0;
 bool Gpio::logging_enabled = false;
+bool Gpio::statistics_enabled = false;
+uint32_t Gpio::port_groups = 0;
+
+static uint64_t host_nanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Gpio::invoke_measured(const pin_type pin, const pin_data::Listener& listener, GpioEvent& evt) {
+  uint64_t start = host_nanos();
+  listener.callback(evt);
+  counters[pin].callbacks.fetch_add(1, std::memory_order_relaxed);
+  counters[pin].callback_ns.fetch_add(host_nanos() - start, std::memory_order_relaxed);
+}
+
+void Gpio::resetStatistics() {
+  for (auto& pin : counters) {
+    pin.changes = 0;
+    for (auto& count : pin.events) count = 0;
+    pin.callbacks = 0;
+    pin.callback_ns = 0;
+  }
+  statistics_since = Kernel::SimulationRuntime::nanos();
+  statistics_host_since = host_nanos();
+}
+
+Gpio::PinStatistics Gpio::statistics(const pin_type pin) {
+  PinStatistics result;
+  if (!valid_pin(pin)) return result;
+  auto& source = counters[pin];
+  result.changes = source.changes.load(std::memory_order_relaxed);
+  for (std::size_t i = 0; i < std::size(result.events); i++) result.events[i] = source.events[i].load(std::memory_order_relaxed);
+  result.callbacks = source.callbacks.load(std::memory_order_relaxed);
+  result.callback_ns = source.callback_ns.load(std::memory_order_relaxed);
+  return result;
+}
+
+uint64_t Gpio::statisticsSimulatedTime() {
+  uint64_t now = Kernel::SimulationRuntime::nanos();
+  return now > statistics_since ? now - statistics_since : 0;
+}
+
+uint64_t Gpio::statisticsHostTime() {
+  return host_nanos() - statistics_host_since;
+}
@@ -1,12 +1,16 @@
 #pragma once
 
 #include <cstdint>
+#include <algorithm>
 #include <atomic>
 #include <functional>
+#include <initializer_list>
+#include <memory>
 #include <vector>
-#include <deque>
 
 #include "../execution_control.h"
+#include "../trigger_capture.h"
+#include "pin_trace.h"
 #include "src/inc/MarlinConfigPre.h"
 
 
@@ -20,13 +24,21 @@ struct GpioEvent {
     SET_VALUE,
     SETM,
     SETD,
-    GET_VALUE
+    GET_VALUE,
+    PORT  // one per write to a group of pins attached with Gpio::attach_port()
   };
   uint64_t timestamp;
   pin_type pin_id;
   GpioEvent::Type event;
 
   GpioEvent(uint64_t timestamp, pin_type pin_id, GpioEvent::Type event) : timestamp(timestamp), pin_id(pin_id), event(event) { }
+
+  // Event type subscription mask, a listener is only called for the types it subscribed to
+  typedef uint8_t Mask;
+  template<class... Types>
+  static constexpr Mask mask(Types... types) { return Mask(((1 << types) | ...)); }
+  // every per pin type, PORT is only delivered to listeners added with Gpio::attach_port()
+  static constexpr Mask ALL = Mask(0xFF & ~(1 << PORT));
 };
 
 class IOLogger {
@@ -35,11 +47,6 @@ public:
   virtual void log(GpioEvent ev) = 0;
 };
 
-struct pin_log_data {
-  uint64_t timestamp;
-  uint16_t value;
-};
-
 struct pin_data {
   enum Mode {
     GPIO,
@@ -62,19 +69,19 @@ struct pin_data {
     LOW,
     HIGH
   };
-  template<class... Args>
-  bool attach(Args... args) {
-    callbacks.push_back(std::function<void(GpioEvent&)>(args...));
-    return true;
-  }
-  std::atomic_uint8_t pull;
-  std::atomic_uint8_t dir;
-  std::atomic_uint8_t mode;
-  std::atomic_uint16_t value;
-  std::vector<std::function<void(GpioEvent&)>> callbacks;
-  std::deque<pin_log_data> event_log;
+  struct Listener {
+    GpioEvent::Mask events;
+    std::function<void(GpioEvent&)> callback;
+    uint32_t group = 0;  // shared by the pins of one port listener
+  };
 };
 
+/**
+ * The pin table is split by access frequency. Everything Gpio::set() and get_pin_value() touch for a pin
+ * (value, subscription mask, mode, direction, pull) is a 6 byte entry in one dense array, ten pins to a
+ * cache line. Listener lists and traces are cold, kept in separate tables and only allocated for pins
+ * that get a listener, and once pin logging is first enabled.
+ */
 class Gpio {
 public:
 
@@ -82,22 +89,22 @@ public:
 
   static void set_pin_value(const pin_type pin, const uint16_t value) {
     if (!valid_pin(pin)) return;
-    if (value != pin_map[pin].value) { // Optimizes for size, but misses "meaningless" sets
-      pin_map[pin].value = value;
-      if (logging_enabled) {
-        pin_map[pin].event_log.push_back(pin_log_data{Kernel::SimulationRuntime::nanos(), pin_map[pin].value});
-        if (pin_map[pin].event_log.size() > 100000) pin_map[pin].event_log.pop_front();
-      }
+    auto& state = pin_state[pin];
+    uint16_t previous = state.value;
+    if (value != previous) { // Optimizes for size, but misses "meaningless" sets
+      state.value = value;
+      if (statistics_enabled) count_change(pin);
+      record_change(pin, value, previous);
     }
   }
 
   static uint16_t get_pin_value(const pin_type pin) {
     if (!valid_pin(pin)) return 0;
-    return pin_map[pin].value;
+    return pin_state[pin].value;
   }
 
   static inline constexpr bool valid_pin(const pin_type pin) {
-    return pin >= 0 && pin <= pin_count;
+    return pin >= 0 && pin < pin_count;
   }
 
   static inline void set(const pin_type pin) {
@@ -106,23 +113,68 @@ public:
 
   static void set(const pin_type pin, const uint16_t value) {
     if (!valid_pin(pin)) return;
-    if (value != pin_map[pin].value) { // Optimizes for size, but misses "meaningless" sets
-      GpioEvent::Type evt_type = value > 1 ? GpioEvent::SET_VALUE : value > pin_map[pin].value ? GpioEvent::RISE : value < pin_map[pin].value ? GpioEvent::FALL : GpioEvent::NOP;
-      pin_map[pin].value = value;
-      GpioEvent evt(Kernel::TimeControl::getTicks(), pin, evt_type);
-      if (logging_enabled) {
-        pin_map[pin].event_log.push_back(pin_log_data{Kernel::SimulationRuntime::nanos(), pin_map[pin].value});
-        if (pin_map[pin].event_log.size() > 100000) pin_map[pin].event_log.pop_front();
-      }
-      for (auto callback : pin_map[pin].callbacks) callback(evt);
+    auto& state = pin_state[pin];
+    uint16_t previous = state.value;
+    if (value != previous) { // Optimizes for size, but misses "meaningless" sets
+      GpioEvent::Type evt_type = value > 1 ? GpioEvent::SET_VALUE : value > previous ? GpioEvent::RISE : value < previous ? GpioEvent::FALL : GpioEvent::NOP;
+      state.value = value;
+      if (statistics_enabled) count_change(pin);
+      record_change(pin, value, previous);
+      dispatch(pin, evt_type, true);
+    }
+  }
+
+  // Sets the pins selected by `mask` at one timestamp, bit n of mask and value drives pins[n] (up to 32 pins).
+  // Every pin is updated and logged before any listener or trigger runs, so none sees a partly written bus.
+  // Per pin listeners get their usual RISE/FALL, a port listener one PORT event however many of its pins changed.
+  static void write_port(const pin_type* pins, std::size_t count, const uint32_t mask, const uint32_t value) {
+    GpioEvent::Type types[32];
+    uint16_t previous_levels[32];
+    uint32_t changed = 0;
+    const bool triggers = TriggerCapture::active();
+    const uint64_t timestamp = logging_enabled || triggers ? Kernel::SimulationRuntime::nanos() : 0;
+    count = std::min<std::size_t>(count, 32);
+    for (std::size_t i = 0; i < count; i++) {
+      if (!(mask & (1u << i)) || !valid_pin(pins[i])) continue;
+      auto& state = pin_state[pins[i]];
+      uint16_t level = (value >> i) & 1, previous = state.value;
+      if (level == previous) continue;
+      state.value = level;
+      if (logging_enabled) traces[pins[i]]->append(timestamp, level);
+      if (statistics_enabled) count_change(pins[i]);
+      types[i] = level > previous ? GpioEvent::RISE : GpioEvent::FALL;
+      previous_levels[i] = previous;
+      changed |= 1u << i;
+    }
+    if (!changed) return;
+    // a pattern trigger reads the other pins, it has to see the whole write
+    for (std::size_t i = 0; triggers && i < count; i++) {
+      if (changed & (1u << i)) TriggerCapture::pin_changed(pins[i], timestamp, (value >> i) & 1, previous_levels[i]);
+    }
+    for (std::size_t i = 0; i < count; i++) {
+      if (changed & (1u << i)) dispatch(pins[i], types[i]);
+    }
+    uint32_t notified[32];
+    std::size_t notified_count = 0;
+    for (std::size_t i = 0; i < count; i++) {
+      if (changed & (1u << i)) dispatch_port(pins[i], notified, notified_count);
     }
   }
 
+  // The levels of up to 32 pins, pins[n] in bit n, without raising GET_VALUE events
+  static uint32_t read_port(const pin_type* pins, std::size_t count) {
+    uint32_t value = 0;
+    count = std::min<std::size_t>(count, 32);
+    for (std::size_t i = 0; i < count; i++) {
+      if (valid_pin(pins[i]) && pin_state[pins[i]].value) value |= 1u << i;
+    }
+    return value;
+  }
+
   static uint16_t get(const pin_type pin) {
     if (!valid_pin(pin)) return 0;
-    GpioEvent evt(Kernel::TimeControl::getTicks(), pin, GpioEvent::GET_VALUE);
-    for (auto callback : pin_map[pin].callbacks) callback(evt);
-    return pin_map[pin].value;
+    dispatch(pin, GpioEvent::GET_VALUE);
+    return pin_state[pin].value;
   }
 
   static inline void clear(const pin_type pin) {
@@ -131,61 +183,89 @@ public:
 
   static void setMode(const pin_type pin, const uint8_t value) {
     if (!valid_pin(pin)) return;
-    pin_map[pin].mode = pin_data::Mode::GPIO;
+    pin_state[pin].mode = pin_data::Mode::GPIO;
 
     GpioEvent evt(Kernel::TimeControl::getTicks(), pin, GpioEvent::Type::SETM);
 
     if (value != 1) setDir(pin, pin_data::Direction::INPUT);
     else setDir(pin, pin_data::Direction::OUTPUT);
 
-    pin_map[pin].pull = value == 2 ? pin_data::Pull::PULLUP : value == 3 ? pin_data::Pull::PULLDOWN : pin_data::Pull::NONE;
-    if (pin_map[pin].pull == pin_data::Pull::PULLUP) set(pin, pin_data::State::HIGH);
+    pin_state[pin].pull = value == 2 ? pin_data::Pull::PULLUP : value == 3 ? pin_data::Pull::PULLDOWN : pin_data::Pull::NONE;
+    if (pin_state[pin].pull == pin_data::Pull::PULLUP) set(pin, pin_data::State::HIGH);
 
   }
 
   static inline uint8_t getMode(const pin_type pin) {
     if (!valid_pin(pin)) return 0;
-    return pin_map[pin].mode;
+    return pin_state[pin].mode;
   }
 
   static void setDir(const pin_type pin, const uint8_t value) {
     if (!valid_pin(pin)) return;
-    pin_map[pin].dir = value;
-    GpioEvent evt(Kernel::TimeControl::getTicks(), pin, GpioEvent::Type::SETD);
-    for (auto callback : pin_map[pin].callbacks) callback(evt);
+    pin_state[pin].dir = value;
+    dispatch(pin, GpioEvent::SETD);
   }
 
   static inline uint8_t getDir(const pin_type pin) {
     if (!valid_pin(pin)) return 0;
-    return pin_map[pin].dir;
+    return pin_state[pin].dir;
   }
 
   static void write(const pin_type pin, const uint16_t value) {
     if (!valid_pin(pin)) return;
-    pin_map[pin].value = value;
-    GpioEvent evt(Kernel::TimeControl::getTicks(), pin, GpioEvent::SET_VALUE);
-    for (auto callback : pin_map[pin].callbacks) callback(evt);
+    pin_state[pin].value = value;
+    dispatch(pin, GpioEvent::SET_VALUE);
   }
 
   static uint16_t read(const pin_type pin) {
     if (!valid_pin(pin)) return 0;
-    GpioEvent evt(Kernel::TimeControl::getTicks(), pin, GpioEvent::GET_VALUE);
-    for (auto callback : pin_map[pin].callbacks) callback(evt);
-    return pin_map[pin].value;
+    dispatch(pin, GpioEvent::GET_VALUE);
+    return pin_state[pin].value;
   }
 
-  template<class... Args>
-  static bool attach(const pin_type pin, Args... args) {
+  // Subscribe to the event types in `events` (GpioEvent::mask(GpioEvent::RISE, ...)), by default every event
+  static bool attach(const pin_type pin, std::function<void(GpioEvent&)> callback, const GpioEvent::Mask events = GpioEvent::ALL) {
     if (!valid_pin(pin)) return false;
-    return pin_map[pin].attach(args...);
+    add_listener(pin, {events, std::move(callback)});
+    return true;
+  }
+
+  // One listener for a group of pins, called once for every Gpio::set() or write_port() that changes any of them
+  static bool attach_port(std::initializer_list<pin_type> pins, std::function<void(GpioEvent&)> callback) {
+    uint32_t group = ++port_groups;
+    bool attached = false;
+    for (auto pin : pins) {
+      if (!valid_pin(pin)) continue;
+      add_listener(pin, {GpioEvent::mask(GpioEvent::PORT), callback, group});
+      attached = true;
+    }
+    return attached;
+  }
+
+  static const std::vector<pin_data::Listener>& listeners(const pin_type pin) {
+    static const std::vector<pin_data::Listener> none;
+    return valid_pin(pin) && pin_listeners[pin] ? *pin_listeners[pin] : none;
+  }
+
+  // Empty until pin logging is first enabled
+  static const PinTrace& trace(const pin_type pin) {
+    static const PinTrace none;
+    return valid_pin(pin) && traces[pin] ? *traces[pin] : none;
+  }
+
+  // Appends to the trace without changing the pin, for peripherals that synthesise their edges
+  static void log(const pin_type pin, const uint64_t timestamp, const uint16_t value) {
+    if (logging_enabled && valid_pin(pin)) traces[pin]->append(timestamp, value);
   }
 
   static void resetLogs() {
-    for (auto &pin : pin_map) {
+    for (pin_type pin = 0; pin < pin_count; pin++) {
+      if (!traces[pin]) traces[pin] = std::make_unique<PinTrace>();
       // Seed each pin with an initial value to ensure important edges are not the first sample.
-      pin.event_log.clear();
-      pin.event_log.push_back(pin_log_data{Kernel::SimulationRuntime::nanos(), pin.value});
+      traces[pin]->clear();
+      traces[pin]->append(Kernel::SimulationRuntime::nanos(), pin_state[pin].value);
     }
+    PinTrace::reset_store();
   }
 
   static void setLoggingEnabled(bool enable) {
@@ -199,8 +279,107 @@ public:
     return logging_enabled;
   }
 
-  static pin_data pin_map[pin_count];
+  // Per pin load counters, only collected while enabled since the callback timing costs two clock reads
+  struct PinStatistics {
+    uint64_t changes = 0;                      // value changes, from any writer
+    uint64_t events[GpioEvent::PORT + 1] = {}; // raised, by GpioEvent::Type, PORT only when someone listens
+    uint64_t callbacks = 0;
+    uint64_t callback_ns = 0;                  // host time spent in the callbacks
+  };
+
+  static void setStatisticsEnabled(bool enable) {
+    if (!statistics_enabled && enable) resetStatistics();
+    statistics_enabled = enable;
+  }
+
+  static bool isStatisticsEnabled() {
+    return statistics_enabled;
+  }
+
+  static void resetStatistics();
+  static PinStatistics statistics(const pin_type pin);
+  // Simulated and host time covered by the counters, ns
+  static uint64_t statisticsSimulatedTime();
+  static uint64_t statisticsHostTime();
 
 private:
+  struct PinState {
+    std::atomic_uint16_t value;
+    GpioEvent::Mask subscribed;  // union of the listener masks, skips dispatch entirely for unwatched types
+    std::atomic_uint8_t mode;
+    std::atomic_uint8_t dir;
+    std::atomic_uint8_t pull;
+  };
+
+  // The timestamp is only worked out when a trace or an armed trigger needs it, every step edge comes through here
+  static inline void record_change(const pin_type pin, const uint16_t value, const uint16_t previous) {
+    if (!logging_enabled && !TriggerCapture::active()) return;
+    const uint64_t timestamp = Kernel::SimulationRuntime::nanos();
+    if (logging_enabled) traces[pin]->append(timestamp, value);
+    TriggerCapture::pin_changed(pin, timestamp, value, previous);
+  }
+
+  static void add_listener(const pin_type pin, pin_data::Listener listener) {
+    if (!pin_listeners[pin]) pin_listeners[pin] = std::make_unique<std::vector<pin_data::Listener>>();
+    pin_state[pin].subscribed |= listener.events;
+    pin_listeners[pin]->push_back(std::move(listener));
+  }
+
+  // Listeners are called in attach order, by reference and only for the event types they subscribed to.
+  // With `port` set, port listeners on the pin get their PORT event in the same pass.
+  static inline void dispatch(const pin_type pin, GpioEvent::Type type, bool port = false) {
+    const GpioEvent::Mask watched = pin_state[pin].subscribed;
+    bool subscribed = watched & (1 << type);
+    port = port && (watched & (1 << GpioEvent::PORT));
+    if (statistics_enabled) {
+      count_event(pin, type);
+      if (port) count_event(pin, GpioEvent::PORT);
+    }
+    if (!subscribed && !port) return;
+    const uint64_t ticks = Kernel::TimeControl::getTicks();
+    GpioEvent evt(ticks, pin, type), port_evt(ticks, pin, GpioEvent::PORT);
+    for (auto& listener : *pin_listeners[pin]) {
+      if (listener.events & (1 << type)) invoke(pin, listener, evt);
+      if (port && (listener.events & (1 << GpioEvent::PORT))) invoke(pin, listener, port_evt);
+    }
+  }
+
+  // PORT listeners whose group is in `notified` have already been called for this write
+  static inline void dispatch_port(const pin_type pin, uint32_t* notified, std::size_t& notified_count) {
+    if (!(pin_state[pin].subscribed & (1 << GpioEvent::PORT))) return;
+    if (statistics_enabled) count_event(pin, GpioEvent::PORT);
+    GpioEvent evt(Kernel::TimeControl::getTicks(), pin, GpioEvent::PORT);
+    for (auto& listener : *pin_listeners[pin]) {
+      if (!(listener.events & (1 << GpioEvent::PORT))) continue;
+      if (listener.group) {
+        if (std::find(notified, notified + notified_count, listener.group) != notified + notified_count) continue;
+        if (notified_count < 32) notified[notified_count++] = listener.group;
+      }
+      invoke(pin, listener, evt);
+    }
+  }
+
+  static inline void invoke(const pin_type pin, const pin_data::Listener& listener, GpioEvent& evt) {
+    if (statistics_enabled) invoke_measured(pin, listener, evt);
+    else listener.callback(evt);
+  }
+
+  struct PinCounters {
+    std::atomic<uint64_t> changes, events[GpioEvent::PORT + 1], callbacks, callback_ns;
+  };
+  static void count_change(const pin_type pin) { counters[pin].changes.fetch_add(1, std::memory_order_relaxed); }
+  static void count_event(const pin_type pin, GpioEvent::Type type) { counters[pin].events[type].fetch_add(1, std::memory_order_relaxed); }
+  static void invoke_measured(const pin_type pin, const pin_data::Listener& listener, GpioEvent& evt);
+
+  // hot
+  static PinState pin_state[pin_count];
+  // cold, allocated on first use
+  static std::unique_ptr<std::vector<pin_data::Listener>> pin_listeners[pin_count];
+  static std::unique_ptr<PinTrace> traces[pin_count];
+  static PinCounters counters[pin_count];
+  static uint64_t statistics_since, statistics_host_since;
+
   static bool logging_enabled;
+  static bool statistics_enabled;
+  static uint32_t port_groups;
 };
@@ -15,22 +15,18 @@
 #include <src/inc/MarlinConfig.h>
 
 HD44780Device::HD44780Device(pin_type rs, pin_type en, pin_type d4, pin_type d5, pin_type d6, pin_type d7, pin_type beeper, pin_type enc1, pin_type enc2, pin_type enc_but, pin_type back, pin_type kill)
-  : rs_pin(rs), en_pin(en), d4_pin(d4), d5_pin(d5), d6_pin(d6), d7_pin(d7), beeper_pin(beeper), enc1_pin(enc1), enc2_pin(enc2), enc_but_pin(enc_but), back_pin(back), kill_pin(kill) {
-
-  Gpio::attach(rs_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  data_is_command = !Gpio::get_pin_value(rs_pin); // make sure the initial state is updated
-  Gpio::attach(en_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  Gpio::attach(d4_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  Gpio::attach(d5_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  Gpio::attach(d6_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  Gpio::attach(d7_pin, [this](GpioEvent& event){ this->interrupt(event); });
-
-  Gpio::attach(beeper_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  Gpio::attach(enc1_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  Gpio::attach(enc2_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  Gpio::attach(enc_but_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  Gpio::attach(back_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  Gpio::attach(kill_pin, [this](GpioEvent& event){ this->interrupt(event); });
+  : rs_pin(rs), en_pin(en), d4_pin(d4), d5_pin(d5), d6_pin(d6), d7_pin(d7), beeper_pin(beeper), enc1_pin(enc1), enc2_pin(enc2), enc_but_pin(enc_but), back_pin(back), kill_pin(kill), bus_pins{d4, d5, d6, d7, rs, en} {
+
+  // one call per bus write, whether the driver sets the pins one at a time or with WRITE_PORT
+  Gpio::attach_port({d4_pin, d5_pin, d6_pin, d7_pin, rs_pin, en_pin}, [this](GpioEvent&){ this->bus_write(); });
+  bus_state = Gpio::read_port(bus_pins, bus_pin_count); // make sure the initial state is updated
+
+  Gpio::attach(beeper_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::RISE, GpioEvent::FALL));
+  Gpio::attach(enc1_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
+  Gpio::attach(enc2_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
+  Gpio::attach(enc_but_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
+  Gpio::attach(back_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
+  Gpio::attach(kill_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
 
   for (auto& pixel : texture_data) pixel = display_color;
 
@@ -142,32 +138,33 @@ void HD44780Device::update() {
   }
 }
 
-void HD44780Device::interrupt(GpioEvent& ev) {
-  if(ev.pin_id == en_pin && ev.event == GpioEvent::RISE) {
-    //read the bus
-    data_byte |= (Gpio::get_pin_value(d7_pin) << 3 | Gpio::get_pin_value(d6_pin) << 2 | Gpio::get_pin_value(d5_pin) << 1 |Gpio::get_pin_value(d4_pin)) << (4 * !data_low_nibble);
-    data_low_nibble = !data_low_nibble;
-    if (!data_low_nibble) {
-      dirty = true; // can't tell when the data transmission has ended? so set dirty on all received bytes
-      if (data_is_command) process_command(data_byte);
-      else {
-        if (state.active_address_space == state.DDRAM) {
-          ddram_buffer[state.address_counter] = data_byte;
-        } else {
-          cgram_buffer[state.address_counter] = data_byte;
-        }
-        state.update_address_counter();
-        if (state.display_shift_enabled) state.update_display_shift();
+// RS and the data nibble are latched on the rising edge of EN
+void HD44780Device::bus_write() {
+  const uint32_t previous = bus_state;
+  bus_state = Gpio::read_port(bus_pins, bus_pin_count);
+  if (!(bus_state & en_bit) || (previous & en_bit)) return;
+
+  data_is_command = !(bus_state & rs_bit);
+  data_byte |= (bus_state & 0x0F) << (4 * !data_low_nibble);
+  data_low_nibble = !data_low_nibble;
+  if (!data_low_nibble) {
+    dirty = true; // can't tell when the data transmission has ended? so set dirty on all received bytes
+    if (data_is_command) process_command(data_byte);
+    else {
+      if (state.active_address_space == state.DDRAM) {
+        ddram_buffer[state.address_counter] = data_byte;
+      } else {
+        cgram_buffer[state.address_counter] = data_byte;
       }
-      data_byte = 0;
+      state.update_address_counter();
+      if (state.display_shift_enabled) state.update_display_shift();
     }
-  } else if (ev.pin_id == rs_pin) {
-    if (ev.event == GpioEvent::RISE) {
-      data_is_command = false;
-    } else if (ev.event == GpioEvent::FALL) {
-      data_is_command = true;
-    }
-  } else if (ev.pin_id == beeper_pin) {
+    data_byte = 0;
+  }
+}
+
+void HD44780Device::interrupt(GpioEvent& ev) {
+  if (ev.pin_id == beeper_pin) {
     if (ev.event == GpioEvent::RISE) {
       // play sound
     } else if (ev.event == GpioEvent::FALL) {
@@ -34,6 +34,7 @@ public:
   virtual ~HD44780Device();
   void process_command(uint8_t cmd);
   void update();
+  void bus_write();
   void interrupt(GpioEvent& ev);
   void ui_init();
   void ui_widget();
@@ -77,6 +78,12 @@ public:
 
   pin_type rs_pin, en_pin, d4_pin, d5_pin, d6_pin, d7_pin, beeper_pin, enc1_pin, enc2_pin, enc_but_pin, back_pin, kill_pin;
 
+  // the parallel bus as one port, D4-D7 in bits 0-3, then RS and EN
+  static constexpr std::size_t bus_pin_count = 6;
+  static constexpr uint32_t rs_bit = 1 << 4, en_bit = 1 << 5;
+  pin_type bus_pins[bus_pin_count];
+  uint32_t bus_state = 0;
+
   uint32_t ddram_address = 0, cgram_address = 0;
   enum { DDRAM, CGRAM } active_address_space = DDRAM;
 
@@ -37,8 +37,8 @@ Heater::Heater(pin_type heater_pin, pin_type adc_pin, heater_data heater, hotend
   adc_resolution = adc.resolution;
   adc_pullup_resistance = adc.pullup_resistance;
 
-  Gpio::attach(this->adc_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  Gpio::attach(this->heater_pin, [this](GpioEvent& event){ this->interrupt(event); });
+  Gpio::attach(this->adc_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
+  Gpio::attach(this->heater_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::RISE, GpioEvent::FALL, GpioEvent::SET_VALUE));
   hotend_energy = hotend_ambient_temperature * (hotend_specific_heat * hotend_mass);
   hotend_temperature = hotend_ambient_temperature;
   static uint64_t elementid = 0;
@@ -65,11 +65,13 @@ void Heater::ui_widget() {
 void Heater::interrupt(GpioEvent& ev) {
   // always update the temperature
   double time_delta = Kernel::TimeControl::ticksToNanos(ev.timestamp - pwm_last_update) / (double)Kernel::TimeControl::ONE_BILLION;
-  double energy_in = ((heater_volts * heater_volts) / heater_resistance) * time_delta * Gpio::get_pin_value(heater_pin);
+  double energy_in = ((heater_volts * heater_volts) / heater_resistance) * time_delta * heater_duty;
   double energy_out = ((hotend_convection_transfer * hotend_surface_area * ( hotend_energy / (hotend_specific_heat * hotend_mass) - hotend_ambient_temperature)) * time_delta);
   hotend_energy += energy_in - energy_out;
   pwm_last_update = ev.timestamp;
   hotend_temperature = hotend_energy / (hotend_specific_heat * hotend_mass);
+  // software PWM is integrated edge by edge, a hardware channel at its average
+  heater_duty = Pwm::duty(heater_pin);
 
   if (ev.event == ev.RISE && ev.pin_id == heater_pin) {
     if (pwm_hightick) pwm_period = ev.timestamp - pwm_hightick;
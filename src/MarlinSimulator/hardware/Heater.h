@@ -55,6 +55,7 @@ public:
   uint64_t pwm_hightick = 0;
   uint64_t pwm_lowtick = 0;
   uint64_t pwm_last_update = 0;
+  double heater_duty = 0;  // average element drive since pwm_last_update, 0 - 1
 
   //hotend block
   double hotend_ambient_temperature = 25.0;
@@ -5,7 +5,7 @@
 
 NeoPixelDevice::NeoPixelDevice(pin_type neopixel_pin, const uint8_t led_type, const uint16_t led_count) : VirtualPrinter::Component("NeoPixel"), neopixel_pin(neopixel_pin), led_type(led_type), led_count(led_count) {
   bits_per_word = led_type == NEO_GRBW ? 32 : 24;
-  Gpio::attach(this->neopixel_pin, [this](GpioEvent& event){ this->interrupt(event); });
+  Gpio::attach(this->neopixel_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::RISE, GpioEvent::FALL));
 }
 
 NeoPixelDevice::~NeoPixelDevice() {
@@ -1,5 +1,10 @@
 
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+
 #include "SDCard.h"
+#include "../logger.h"
 #include <src/sd/SdInfo.h>
 
 constexpr char empty_disk_100[] =
@@ -71,33 +76,265 @@ constexpr char empty_disk_100[] =
 void SDCard::generate_empty_image(std::string filename) {
   auto fp = fopen(filename.c_str(), "w+b");
   fwrite(empty_disk_100, sizeof(empty_disk_100) - 1, 1, fp);
-  char zeros[512]{};
-  for (std::size_t i = 0; i < 195374; i++) {
-    fwrite(zeros, sizeof(zeros), 1, fp);
+  fclose(fp);
+  // the rest is zeros, extending the file leaves it sparse instead of writing them
+  std::error_code error;
+  std::filesystem::resize_file(filename, sizeof(empty_disk_100) - 1 + 195374 * 512, error);
+}
+
+constexpr uint8_t R1_ADDRESS_ERROR = 0x20;
+constexpr uint8_t DATA_ERROR_OUT_OF_RANGE = 0x08;  // data error token, in place of DATA_START_BLOCK
+constexpr uint8_t DATA_RES_WRITE_ERROR = 0x0D;
+constexpr uint32_t OCR_BUSY = 0x80000000, OCR_CCS = 0x40000000, OCR_VOLTAGE_WINDOW = 0x00FF8000;  // 2.7-3.6V
+constexpr std::size_t BLOCK_SIZE = 512;
+
+void SDCard::flush() {
+  if (!dirty()) return;
+  image.sync(dirty_begin, dirty_end - dirty_begin);
+  dirty_begin = dirty_end = 0;
+}
+
+uint64_t SDCard::card_size() {
+  return volume ? volume->block_count() * BLOCK_SIZE : image.size();
+}
+
+const uint8_t* SDCard::block_data(uint64_t block) {
+  if (overlay_active) {
+    auto entry = overlay.find(block);
+    if (entry != overlay.end()) return entry->second.data.data();
+  }
+  if (volume) return volume->block(block);
+  return image.data() + block * BLOCK_SIZE;
+}
+
+void SDCard::write_block_data(uint64_t block, const uint8_t* _data) {
+  if (!overlay_active) {
+    const std::size_t offset = block * BLOCK_SIZE;
+    memcpy(image.data() + offset, _data, BLOCK_SIZE);
+    dirty_begin = dirty() ? std::min(dirty_begin, offset) : offset;
+    dirty_end = std::max(dirty_end, offset + BLOCK_SIZE);
+    return;
+  }
+  std::scoped_lock lock(overlay_mutex);
+  auto [entry, inserted] = overlay.try_emplace(block);
+  // the whole block is written, nothing to copy from the image first
+  memcpy(entry->second.data.data(), _data, BLOCK_SIZE);
+  if (inserted) overlay_blocks++;
+  if (inserted || entry->second.committed) overlay_uncommitted++;
+  entry->second.committed = false;
+}
+
+void SDCard::commit_overlay() {
+  std::scoped_lock lock(overlay_mutex);
+  if (!overlay_uncommitted || volume) return;
+  MappedFile base;
+  if (!base.open(image.path())) return;
+  for (auto& [block, entry] : overlay) {
+    if (entry.committed || (block + 1) * BLOCK_SIZE > base.size()) continue;
+    memcpy(base.data() + block * BLOCK_SIZE, entry.data.data(), BLOCK_SIZE);
+    entry.committed = true;
+  }
+  base.sync();
+  overlay_uncommitted = 0;
+}
+
+// When a block access started now is done, with a stall drawn on top of the nominal time now and then
+uint64_t SDCard::ready_time(uint32_t nominal_us, uint64_t block, bool write) {
+  const uint64_t now = Kernel::SimulationRuntime::nanos();
+  uint64_t duration = uint64_t(nominal_us) * 1000;
+  if (latency.stall_chance > 0 && latency.stall_max_us > 0 && std::uniform_real_distribution<float>()(random) < latency.stall_chance) {
+    // log uniform, short stalls are common and the longest ones rare
+    const double low = std::log(std::max<uint32_t>(latency.stall_min_us, 1)), high = std::log(std::max(latency.stall_min_us, latency.stall_max_us));
+    const uint64_t stall = uint64_t(std::exp(std::uniform_real_distribution<double>(low, high)(random)) * 1000);
+    duration += stall;
+    stall_count++;
+    stall_total_ns += stall;
+    stall_max_ns = std::max(stall_max_ns, stall);
+    logger::debug("SDCard: %s stall of %.1fms at block %llu", write ? "write" : "read", stall / 1e6, (unsigned long long)block);
+    std::scoped_lock lock(stall_mutex);
+    stalls.push_back({now, block, stall, write});
+  }
+  (write ? write_busy_ns : read_wait_ns) += duration;
+  return now + duration;
+}
+
+void SDCard::latency_widget() {
+  ImGui::SetNextItemWidth(ImGui::GetContentRegionAvail().x * 0.5f);
+  if (ImGui::BeginCombo("Latency", latency.name)) {
+    for (int i = 0; i < (int)std::size(latency_presets); i++) {
+      if (ImGui::Selectable(latency_presets[i].name, latency_preset == i)) {
+        latency_preset = i;
+        latency = latency_presets[i];
+      }
+    }
+    ImGui::EndCombo();
+  }
+  if (ImGui::TreeNode("Latency Profile")) {
+    bool edited = false;
+    edited |= ImGui::InputScalar("Read (us)", ImGuiDataType_U32, &latency.read_us);
+    edited |= ImGui::InputScalar("Next block (us)", ImGuiDataType_U32, &latency.next_block_us);
+    edited |= ImGui::InputScalar("Write busy (us)", ImGuiDataType_U32, &latency.write_us);
+    edited |= ImGui::SliderFloat("Stall chance", &latency.stall_chance, 0.0f, 0.1f, "%.4f");
+    edited |= ImGui::InputScalar("Stall min (us)", ImGuiDataType_U32, &latency.stall_min_us);
+    edited |= ImGui::InputScalar("Stall max (us)", ImGuiDataType_U32, &latency.stall_max_us);
+    if (edited) latency.name = "Custom";
+    ImGui::TreePop();
+  }
+  ImGui::Text("Waited %.1fms on reads, %.1fms busy on writes", read_wait_ns / 1e6, write_busy_ns / 1e6);
+  ImGui::Text("%llu stalls, %.1fms in total, longest %.1fms", (unsigned long long)stall_count, stall_total_ns / 1e6, stall_max_ns / 1e6);
+  if (ImGui::Button("Export CSV##SDLatency")) {
+    IGFD::FileDialogConfig config { "." };
+    config.flags |= ImGuiFileDialogFlags_Modal;
+    ImGuiFileDialog::Instance()->OpenDialog("SDLatencyExportDlgKey", "Choose File", "Comma Separated Values (*.csv){.csv},.*", config);
+  }
+  if (ImGuiFileDialog::Instance()->Display("SDLatencyExportDlgKey", ImGuiWindowFlags_NoDocking)) {
+    if (ImGuiFileDialog::Instance()->IsOk()) {
+      auto filename = ImGuiFileDialog::Instance()->GetFilePathName();
+      if (!export_csv(filename)) logger::error("SDCard: unable to export latency statistics to %s", filename.c_str());
+    }
+    ImGuiFileDialog::Instance()->Close();
+  }
+  std::scoped_lock lock(stall_mutex);
+  if (!stalls.empty() && ImGui::TreeNode("Recent Stalls")) {
+    for (auto stall = stalls.rbegin(); stall != stalls.rend() && stall - stalls.rbegin() < (std::ptrdiff_t)recent_stall_limit; ++stall) {
+      ImGui::Text("%.3fs: %s block %llu, %.1fms", stall->at_ns / 1e9, stall->write ? "write" : "read", (unsigned long long)stall->block, stall->duration_ns / 1e6);
+    }
+    ImGui::TreePop();
+  }
+}
+
+bool SDCard::export_csv(const std::string& filename) {
+  FILE* fp = fopen(filename.c_str(), "w");
+  if (fp == nullptr) return false;
+  fprintf(fp, "# profile=%s blocks_read=%llu blocks_written=%llu read_wait_ns=%llu write_busy_ns=%llu\n", latency.name,
+    (unsigned long long)blocks_read, (unsigned long long)blocks_written, (unsigned long long)read_wait_ns, (unsigned long long)write_busy_ns);
+  fprintf(fp, "# stall_count=%llu stall_total_ns=%llu stall_max_ns=%llu\n", (unsigned long long)stall_count, (unsigned long long)stall_total_ns, (unsigned long long)stall_max_ns);
+  fprintf(fp, "at_ns,access,block,duration_ns\n");
+  std::scoped_lock lock(stall_mutex);
+  for (auto& stall : stalls) {
+    fprintf(fp, "%llu,%s,%llu,%llu\n", (unsigned long long)stall.at_ns, stall.write ? "write" : "read", (unsigned long long)stall.block, (unsigned long long)stall.duration_ns);
   }
   fclose(fp);
+  return true;
+}
+
+/**
+ * Maps the selected image, or scans the selected directory, when it or the overlay mode changed. A directory
+ * is scanned again at every card init so host changes show up, unless the overlay holds writes, which only
+ * make sense on the layout they were made against. A directory is always mounted with the overlay.
+ */
+bool SDCard::mount() {
+  std::error_code error;
+  const bool directory = std::filesystem::is_directory(image_filename, error);
+  const bool mode = use_overlay || directory;
+  const bool changed = overlay_active != mode || (directory
+    ? !volume || volume->path() != image_filename || !overlay_blocks
+    : !image.is_open() || image.path() != image_filename || volume);
+  if (!changed) return true;
+
+  std::scoped_lock lock(overlay_mutex);
+  if (overlay_uncommitted) logger::warning("SDCard: discarding %llu uncommitted overlay blocks", (unsigned long long)overlay_uncommitted);
+  overlay.clear();
+  overlay_blocks = overlay_uncommitted = 0;
+  overlay_active = mode;
+  image.close();
+  volume.reset();
+  if (directory) {
+    volume = std::make_unique<VirtualFatVolume>();
+    if (!volume->scan(image_filename)) volume.reset();
+  }
+  else if (image_exists()) {
+    if (overlay_active) image.open_read_only(image_filename);
+    else image.open(image_filename);
+  }
+  volume_mounted = volume != nullptr;
+  return volume || image.is_open();
 }
 
 void SDCard::onByteReceived(uint8_t _byte) {
+  // a byte that completes a request, such as a data crc, is never also a command or token
+  const bool pending_request = getCurrentToken() != 0xFF;
   SPISlavePeripheral::onByteReceived(_byte);
-  if (getCurrentToken() != 0xFF || _byte == 0xFF) return;
+  if (pending_request || _byte == 0xFF) return;
+
+  // data tokens have the top bit set, commands are 01 followed by the index
+  switch (_byte) {
+    case DATA_START_BLOCK:
+    case WRITE_MULTIPLE_TOKEN:
+      setRequestedDataSize(_byte, BLOCK_SIZE + 2); // data + 2 crc
+      return;
+    case STOP_TRAN_TOKEN:
+      return;
+  }
 
   // 1 byte (cmd) + 4 byte (arg) + 1 byte (crc)
   const uint8_t cmd = _byte - 0x40;
   switch (cmd) {
     case CMD0:
     case CMD8:
+    case CMD12:
     case CMD55:
     case CMD58:
     case CMD17: //read block
+    case CMD18: //read multiple blocks
     case CMD24: //write block
+    case CMD25: //write multiple blocks
     case CMD13:
+    case ACMD23:
     case ACMD41:
       setRequestedDataSize(cmd, 5);
       break;
   }
 }
 
+// Queues the next piece of a block read, a gap byte while it is not ready, the start token, the block straight
+// from the mapping or its crc, or the busy token while a written block is programmed
+void SDCard::onResponseSent() {
+  SPISlavePeripheral::onResponseSent();
+  switch (phase) {
+    case Phase::NEXT_BLOCK:
+      if ((++read_block + 1) * BLOCK_SIZE > card_size()) {
+        phase = Phase::NONE;
+        buf[0] = 0xFF;
+        buf[1] = DATA_ERROR_OUT_OF_RANGE;
+        setResponse(buf, 2);
+        break;
+      }
+      phase = Phase::ACCESS;
+      ready_at = ready_time(latency.next_block_us, read_block, false);
+      [[fallthrough]];
+    case Phase::ACCESS:
+      if (Kernel::SimulationRuntime::nanos() < ready_at) {
+        setResponse(block_start, 1);
+        break;
+      }
+      phase = Phase::DATA;
+      setResponse(block_start, sizeof(block_start));
+      break;
+    case Phase::DATA:
+      phase = Phase::CRC;
+      setResponse((uint8_t*)block_data(read_block), BLOCK_SIZE);
+      break;
+    case Phase::CRC:
+      phase = read_multiple ? Phase::NEXT_BLOCK : Phase::NONE;
+      blocks_read++;
+      setResponse(block_crc, sizeof(block_crc));
+      break;
+    case Phase::BUSY:
+      if (Kernel::SimulationRuntime::nanos() < ready_at) setResponse(&busy_token, 1);
+      else phase = Phase::NONE;
+      break;
+    default:
+      break;
+  }
+}
+
+// A card that is still programming drives the busy token from the moment it is selected again
+void SDCard::onBeginTransaction() {
+  SPISlavePeripheral::onBeginTransaction();
+  if (phase == Phase::BUSY) onResponseSent();
+}
+
 void SDCard::onRequestedDataReceived(uint8_t token, uint8_t* _data, size_t count) {
   SPISlavePeripheral::onRequestedDataReceived(token, _data, count);
 
@@ -117,63 +354,95 @@ void SDCard::onRequestedDataReceived(uint8_t token, uint8_t* _data, size_t count
   // Marlin SD2Card keep the CS LOW for multiple commands, so I need to manually clear the token, to receive next.
   clearCurrentToken();
 
+  // SDHC cards take block numbers, standard capacity cards byte addresses
+  const uint64_t block = high_capacity ? currentArg : currentArg >> 9;
+  const bool in_range = (block + 1) * BLOCK_SIZE <= card_size();
+
   // printf("CMD: %d, currentArg: %d, crc: %d, count: %d\n", token, currentArg, crc, count);
   switch (token) {
     case CMD0:
-      if (fp) fclose(fp);
-      fp = fopen(image_filename.c_str(), "rb+");
-      if (fp)
+      flush();
+      interface_v2 = high_capacity = false;
+      phase = Phase::NONE;
+      random.seed(std::mt19937::default_seed);
+      if (mount())
         setResponse(R1_IDLE_STATE);
       else
         setResponse(0);
       break;
     case CMD8:
-      if (true/*_type == SD_CARD_TYPE_SD1*/) {
-        setResponse((R1_ILLEGAL_COMMAND | R1_IDLE_STATE));
-      }
-      else {
-        memset(buf, 0xAA, 4);
-        setResponse(buf, 4);
-      }
+      // R7, echoes the voltage and check pattern
+      interface_v2 = true;
+      buf[0] = R1_IDLE_STATE;
+      buf[1] = 0;
+      buf[2] = 0;
+      buf[3] = (currentArg >> 8) & 0x0F;
+      buf[4] = currentArg & 0xFF;
+      setResponse(buf, 5);
       break;
-    case CMD58:
+    case CMD58: {
+      // R3, the OCR with CCS set once the host asked for a high capacity card
+      const uint32_t ocr = OCR_BUSY | OCR_VOLTAGE_WINDOW | (high_capacity ? OCR_CCS : 0);
       buf[0] = R1_READY_STATE;
-      memset(buf+1, 0xC0, 3);
-      setResponse(buf, 4);
+      for (int i = 0; i < 4; i++) buf[1 + i] = ocr >> (24 - 8 * i);
+      setResponse(buf, 5);
       break;
-    case CMD17: { //read block
-      buf[0] = R1_READY_STATE;
-      buf[1] = DATA_START_BLOCK;
-      if (true  /*_type != SD_CARD_TYPE_SDHC*/) {
-        currentArg >>= 9;
+    }
+    case CMD17: //read block
+    case CMD18: //read multiple blocks
+      if (!in_range) {
+        setResponse(R1_ADDRESS_ERROR);
+        break;
       }
-      fseek(fp, 512 * currentArg, SEEK_SET);
-      [[maybe_unused]] auto result = fread(buf + 2, 512, 1, fp);
-      buf[512 + 2] = 0; //crc
-      setResponse(buf, 512 + 3);
+      read_block = block;
+      read_multiple = token == CMD18;
+      phase = Phase::ACCESS;
+      ready_at = ready_time(latency.read_us, block, false);
+      setResponse(R1_READY_STATE);
+      break;
+    case CMD12:
+      // stop transmission, a stuff byte then R1
+      phase = Phase::NONE;
+      buf[0] = 0xFF;
+      buf[1] = R1_READY_STATE;
+      setResponse(buf, 2);
       break;
-    }
     case CMD24: //write block
-      if (true  /*_type != SD_CARD_TYPE_SDHC*/) {
-        currentArg >>= 9;
+    case CMD25: //write multiple blocks, until STOP_TRAN_TOKEN
+      if (!in_range) {
+        setResponse(R1_ADDRESS_ERROR);
+        break;
       }
+      write_block = block;
       setResponse(R1_READY_STATE);
-      setRequestedDataSize(DATA_START_BLOCK, 512 + 1 + 2 + 1); //token + ff (from this response) + data + 2 crc
       break;
     case CMD13:
       setResponse16(R1_READY_STATE);
       break;
     case CMD55:
+    case ACMD23:
+      setResponse(R1_READY_STATE);
+      break;
     case ACMD41:
+      // HCS is only honoured from a host that has sent CMD8
+      high_capacity = interface_v2 && (currentArg & OCR_CCS);
       setResponse(R1_READY_STATE);
       break;
-    case DATA_START_BLOCK: // CMD24 write block
-      fseek(fp, 512 * currentArg, SEEK_SET);
-      fwrite(_data + 2, 512, 1, fp);
-      fflush(fp);
-      buf[0] = DATA_RES_ACCEPTED;
-      buf[1] = 0xFF; // ack for finish write
-      setResponse(buf, 2);
+    case DATA_START_BLOCK:      // CMD24 write block
+    case WRITE_MULTIPLE_TOKEN:  // CMD25 write multiple blocks
+      if (count != BLOCK_SIZE + 2) break;
+      if ((write_block + 1) * BLOCK_SIZE > card_size()) {
+        buf[0] = DATA_RES_WRITE_ERROR;
+        buf[1] = 0xFF;
+        setResponse(buf, 2);
+        break;
+      }
+      write_block_data(write_block, _data);
+      blocks_written++;
+      // busy until the block is programmed, then idle, the ack for the finished write
+      phase = Phase::BUSY;
+      ready_at = ready_time(latency.write_us, write_block++, true);
+      setResponse(DATA_RES_ACCEPTED);
       break;
   }
 }
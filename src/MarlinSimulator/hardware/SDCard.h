@@ -1,8 +1,18 @@
 #pragma once
 
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
 #include "../user_interface.h"
 
 #include "SPISlavePeripheral.h"
+#include "../mapped_file.h"
+#include "virtual_fat_volume.h"
 
 /**
   * Instructions for create a FAT image:
@@ -13,41 +23,104 @@
   * 3) Copy files to the image:
   *    $ mcopy -i fs.img CFFFP_flow_calibrator.gcode ::/
   * 4) Set the path for SD_SIMULATOR_FAT_IMAGE
+  *
+  * Or set it to a directory, which the card then presents as a FAT32 volume of its content.
   */
  //#define SD_SIMULATOR_FAT_IMAGE "/full/path/to/fs.img"
 #ifndef SD_SIMULATOR_FAT_IMAGE
   #define SD_SIMULATOR_FAT_IMAGE "fs.img"
 #endif
+// Map the image read only, shared by every instance, and keep this instance's writes in memory
+#ifndef SD_SIMULATOR_OVERLAY
+  #define SD_SIMULATOR_OVERLAY false
+#endif
+// The latency preset the card starts with, an index into SDCard::latency_presets, 0 answers instantly
+#ifndef SD_SIMULATOR_LATENCY
+  #define SD_SIMULATOR_LATENCY 0
+#endif
 
+/**
+ * SD card in SPI mode, backed by a memory mapping of the image.
+ *
+ * Reads are served from the mapping without a copy, CMD18 streams consecutive blocks until CMD12 and
+ * CMD25 takes blocks until the stop token. A host that sends CMD8 and sets HCS in ACMD41 gets an SDHC
+ * card, addressed in blocks, otherwise the card is standard capacity and addressed in bytes. Writes
+ * land in the mapping, they reach the image file when the OS writes the pages back or on flush().
+ *
+ * In overlay mode the image is mapped read only and written blocks are kept in a per instance block
+ * map, copy on write, which reads check first. commit_overlay() writes them back to the image.
+ *
+ * A host directory is served by a VirtualFatVolume, always with the overlay, and writes are never
+ * committed back to the host files.
+ *
+ * Timing follows a LatencyProfile. A block read holds the start token back for the access latency, the
+ * host sees 0xFF until it is ready, and a written block holds MISO low, the busy token, until it has
+ * been programmed, also while the card is deselected and selected again. Any block access may stall
+ * on top of that, for a duration drawn log uniformly between the profile's bounds, and every stall is
+ * counted and kept in the stall list, which export_csv() writes out with the counters. The wait is in
+ * simulated time, which the firmware's own timeout loops advance as they poll, so its SD timeouts behave
+ * as on hardware.
+ */
 class SDCard: public SPISlavePeripheral {
 public:
   SDCard(SpiBus& spi_bus, pin_type cs, pin_type sd_detect = -1, bool sd_detect_state = true) : SPISlavePeripheral(spi_bus, cs), sd_detect(sd_detect), sd_detect_state(sd_detect_state), image_filename(SD_SIMULATOR_FAT_IMAGE) {
     if (Gpio::valid_pin(sd_detect)) {
-      Gpio::attach(sd_detect, [this](GpioEvent& event){ this->interrupt(event); });
+      Gpio::attach(sd_detect, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
     }
     sd_present = image_exists();
     Gpio::set_pin_value(sd_detect, sd_present);
   }
-  virtual ~SDCard() {};
+  virtual ~SDCard() { flush(); };
 
   void update() {}
   const std::string file_dialog_key = "ChooseSDFileDlgKey";
+  const std::string directory_dialog_key = "ChooseSDDirectoryDlgKey";
   void ui_widget() {
     if (ImGui::Button("Select Image (FAT32)")) {
       IGFD::FileDialogConfig config { "." };
       config.flags |= ImGuiFileDialogFlags_Modal;
       ImGuiFileDialog::Instance()->OpenDialog(file_dialog_key, "Choose File", "FAT32 Disk Image(*.img){.img},.*", config);
     }
+    ImGui::SameLine();
+    if (ImGui::Button("Select Host Directory")) {
+      IGFD::FileDialogConfig config { "." };
+      config.flags |= ImGuiFileDialogFlags_Modal;
+      ImGuiFileDialog::Instance()->OpenDialog(directory_dialog_key, "Choose Directory", nullptr, config);
+    }
     if (ImGuiFileDialog::Instance()->Display(file_dialog_key, ImGuiWindowFlags_NoDocking))  {
       if (ImGuiFileDialog::Instance()->IsOk()) {
-        image_filename = ImGuiFileDialog::Instance()->GetFilePathName();
+        image_filename = ImGuiFileDialog::Instance()->GetFilePathName();  // mapped at the next CMD0
+        sd_present = image_exists();
+        Gpio::set_pin_value(sd_detect, sd_present);
+      }
+      ImGuiFileDialog::Instance()->Close();
+    }
+    if (ImGuiFileDialog::Instance()->Display(directory_dialog_key, ImGuiWindowFlags_NoDocking))  {
+      if (ImGuiFileDialog::Instance()->IsOk()) {
+        image_filename = ImGuiFileDialog::Instance()->GetCurrentPath();  // scanned at the next CMD0
         sd_present = image_exists();
         Gpio::set_pin_value(sd_detect, sd_present);
       }
       ImGuiFileDialog::Instance()->Close();
     }
 
-    ImGui::Text("FileSystem image \"%s\" selected", image_filename.c_str());
+    std::error_code error;
+    ImGui::Text("%s \"%s\" selected", std::filesystem::is_directory(image_filename, error) ? "Host directory" : "FileSystem image", image_filename.c_str());
+    ImGui::Text("%s card, %llu blocks read, %llu written", high_capacity ? "SDHC" : "SDSC", (unsigned long long)blocks_read, (unsigned long long)blocks_written);
+    latency_widget();
+    ImGui::Checkbox("Copy-on-write Overlay", &use_overlay);
+    ImGui::SameLine();
+    ImGui::TextDisabled("(from the next card init)");
+    if (overlay_active) {
+      ImGui::Text("Overlay: %llu blocks, %llu not committed", (unsigned long long)overlay_blocks, (unsigned long long)overlay_uncommitted);
+      ImGui::BeginDisabled(!overlay_uncommitted || volume_mounted);
+      if (ImGui::Button("Commit Overlay to Image")) commit_overlay();
+      ImGui::EndDisabled();
+    } else {
+      ImGui::BeginDisabled(!dirty());
+      if (ImGui::Button("Flush to Image")) flush();
+      ImGui::EndDisabled();
+    }
     if (Gpio::valid_pin(sd_detect)) {
       ImGui::Checkbox("SD Card Present ", (bool*)&sd_present);
     }
@@ -67,7 +140,10 @@ public:
   }
 
   void onByteReceived(uint8_t _byte) override;
+  void onBlockReceived(const uint8_t* _data, size_t count) override { receiveBlock(_data, count); }
   void onRequestedDataReceived(uint8_t token, uint8_t* _data, size_t count) override;
+  void onResponseSent() override;
+  void onBeginTransaction() override;
 
   void interrupt(GpioEvent &ev) {
     if (ev.pin_id == sd_detect && ev.event == GpioEvent::GET_VALUE) {
@@ -76,18 +152,76 @@ public:
   }
 
   bool image_exists() {
-    auto image_fp = fopen(image_filename.c_str(), "rb+");
-    if (image_fp == nullptr) {
-      return false;
-    }
-    fclose(image_fp);
-    return true;
+    std::error_code error;
+    return std::filesystem::exists(image_filename, error);
   }
   void generate_empty_image(std::string filename);
 
-  int32_t currentArg = 0;
-  uint8_t buf[1024];
-  FILE *fp = nullptr;
+  // Writes the blocks changed since the last flush back to the image file
+  void flush();
+  bool dirty() { return dirty_end > dirty_begin; }
+  // Writes the overlay blocks back to the image, they stay in the overlay, UI thread
+  void commit_overlay();
+  bool mount();
+  uint64_t card_size();  // bytes
+  const uint8_t* block_data(uint64_t block);
+  void write_block_data(uint64_t block, const uint8_t* _data);
+  uint64_t ready_time(uint32_t nominal_us, uint64_t block, bool write);
+  void latency_widget();
+  // The latency counters and every stall so far, UI thread
+  bool export_csv(const std::string& filename);
+
+  struct LatencyProfile {
+    const char* name;
+    uint32_t read_us, next_block_us, write_us;  // first block of a read, each further CMD18 block, programming a block
+    float stall_chance;                         // per block access
+    uint32_t stall_min_us, stall_max_us;
+  };
+  static constexpr LatencyProfile latency_presets[] = {
+    {"Instant",                  0,    0,    0, 0.0f,      0,      0},
+    {"Class 10 / UHS-I",       250,   60,  600, 0.002f, 5000,  60000},
+    {"Class 4",                700,  200, 1800, 0.005f, 15000, 150000},
+    {"Class 2 / worn",        1500,  500, 4500, 0.02f,  40000, 400000},
+  };
+  struct Stall {
+    uint64_t at_ns, block, duration_ns;
+    bool write;
+  };
+
+  // ACCESS waits out a block's read latency, BUSY the programming of a written block
+  enum class Phase : uint8_t { NONE, ACCESS, DATA, CRC, NEXT_BLOCK, BUSY };
+
+  uint32_t currentArg = 0;
+  uint8_t buf[8];
+  uint8_t block_start[2] = {0xFF, 0xFE};  // a gap before the token, so a reselect between blocks loses nothing
+  uint8_t block_crc[2] = {};
+  MappedFile image;
+  std::unique_ptr<VirtualFatVolume> volume;
+  bool volume_mounted = false;  // for the UI thread
+  bool use_overlay = SD_SIMULATOR_OVERLAY, overlay_active = false;
+  struct OverlayBlock {
+    std::array<uint8_t, 512> data;
+    bool committed = false;
+  };
+  std::unordered_map<uint64_t, OverlayBlock> overlay;  // nodes never move, reads point into them
+  std::mutex overlay_mutex;  // inserts against commit_overlay()
+  std::size_t overlay_blocks = 0, overlay_uncommitted = 0;
+  bool interface_v2 = false, high_capacity = false;
+  Phase phase = Phase::NONE;
+  int latency_preset = SD_SIMULATOR_LATENCY;
+  LatencyProfile latency = latency_presets[SD_SIMULATOR_LATENCY];
+  std::mt19937 random;  // seeded at CMD0, so a run stalls the same way each time
+  uint64_t ready_at = 0;  // simulated nanos
+  uint8_t busy_token = 0x00;
+  bool read_multiple = false;
+  uint64_t read_block = 0, write_block = 0;
+  std::size_t dirty_begin = 0, dirty_end = 0;  // byte range written since the last flush
+  uint64_t blocks_read = 0, blocks_written = 0;
+  uint64_t read_wait_ns = 0, write_busy_ns = 0;  // scheduled, stalls included
+  uint64_t stall_count = 0, stall_total_ns = 0, stall_max_ns = 0;
+  static constexpr std::size_t recent_stall_limit = 16;  // shown in the UI, the export has them all
+  std::vector<Stall> stalls;  // oldest first
+  std::mutex stall_mutex;  // stalls, against the UI thread
   bool sd_present = false;
   pin_type sd_detect;
   bool sd_detect_state = true;
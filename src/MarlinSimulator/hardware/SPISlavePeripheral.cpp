@@ -1,14 +1,18 @@
+#include <algorithm>
+
 #include "SPISlavePeripheral.h"
 
 SPISlavePeripheral::SPISlavePeripheral(SpiBus& spi_bus, pin_type cs) : VirtualPrinter::Component("SPISlavePeripheral"), spi_bus(spi_bus), cs_pin(cs) {
-  Gpio::attach(cs_pin, [this](GpioEvent& event){ this->interrupt(event); });
-  spi_bus.attach([this](SpiEvent& event){ this->interrupt(event); });
+  Gpio::attach(cs_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::RISE, GpioEvent::FALL));
+  spi_bus.add_device(this);
 }
 
-SPISlavePeripheral::~SPISlavePeripheral() {};
+SPISlavePeripheral::~SPISlavePeripheral() {
+  spi_bus.remove_device(this);
+};
 
 void SPISlavePeripheral::onBeginTransaction() {
-  spi_bus.acquire();
+  spi_bus.acquire(this);
   //printf("BUS Acquired by %s (cs: %d)\n", name.c_str(), cs_pin);
   insideTransaction = true;
   outgoing_byte = 0xFF;
@@ -18,11 +22,11 @@ void SPISlavePeripheral::onBeginTransaction() {
 void SPISlavePeripheral::onEndTransaction() {
   // check for pending data to receive
   if (requestedDataSize > 0) {
-    onRequestedDataReceived(currentToken, requestedData, requestedDataIndex);
+    onRequestedDataReceived(currentToken, requestedData.data(), requestedDataIndex);
   }
   setRequestedDataSize(0xFF, 0);
   insideTransaction = false;
-  spi_bus.release();
+  spi_bus.release(this);
   //printf("BUS Released by %s (cs: %d)\n", name.c_str(), cs_pin);
 }
 
@@ -33,11 +37,34 @@ void SPISlavePeripheral::onByteReceived(uint8_t _byte) {
     requestedData[requestedDataIndex++] = _byte;
     if (requestedDataIndex == requestedDataSize) {
       requestedDataSize = 0;
-      onRequestedDataReceived(currentToken, requestedData, requestedDataIndex);
+      onRequestedDataReceived(currentToken, requestedData.data(), requestedDataIndex);
     }
   }
 }
 
+void SPISlavePeripheral::onBlockReceived(const uint8_t* _data, size_t count) {
+  for (size_t i = 0; i < count; i++) onByteReceived(_data[i]);
+}
+
+void SPISlavePeripheral::receiveBlock(const uint8_t* _data, size_t count) {
+  while (count > 0) {
+    size_t used = 1;
+    if (getCurrentToken() != 0xFF && requestedDataSize > 0) {
+      used = std::min(requestedDataSize - requestedDataIndex, count);
+      memcpy(requestedData.data() + requestedDataIndex, _data, used);
+      requestedDataIndex += used;
+      if (requestedDataIndex == requestedDataSize) {
+        requestedDataSize = 0;
+        onRequestedDataReceived(currentToken, requestedData.data(), requestedDataIndex);
+      }
+    } else {
+      onByteReceived(*_data);
+    }
+    _data += used;
+    count -= used;
+  }
+}
+
 void SPISlavePeripheral::onResponseSent() {
   // printf("SPISlavePeripheral::onResponseSent\n");
   hasDataToSend = false;
@@ -55,8 +82,31 @@ void SPISlavePeripheral::onByteSent(uint8_t _byte) {
     responseDataSize--;
   }
   else {
-    if (hasDataToSend) onResponseSent();
+    // idle first, so a response queued by onResponseSent() goes out with the next byte
     outgoing_byte = 0xFF;
+    if (hasDataToSend) onResponseSent();
+  }
+}
+
+// The bulk equivalent of sending each byte and calling onByteSent()
+void SPISlavePeripheral::fillBlock(uint8_t* _data, size_t count) {
+  for (size_t i = 0; i < count;) {
+    _data[i++] = outgoing_byte;
+    if (responseDataSize > 0) {
+      // all but the last response byte that fits go out verbatim, that one becomes the next outgoing byte
+      size_t run = std::min(responseDataSize - 1, count - i);
+      memcpy(_data + i, responseData, run);
+      i += run;
+      responseData += run;
+      responseDataSize -= run;
+      outgoing_byte = *responseData;
+      responseData++;
+      responseDataSize--;
+    }
+    else {
+      outgoing_byte = 0xFF;
+      if (hasDataToSend) onResponseSent();
+    }
   }
 }
 
@@ -91,29 +141,31 @@ void SPISlavePeripheral::setRequestedDataSize(uint8_t token, size_t _count) {
   currentToken = token;
   requestedDataSize = _count;
   requestedDataIndex = 0;
-  delete[] requestedData;
-  if (_count > 0) {
-    requestedData = new uint8_t[_count];
-  }
-  else {
-    requestedData = nullptr;
-  }
+  requestedData.resize(_count);
 }
 
-void SPISlavePeripheral::interrupt(SpiEvent& ev) {
-  //printf("SPI(%s): interrupt\n", name.c_str());
-  if (Gpio::get_pin_value(cs_pin) != 0 || !insideTransaction) return;
+void SPISlavePeripheral::transfer(SpiEvent& ev) {
+  if (!insideTransaction) return;
 
-  for (size_t i = 0; i < ev.length; i++) {
-    if (ev.read_into != nullptr) {
+  if (ev.read_into != nullptr && ev.write_from != nullptr) {
+    for (size_t i = 0; i < ev.length; i++) {
       ev.read_into[i] = outgoing_byte;
       onByteSent(outgoing_byte);
-      //printf("SPI(%s): data out\n", name.c_str());
+      onByteReceived(ev.byte(i));
+    }
+  } else if (ev.read_into != nullptr) {
+    fillBlock(ev.read_into, ev.length);
+  } else if (ev.write_from != nullptr) {
+    if (ev.source_format == 1 && ev.source_increment) {
+      onBlockReceived(ev.write_from, ev.length);
+      return;
     }
-    if (ev.write_from != nullptr) {
-      incoming_byte = ev.source_increment ? ev.write_from[i] : ev.write_from[i % ev.source_format] ;
-      onByteReceived(incoming_byte);
-      //printf("SPI(%s): data in\n", name.c_str());
+    // words and repeated sources are put in wire order a chunk at a time, on the stack
+    uint8_t chunk[512];
+    for (size_t offset = 0; offset < ev.length; offset += sizeof(chunk)) {
+      size_t count = std::min(sizeof(chunk), ev.length - offset);
+      ev.copy_out(offset, chunk, count);
+      onBlockReceived(chunk, count);
     }
   }
 }
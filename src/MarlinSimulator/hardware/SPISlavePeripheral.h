@@ -6,20 +6,28 @@
 
 /**
  * Class to Easily Handle SPI Slave communication
+ *
+ * Transfers arrive as blocks. Reads are filled from the pending response with fillBlock(), writes are
+ * handed to onBlockReceived(), which by default feeds onByteReceived() one byte at a time. Only full
+ * duplex transfers, where a response may depend on the byte just received, go byte by byte.
+ * onResponseSent() may set the next response, it goes out straight after the last byte of this one.
  */
-class SPISlavePeripheral : public VirtualPrinter::Component {
+class SPISlavePeripheral : public VirtualPrinter::Component, public SpiBus::Device {
 public:
   SPISlavePeripheral(SpiBus &spi_bus, pin_type cs);
   virtual ~SPISlavePeripheral();
+  std::string device_name() const override { return name; }
 
   // Callbacks
   virtual void onBeginTransaction();
   virtual void onEndTransaction();
 
   virtual void onByteReceived(uint8_t _byte);
+  virtual void onBlockReceived(const uint8_t* _data, size_t count);
   virtual void onRequestedDataReceived(uint8_t token, uint8_t* _data, size_t count);
 
   virtual void onByteSent(uint8_t _byte);
+  virtual void fillBlock(uint8_t* _data, size_t count);
   virtual void onResponseSent();
 
 
@@ -34,7 +42,9 @@ public:
 
 protected:
   void interrupt(GpioEvent& ev);
-  void interrupt(SpiEvent& ev);
+  void transfer(SpiEvent& ev) override;
+  // For devices that ignore incoming bytes while a request is pending, those are copied in bulk
+  void receiveBlock(const uint8_t* _data, size_t count);
   SpiBus &spi_bus;
   pin_type cs_pin;
 
@@ -48,7 +58,7 @@ private:
   bool insideTransaction = false;
   bool hasDataToSend = false;
   uint8_t currentToken = 0xFF;
-  uint8_t *requestedData = nullptr;
+  std::vector<uint8_t> requestedData;  // keeps its capacity between commands
   size_t requestedDataSize = 0;
   size_t requestedDataIndex = 0;
 };
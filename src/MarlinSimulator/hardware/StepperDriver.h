@@ -10,7 +10,7 @@
 class StepperDriver : public VirtualPrinter::Component {
 public:
   StepperDriver(pin_type enable, pin_type dir, pin_type step, std::function<void()> step_callback = [](){} ) : VirtualPrinter::Component("StepperDriver"), enable(enable), dir(dir), step(step), step_callback(step_callback) {
-    Gpio::attach(step, [this](GpioEvent& ev){ this->interrupt(ev); });
+    Gpio::attach(step, [this](GpioEvent& ev){ this->interrupt(ev); }, GpioEvent::mask(GpioEvent::RISE));
   }
   ~StepperDriver() {}
 
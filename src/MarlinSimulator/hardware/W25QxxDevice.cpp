@@ -1,6 +1,46 @@
+#include <algorithm>
+#include <filesystem>
+#include <numeric>
+
 #include "W25QxxDevice.h"
+#include "../logger.h"
 #include "src/libs/W25Qxx.h"
 
+W25QxxDevice::W25QxxDevice(SpiBus& spi_bus, pin_type cs, size_t flash_size) : SPISlavePeripheral(spi_bus, cs), flash_size(flash_size), erase_counts(flash_size / SPI_FLASH_SectorSize) {
+  std::error_code error;
+  size_t file_size = std::filesystem::exists(SPI_FLASH_IMAGE, error) ? std::filesystem::file_size(SPI_FLASH_IMAGE, error) : 0;
+  if (error) file_size = 0;
+  // never shrink an image made for a larger part, the flash only uses the first flash_size bytes of it
+  if (!image.open(SPI_FLASH_IMAGE, std::max(file_size, flash_size))) {
+    logger::error("W25QxxDevice: unable to map %s", SPI_FLASH_IMAGE);
+    return;
+  }
+  // a new flash, or the part a smaller image did not cover, comes erased
+  const size_t existing = std::min(file_size, flash_size);
+  memset(image.data() + existing, 0xFF, flash_size - existing);
+}
+
+uint8_t W25QxxDevice::read_status() {
+  const uint64_t now = Kernel::SimulationRuntime::nanos();
+  if (now >= ready_at) return 0;
+  // the firmware spins on the status register without a timeout, nothing else would move time on, in
+  // steps that shrink as the operation nears its end so the firmware still sees it finish on time
+  const uint64_t remaining = ready_at - now;
+  Kernel::delayNanos(std::min(remaining, std::max(remaining / status_poll_divisor, status_poll_ns)));
+  return WIP_Flag;
+}
+
+void W25QxxDevice::erase(uint32_t address, size_t length, uint64_t duration_us) {
+  address -= address % length;
+  if (!image.is_open() || address + length > flash_size) return;
+  memset(image.data() + address, 0xFF, length);
+  for (size_t sector = address / SPI_FLASH_SectorSize; sector < (address + length) / SPI_FLASH_SectorSize; sector++) erase_counts[sector]++;
+  if (model_timing) {
+    ready_at = Kernel::SimulationRuntime::nanos() + duration_us * 1000;
+    busy_ns += duration_us * 1000;
+  }
+}
+
 void W25QxxDevice::onByteReceived(uint8_t _byte) {
   SPISlavePeripheral::onByteReceived(_byte);
   if (getCurrentToken() != 0xFF) return;
@@ -12,50 +52,70 @@ void W25QxxDevice::onByteReceived(uint8_t _byte) {
     case W25X_BlockErase:
       setRequestedDataSize(_byte, 3);
       break;
+    case W25X_ChipErase:
+      erase(0, flash_size, chip_erase_us);
+      chip_erases++;
+      break;
     case W25X_WriteEnable:
       break;
     case W25X_ReadStatusReg:
-      fflush(fp);
-      setResponse(0);
+      reading_status = true;
+      status = read_status();
+      setResponse(&status, 1);
       break;
     default:
       break;
   }
 };
 
+// The status register repeats for as long as the chip stays selected
+void W25QxxDevice::onResponseSent() {
+  SPISlavePeripheral::onResponseSent();
+  if (!reading_status) return;
+  status = read_status();
+  setResponse(&status, 1);
+}
+
 void W25QxxDevice::onRequestedDataReceived(uint8_t token, uint8_t* _data, size_t count) {
   SPISlavePeripheral::onRequestedDataReceived(token, _data, count);
+  if (!image.is_open()) return;
   switch (token) {
     case W25X_ReadData:
       currentAddress = (_data[0] << 16) | (_data[1] << 8) | _data[2];
-      setResponse(data + currentAddress, flash_size - currentAddress);
+      if (size_t(currentAddress) < flash_size) setResponse(image.data() + currentAddress, flash_size - currentAddress);
       currentAddress = -1;
       break;
     case W25X_PageProgram:
       // receivind data to write!
       if (currentAddress > -1) {
-        memcpy(data + currentAddress, _data, count);
-        fwrite(_data, 1, count, fp);
+        // bits only go from 1 to 0, an address past the end of the page wraps to its start
+        const size_t page = currentAddress - currentAddress % SPI_FLASH_PerWritePageSize;
+        if (page + SPI_FLASH_PerWritePageSize <= flash_size) {
+          for (size_t i = 0; i < count; i++) image.data()[page + (currentAddress + i) % SPI_FLASH_PerWritePageSize] &= _data[i];
+          pages_programmed++;
+          bytes_programmed += count;
+          if (model_timing) {
+            ready_at = Kernel::SimulationRuntime::nanos() + page_program_us * 1000;
+            busy_ns += page_program_us * 1000;
+          }
+        }
         currentAddress = -1;
       }
       else {
         currentAddress = (_data[0] << 16) | (_data[1] << 8) | _data[2];
-        fseek(fp, currentAddress, SEEK_SET);
         setRequestedDataSize(W25X_PageProgram, SPI_FLASH_PerWritePageSize);
       }
       break;
     case W25X_SectorErase:
       currentAddress = (_data[0] << 16) | (_data[1] << 8) | _data[2];
-      memset(data + currentAddress, 0xFF, SPI_FLASH_SectorSize);
-      fseek(fp, currentAddress, SEEK_SET);
-      fwrite(data + currentAddress, 1, SPI_FLASH_SectorSize, fp);
+      erase(currentAddress, SPI_FLASH_SectorSize, sector_erase_us);
+      sector_erases++;
       currentAddress = -1;
       break;
     case W25X_BlockErase:
       currentAddress = (_data[0] << 16) | (_data[1] << 8) | _data[2];
-      memset(data + currentAddress, 0xFF, 65536); //64kb
-      fseek(fp, currentAddress, SEEK_SET);
-      fwrite(data + currentAddress, 1, 65536, fp);
+      erase(currentAddress, 65536, block_erase_us); //64kb
+      block_erases++;
       currentAddress = -1;
       break;
     default:
@@ -66,4 +126,33 @@ void W25QxxDevice::onRequestedDataReceived(uint8_t token, uint8_t* _data, size_t
 
 void W25QxxDevice::onEndTransaction() {
   SPISlavePeripheral::onEndTransaction();
+  reading_status = false;
+}
+
+void W25QxxDevice::log_wear_report() {
+  logger::info("W25QxxDevice: %llu sector, %llu block and %llu chip erases", (unsigned long long)sector_erases, (unsigned long long)block_erases, (unsigned long long)chip_erases);
+  for (size_t sector = 0; sector < erase_counts.size(); sector++) {
+    if (erase_counts[sector]) logger::info("  0x%06zX: erased %u times", sector * SPI_FLASH_SectorSize, erase_counts[sector]);
+  }
+}
+
+void W25QxxDevice::ui_widget() {
+  ImGui::Text("\"%s\", %zu KiB", image.path().c_str(), flash_size / 1024);
+  ImGui::Checkbox("Program/Erase Timing", &model_timing);
+  ImGui::Text("%llu pages programmed, %llu bytes, %.1fms busy", (unsigned long long)pages_programmed, (unsigned long long)bytes_programmed, busy_ns / 1e6);
+  ImGui::Text("%llu sector, %llu block, %llu chip erases", (unsigned long long)sector_erases, (unsigned long long)block_erases, (unsigned long long)chip_erases);
+
+  const size_t erased = std::count_if(erase_counts.begin(), erase_counts.end(), [](uint32_t count) { return count > 0; });
+  const uint32_t most = erase_counts.empty() ? 0 : *std::max_element(erase_counts.begin(), erase_counts.end());
+  ImGui::Text("%zu of %zu sectors erased, at most %u times", erased, erase_counts.size(), most);
+  if (erased && ImGui::TreeNode("Wear Report")) {
+    // the most erased sectors, the full list goes to the log
+    std::vector<size_t> sectors(erase_counts.size());
+    std::iota(sectors.begin(), sectors.end(), 0);
+    const size_t shown = std::min<size_t>(erased, 16);
+    std::partial_sort(sectors.begin(), sectors.begin() + shown, sectors.end(), [this](size_t a, size_t b) { return erase_counts[a] > erase_counts[b]; });
+    for (size_t i = 0; i < shown; i++) ImGui::Text("0x%06zX: erased %u times", sectors[i] * SPI_FLASH_SectorSize, erase_counts[sectors[i]]);
+    if (ImGui::Button("Log Wear Report")) log_wear_report();
+    ImGui::TreePop();
+  }
 }
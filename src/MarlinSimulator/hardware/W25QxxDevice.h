@@ -1,45 +1,59 @@
 #pragma once
 
+#include <vector>
+
 #include "../user_interface.h"
 
 #include "SPISlavePeripheral.h"
+#include "../mapped_file.h"
 
 /**
  * SPI Flash W25Qxx device
+ *
+ * The image is mapped shared, reads are served straight from the mapping and programs and erases land
+ * in it, so startup costs the same whatever the flash size and the OS writes the pages back. Programming
+ * only clears bits, as on the real part, and wraps within the 256 byte page.
+ *
+ * With timing modelled, a program or erase keeps the busy bit set in the status register for the
+ * datasheet's typical time. The firmware polls the status register without a timeout, so each status
+ * byte read while busy moves simulated time on by a share of the busy time left, never less than a
+ * poll interval, and a chip erase is waited out in a hundred or so reads. Every sector erase is counted,
+ * for the wear report.
  **/
- #define SPI_FLASH_IMAGE "./spi_flash.bin"
- #ifndef SPI_FLASH_IMAGE
-   #error "You need set SPI_FLASH_IMAGE to keep SPI FLASH data."
- #endif
+#ifndef SPI_FLASH_IMAGE
+  #define SPI_FLASH_IMAGE "./spi_flash.bin"
+#endif
 
 class W25QxxDevice: public SPISlavePeripheral {
 public:
-  W25QxxDevice(SpiBus& spi_bus, pin_type cs, size_t flash_size) : SPISlavePeripheral(spi_bus, cs), flash_size(flash_size) {
-    // read current data
-    data = new uint8_t[flash_size];
-    memset(data, 0xFF, flash_size);
-
-    fp = fopen(SPI_FLASH_IMAGE, "rb+");
-    if (fp == nullptr) {
-      fp = fopen(SPI_FLASH_IMAGE, "wb+");
-      assert(fp);
-      fwrite(data, 1, flash_size, fp);
-    } else {
-      [[maybe_unused]] auto value = fread(data, 1, flash_size, fp);
-    }
-  }
-  virtual ~W25QxxDevice() {
-    fclose(fp);
-    delete[] data;
-  };
+  W25QxxDevice(SpiBus& spi_bus, pin_type cs, size_t flash_size);
+  virtual ~W25QxxDevice() { image.sync(); };
 
   size_t flash_size;
 
+  void ui_widget() override;
   void onByteReceived(uint8_t _byte) override;
+  void onBlockReceived(const uint8_t* _data, size_t count) override { receiveBlock(_data, count); }
   void onEndTransaction() override;
   void onRequestedDataReceived(uint8_t token, uint8_t* _data, size_t count) override;
+  void onResponseSent() override;
+
+  uint8_t read_status();
+  void erase(uint32_t address, size_t length, uint64_t duration_us);
+  void log_wear_report();
+
+  // typical W25Q64JV times
+  static constexpr uint64_t page_program_us = 700, sector_erase_us = 45'000, block_erase_us = 150'000, chip_erase_us = 20'000'000;
+  static constexpr uint64_t status_poll_ns = 1000, status_poll_divisor = 8;  // step = max(remaining / divisor, poll)
 
-  FILE *fp = nullptr;
-  uint8_t *data;
+  MappedFile image;
   int32_t currentAddress = -1;
+  bool reading_status = false;
+  uint8_t status = 0;
+  bool model_timing = true;
+  uint64_t ready_at = 0;  // simulated nanos
+
+  std::vector<uint32_t> erase_counts;  // per sector
+  uint64_t pages_programmed = 0, bytes_programmed = 0, busy_ns = 0;
+  uint64_t sector_erases = 0, block_erases = 0, chip_erases = 0;
 };
@@ -7,7 +7,7 @@
 class BedProbe : public VirtualPrinter::Component {
 public:
   BedProbe(pin_type probe, glm::vec3 offset, glm::vec4& position, PrintBed& bed) : VirtualPrinter::Component("BedProbe"), probe_pin(probe), offset(offset), position(position), bed(bed) {
-    Gpio::attach(probe, [this](GpioEvent& event){ this->interrupt(event); });
+    Gpio::attach(probe, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
   }
 
   void interrupt(GpioEvent& event) {
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+/**
+ * A 16 bit parallel LCD bank, as the STM32 FSMC maps it: a write to the register address puts a command
+ * on the bus with the RS line low, a write to the RAM address puts data on it with RS high. The firmware
+ * sees two memory locations, so there is no chip select or clock to model, every access goes straight to
+ * the one attached device. Block writes hand the device the caller's words without copying, which is
+ * what a DMA memory to memory transfer into the RAM address does.
+ */
+class FsmcBus {
+public:
+  struct Device {
+    virtual ~Device() = default;
+    virtual void write_register(uint16_t value) = 0;
+    virtual void write_data(uint16_t value) = 0;
+    // `count` words to the RAM address, from consecutive words or all from the first when !increment
+    virtual void write_block(const uint16_t* data, size_t count, bool increment) {
+      for (size_t i = 0; i < count; i++) write_data(data[increment ? i : 0]);
+    }
+    virtual uint16_t read_data() { return 0; }
+  };
+
+  FsmcBus() {}
+  ~FsmcBus() = default;
+  FsmcBus(const FsmcBus&) = delete;
+
+  void attach(Device* device) {
+    if (attached != nullptr && attached != device) printf("fsmc bank already has a device!\n");
+    attached = device;
+  }
+  void detach(Device* device) { if (attached == device) attached = nullptr; }
+
+  void write_register(uint16_t value) { if (attached != nullptr) attached->write_register(value); }
+  void write_data(uint16_t value) { if (attached != nullptr) attached->write_data(value); }
+  void write_block(const uint16_t* data, size_t count, bool increment = true) {
+    if (attached != nullptr && count) attached->write_block(data, count, increment);
+  }
+  uint16_t read_data() { return attached != nullptr ? attached->read_data() : 0xFFFF; }
+
+private:
+  Device* attached = nullptr;
+};
+
+extern FsmcBus FsmcBus0;
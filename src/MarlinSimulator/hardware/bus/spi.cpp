@@ -0,0 +1,86 @@
+#include <chrono>
+
+#include "spi.h"
+
+bool SpiBus::statistics_enabled = false;
+uint64_t SpiBus::statistics_since = 0, SpiBus::statistics_host_since = 0;
+
+static uint64_t host_nanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void count_transfer(SpiBus::Counters& counters, uint64_t bytes, uint64_t wire_ns) {
+  counters.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  counters.transfers.fetch_add(1, std::memory_order_relaxed);
+  counters.wire_ns.fetch_add(wire_ns, std::memory_order_relaxed);
+}
+
+void SpiBus::dispatch_measured(SpiEvent& evt) {
+  uint64_t start = host_nanos();
+  Device* device = selected;
+  if (device != nullptr) device->transfer(evt);
+  for (auto& callback : callbacks) callback(evt);
+
+  uint64_t wire_ns = evt.length * 8 * Kernel::TimeControl::ONE_BILLION / clock_hz;
+  count_transfer(counters, evt.length, wire_ns);
+  if (device != nullptr) count_transfer(device->counters, evt.length, wire_ns);
+
+  // the main loop is a kernel timer like the ISRs, transfers outside any of them go to the last context
+  std::size_t context = context_count - 1;
+  if (!Kernel::isr_stack.empty()) context = std::min<std::size_t>(Kernel::isr_stack.back() - Kernel::Timers::timers.data(), context_count - 1);
+  context_ns[context].fetch_add(host_nanos() - start, std::memory_order_relaxed);
+}
+
+void SpiBus::count_transaction(Device* device) {
+  counters.transactions.fetch_add(1, std::memory_order_relaxed);
+  device->counters.transactions.fetch_add(1, std::memory_order_relaxed);
+}
+
+void SpiBus::count_selected(Device* device) {
+  // a chip select asserted before the reset only counts from the reset
+  uint64_t now = Kernel::SimulationRuntime::nanos(), since = std::max(device->selected_since, statistics_since);
+  if (now <= since) return;
+  counters.selected_ns.fetch_add(now - since, std::memory_order_relaxed);
+  device->counters.selected_ns.fetch_add(now - since, std::memory_order_relaxed);
+}
+
+static void reset(SpiBus::Counters& counters) {
+  counters.bytes = 0;
+  counters.transfers = 0;
+  counters.transactions = 0;
+  counters.selected_ns = 0;
+  counters.wire_ns = 0;
+}
+
+void SpiBus::resetStatistics() {
+  for (auto bus : instances()) {
+    reset(bus->counters);
+    for (auto device : bus->devices) reset(device->counters);
+    for (auto& ns : bus->context_ns) ns = 0;
+  }
+  statistics_since = Kernel::SimulationRuntime::nanos();
+  statistics_host_since = host_nanos();
+}
+
+SpiBus::Statistics SpiBus::statistics(const Counters& counters) {
+  return {
+    counters.bytes.load(std::memory_order_relaxed),
+    counters.transfers.load(std::memory_order_relaxed),
+    counters.transactions.load(std::memory_order_relaxed),
+    counters.selected_ns.load(std::memory_order_relaxed),
+    counters.wire_ns.load(std::memory_order_relaxed),
+  };
+}
+
+const char* SpiBus::context_name(std::size_t context) {
+  return context < Kernel::Timers::timers.size() ? Kernel::Timers::timers[context].name.c_str() : "Other";
+}
+
+uint64_t SpiBus::statisticsSimulatedTime() {
+  uint64_t now = Kernel::SimulationRuntime::nanos();
+  return now > statistics_since ? now - statistics_since : 0;
+}
+
+uint64_t SpiBus::statisticsHostTime() {
+  return host_nanos() - statistics_host_since;
+}
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
 #include <vector>
 #include <functional>
 
@@ -8,61 +13,98 @@
 
 struct SpiEvent {
   uint8_t *write_from, *read_into;
-  size_t length;
+  size_t length;                // bytes
   bool source_increment = true;
-  uint8_t source_format = 1;
+  uint8_t source_format = 1;    // bytes per word, words are in host order and go out MSB first
+
+  // Outgoing byte `index` in wire order
+  uint8_t byte(size_t index) const {
+    if (source_format == 1) return write_from[source_increment ? index : 0];
+    uint16_t word;
+    memcpy(&word, write_from + (source_increment ? index & ~size_t(1) : 0), sizeof(word));
+    return index & 1 ? word & 0xFF : word >> 8;
+  }
+
+  // Outgoing bytes [offset, offset + count) in wire order, the 16 bit swap is a loop the compiler vectorises
+  void copy_out(size_t offset, uint8_t* destination, size_t count) const {
+    if (source_format == 1 && source_increment) {
+      memcpy(destination, write_from + offset, count);
+    } else if (source_format == 2 && source_increment && !(offset & 1)) {
+      for (size_t i = 0; i + 1 < count; i += 2) {
+        uint16_t word;
+        memcpy(&word, write_from + offset + i, sizeof(word));
+        destination[i] = word >> 8;
+        destination[i + 1] = word & 0xFF;
+      }
+      if (count & 1) destination[count - 1] = byte(offset + count - 1);
+    } else {
+      for (size_t i = 0; i < count; i++) destination[i] = byte(offset + i);
+    }
+  }
 };
 
+/**
+ * A transfer goes to the device that holds the bus, the one whose chip select is asserted, rather than
+ * to every device on it. Attached callbacks see every transfer, for monitoring. 16 bit transfers are
+ * passed on as the caller's words, a device that wants bytes converts with SpiEvent::copy_out().
+ *
+ * With statistics enabled the bus counts bytes, transfers and chip select transactions, for itself and
+ * for each device, along with the simulated time a device held its chip select and the time the bytes
+ * would take on the wire at the bus clock, which spiInit() sets. The host time spent in transfers is
+ * split by the kernel timer, main loop or ISR, they were made from.
+ */
 class SpiBus {
 public:
-  SpiBus() {}
+  struct Counters {
+    std::atomic_uint64_t bytes {0}, transfers {0}, transactions {0}, selected_ns {0}, wire_ns {0};
+  };
+  struct Statistics {
+    uint64_t bytes = 0, transfers = 0, transactions = 0, selected_ns = 0, wire_ns = 0;
+  };
+
+  struct Device {
+    virtual ~Device() = default;
+    virtual void transfer(SpiEvent& evt) = 0;
+    virtual std::string device_name() const { return "device"; }
+    Counters counters;
+    uint64_t selected_since = 0;
+  };
+
+  static constexpr uint32_t default_clock = 8'333'333;  // Hz, SPI_FULL_SPEED
+  static constexpr std::size_t context_count = std::tuple_size_v<decltype(Kernel::Timers::timers)> + 1;  // the kernel timers, then anything outside them
+
+  SpiBus() { instances().push_back(this); }
   ~SpiBus() = default;
   SpiBus(const SpiBus&) = delete;
 
+  static std::vector<SpiBus*>& instances() {
+    static std::vector<SpiBus*> buses;
+    return buses;
+  }
+
   void write(uint8_t value) {
     auto evt = SpiEvent{&value, nullptr, 1};
-    for (auto callback : callbacks) callback(evt);
+    dispatch(evt);
   }
 
   uint8_t read() {
-    uint8_t value;
+    uint8_t value = 0xFF;
     auto evt = SpiEvent{nullptr, &value, 1};
-    for (auto callback : callbacks) callback(evt);
+    dispatch(evt);
     return value;
   }
 
   uint8_t transfer(uint8_t write_value) {
     uint8_t read_value = 0xFF;
     auto evt = SpiEvent{&write_value, &read_value, 1};
-    for (auto callback : callbacks) callback(evt);
+    dispatch(evt);
     return read_value;
   }
 
   template<typename DataType>
   void transfer(DataType* write_from, DataType* read_into, size_t length, bool source_increment = true) {
-    uint8_t* data = nullptr;
-
-    // uint16_t Endian swap hack
-    if (sizeof(DataType) == 2) {
-      if (source_increment) {
-        data = new uint8_t[sizeof(DataType) * length];
-        for (size_t i = 0; i < length; i ++) {
-          data[(i * 2)] = (write_from[i] >> 8) & 0xFF;
-          data[(i * 2) + 1] = (write_from[i] & 0xFF);
-        }
-      } else {
-        data = new uint8_t[sizeof(DataType)];
-        data[0] = (write_from[0] >> 8) & 0xFF;
-        data[1] = (write_from[0] & 0xFF);
-      }
-    } else {
-      data = (uint8_t*)write_from;
-    }
-
-    auto evt = SpiEvent{data, (uint8_t*)read_into, sizeof(DataType) * length, source_increment, sizeof(DataType)};
-    for (auto callback : callbacks) callback(evt);
-
-    if ((void*)data != (void*)write_from) delete[] data;
+    auto evt = SpiEvent{(uint8_t*)write_from, (uint8_t*)read_into, sizeof(DataType) * length, source_increment, sizeof(DataType)};
+    dispatch(evt);
   }
 
   template<class... Args>
@@ -70,13 +112,60 @@ public:
     callbacks.push_back(std::function<void(SpiEvent&)>(args...));
   }
 
-  void acquire() { if(busy == true) printf("spi bus contention!\n"); busy = true; }
-  void release() { busy = false; }
-  bool is_busy() { return busy; }
+  // Devices on the bus, listed for the statistics
+  void add_device(Device* device) { devices.push_back(device); }
+  void remove_device(Device* device) { devices.erase(std::remove(devices.begin(), devices.end(), device), devices.end()); }
+  const std::vector<Device*>& attached_devices() const { return devices; }
+
+  // Called by a device when its chip select is asserted and released
+  void acquire(Device* device) {
+    if (selected != nullptr && selected != device) printf("spi bus contention!\n");
+    selected = device;
+    device->selected_since = Kernel::SimulationRuntime::nanos();
+    if (statistics_enabled) count_transaction(device);
+  }
+  void release(Device* device) {
+    if (selected != device) return;
+    if (statistics_enabled) count_selected(device);
+    selected = nullptr;
+  }
+  bool is_busy() { return selected != nullptr; }
+
+  void set_clock(uint32_t hz) { if (hz) clock_hz = hz; }
+  uint32_t clock() const { return clock_hz; }
+
+  static void setStatisticsEnabled(bool enable) {
+    if (!statistics_enabled && enable) resetStatistics();
+    statistics_enabled = enable;
+  }
+  static bool isStatisticsEnabled() { return statistics_enabled; }
+  static void resetStatistics();
+  static Statistics statistics(const Counters& counters);
+  Statistics statistics() const { return statistics(counters); }
+  uint64_t context_host_ns(std::size_t context) const { return context_ns[context].load(std::memory_order_relaxed); }
+  static const char* context_name(std::size_t context);
+  static uint64_t statisticsSimulatedTime();
+  static uint64_t statisticsHostTime();
 
 private:
+  void dispatch(SpiEvent& evt) {
+    if (statistics_enabled) return dispatch_measured(evt);
+    if (selected != nullptr) selected->transfer(evt);
+    for (auto& callback : callbacks) callback(evt);
+  }
+  void dispatch_measured(SpiEvent& evt);
+  void count_transaction(Device* device);
+  void count_selected(Device* device);
+
   std::vector<std::function<void(SpiEvent&)>> callbacks;
-  bool busy = false;
+  std::vector<Device*> devices;
+  Device* selected = nullptr;
+  uint32_t clock_hz = default_clock;
+  Counters counters;
+  std::atomic_uint64_t context_ns[context_count] {};
+
+  static bool statistics_enabled;
+  static uint64_t statistics_since, statistics_host_since;
 };
 
 extern SpiBus SpiBus0;
@@ -0,0 +1,342 @@
+#include "pin_trace.h"
+#include "../mapped_file.h"
+#include "../logger.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+std::atomic<std::size_t> PinTrace::memory_budget {256 * 1024 * 1024};
+std::atomic<std::size_t> PinTrace::memory_used {0}, PinTrace::spill_used {0};
+std::atomic<uint64_t> PinTrace::event_total {0}, PinTrace::evicted_total {0}, PinTrace::next_id {0};
+
+namespace {
+
+// Sealed blocks in the order they were sealed, the oldest are reclaimed first when over budget
+struct SealedBlock {
+  PinTrace* trace;
+  uint64_t id;
+};
+
+// Blocks in the spill file in the order they were written
+struct SpilledBlock {
+  PinTrace* trace;
+  uint64_t id;
+  std::size_t offset;
+  std::weak_ptr<PinTrace::Block> block;
+};
+
+struct Store {
+  std::mutex reclaim_mutex;
+  std::mutex store_mutex;
+  std::deque<SealedBlock> sealed;
+  std::deque<SpilledBlock> spilled;
+  std::vector<std::weak_ptr<PinTrace::Block>> overwriting;  // dropped blocks in the region about to be reused
+  std::shared_ptr<MappedFile> spill_file;
+  std::weak_ptr<MappedFile> retired_file;  // the previous spill file, alive while a cursor reads from it
+  std::size_t spill_offset = 0;
+} store;
+
+inline std::size_t encode_varint(uint64_t value, uint8_t* output) {
+  std::size_t length = 0;
+  while (value >= 0x80) {
+    output[length++] = uint8_t(value) | 0x80;
+    value >>= 7;
+  }
+  output[length++] = uint8_t(value);
+  return length;
+}
+
+}
+
+PinTrace::Block::Block(uint64_t timestamp, uint16_t value)
+  : id(next_id++), first_timestamp(timestamp), last_timestamp(timestamp), first_value(value), last_value(value), storage(std::make_unique<uint8_t[]>(block_size)) {
+  timestamps = storage.get();
+  values_end = storage.get() + block_size;
+  memory_used += block_size;
+}
+
+// Compacted copy of a sealed block, the value column is moved to follow the timestamp column
+PinTrace::Block::Block(const Block& source, std::shared_ptr<void> backing, uint8_t* destination)
+  : id(source.id), first_timestamp(source.first_timestamp), last_timestamp(source.last_timestamp), first_value(source.first_value), last_value(source.last_value),
+    count(source.count), timestamp_bytes(source.timestamp_bytes), value_bytes(source.value_bytes), backing(std::move(backing)) {
+  std::memcpy(destination, source.timestamps, timestamp_bytes);
+  std::memcpy(destination + timestamp_bytes, source.values_end - value_bytes, value_bytes);
+  timestamps = destination;
+  values_end = destination + timestamp_bytes + value_bytes;
+  spill_used += timestamp_bytes + value_bytes;
+}
+
+PinTrace::Block::~Block() {
+  if (storage) memory_used -= block_size;
+  else spill_used -= timestamp_bytes + value_bytes;
+}
+
+bool PinTrace::Block::append(uint64_t timestamp, uint16_t value) {
+  uint8_t timestamp_delta[10], value_delta[3];
+  auto timestamp_length = encode_varint(timestamp > last_timestamp ? timestamp - last_timestamp : 0, timestamp_delta);
+  int32_t difference = int32_t(value) - int32_t(last_value);
+  auto value_length = encode_varint((uint32_t(difference) << 1) ^ uint32_t(difference >> 31), value_delta);
+  if (timestamp_bytes + timestamp_length + value_bytes + value_length > block_size) return false;
+
+  uint8_t* data = storage.get();
+  std::memcpy(data + timestamp_bytes, timestamp_delta, timestamp_length);
+  timestamp_bytes += timestamp_length;
+  for (std::size_t i = 0; i < value_length; i++) data[block_size - 1 - value_bytes++] = value_delta[i];
+
+  last_timestamp = std::max(timestamp, last_timestamp);
+  last_value = value;
+  count++;
+  return true;
+}
+
+bool PinTrace::Cursor::next(pin_log_data& event) {
+  while (state.block_index < blocks.size()) {
+    auto& entry = blocks[state.block_index];
+    if (state.event_index < entry.count && state.timestamp_offset < entry.timestamp_bytes && state.value_offset < entry.value_bytes) {
+      auto& block = *entry.block;
+      if (state.event_index == 0) state.last = { block.first_timestamp, block.first_value };
+
+      uint64_t delta = 0;
+      for (uint32_t shift = 0; state.timestamp_offset < entry.timestamp_bytes; shift += 7) {
+        uint8_t byte = block.timestamps[state.timestamp_offset++];
+        delta |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+      }
+      uint32_t zigzag = 0;
+      for (uint32_t shift = 0; state.value_offset < entry.value_bytes; shift += 7) {
+        uint8_t byte = block.values_end[-1 - std::ptrdiff_t(state.value_offset++)];
+        zigzag |= uint32_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+      }
+
+      state.last.timestamp += delta;
+      state.last.value = uint16_t(int32_t(state.last.value) + (int32_t(zigzag >> 1) ^ -int32_t(zigzag & 1)));
+      state.event_index++;
+      event = state.last;
+      return true;
+    }
+    state.block_index++;
+    state.event_index = 0;
+    state.timestamp_offset = state.value_offset = 0;
+  }
+  return false;
+}
+
+bool PinTrace::Cursor::peek(pin_log_data& event) {
+  auto saved = state;
+  bool result = next(event);
+  state = saved;
+  return result;
+}
+
+// Leaves the cursor on the last event not after timestamp, or the first event
+void PinTrace::Cursor::seek(uint64_t timestamp) {
+  State candidate = state, position = state;
+  pin_log_data event;
+  while (next(event) && event.timestamp <= timestamp) {
+    candidate = position;
+    position = state;
+  }
+  state = candidate;
+}
+
+void PinTrace::append(uint64_t timestamp, uint16_t value) {
+  bool sealed = false;
+  {
+    std::scoped_lock lock(trace_mutex);
+    if (blocks.empty() || !blocks.back()->append(timestamp, value)) {
+      if (blocks.size()) seal();
+      blocks.push_back(std::make_shared<Block>(timestamp, value));
+      blocks.back()->append(timestamp, value);
+      sealed = blocks.size() > 1;
+    }
+    events++;
+  }
+  event_total++;
+  if (sealed && memory_used > memory_budget) reclaim();
+}
+
+void PinTrace::seal() {
+  std::scoped_lock lock(store.store_mutex);
+  store.sealed.push_back({this, blocks.back()->id});
+}
+
+void PinTrace::clear() {
+  std::scoped_lock lock(trace_mutex);
+  blocks.clear();
+  event_total -= events;
+  events = 0;
+}
+
+PinTrace::Cursor PinTrace::cursor(uint64_t from, uint64_t to) const {
+  Cursor cursor;
+  {
+    std::scoped_lock lock(trace_mutex);
+    auto first = std::upper_bound(blocks.begin(), blocks.end(), from, [](uint64_t value, auto& block){ return value < block->first_timestamp; });
+    if (first != blocks.begin()) --first;
+    auto last = std::upper_bound(first, blocks.end(), to, [](uint64_t value, auto& block){ return value < block->first_timestamp; });
+    cursor.blocks.reserve(std::distance(first, last));
+    for (auto block = first; block != last; ++block) cursor.blocks.push_back({*block, (*block)->count, (*block)->timestamp_bytes, (*block)->value_bytes});
+  }
+  if (from) cursor.seek(from);
+  return cursor;
+}
+
+std::size_t PinTrace::size() const {
+  std::scoped_lock lock(trace_mutex);
+  return events;
+}
+
+uint64_t PinTrace::first_timestamp() const {
+  std::scoped_lock lock(trace_mutex);
+  return blocks.size() ? blocks.front()->first_timestamp : 0;
+}
+
+// Moves the block to the spill file, or drops it and everything older when it can not be spilled.
+// Returns the number of blocks whose memory was freed, or -1, leaving the trace as it was, when a cursor
+// holds a block that would leave memory, as its memory would not come back.
+int PinTrace::release(uint64_t id, bool allow_spill) {
+  std::scoped_lock lock(trace_mutex);
+  auto block = find(id);
+  if (block == blocks.end() || (*block)->storage == nullptr || *block == blocks.back()) return 0;
+  auto held = [](auto& block){ return block->storage && block.use_count() > 1; };
+  if (held(*block)) return -1;
+
+  if (auto spilled = allow_spill ? spill(**block) : nullptr) {
+    *block = spilled;
+    return 1;
+  }
+  if (std::any_of(blocks.begin(), block, held)) return -1;
+  int freed = std::count_if(blocks.begin(), block + 1, [](auto& block){ return block->storage != nullptr; });
+  drop(block + 1);
+  return freed;
+}
+
+// Drops a spilled block whose space in the spill file is about to be reused, and everything older
+void PinTrace::discard(uint64_t id) {
+  std::scoped_lock lock(trace_mutex);
+  auto block = find(id);
+  if (block != blocks.end() && *block != blocks.back()) drop(block + 1);
+}
+
+std::deque<std::shared_ptr<PinTrace::Block>>::iterator PinTrace::find(uint64_t id) {
+  auto block = std::lower_bound(blocks.begin(), blocks.end(), id, [](auto& block, uint64_t value){ return block->id < value; });
+  return block != blocks.end() && (*block)->id == id ? block : blocks.end();
+}
+
+void PinTrace::drop(std::deque<std::shared_ptr<Block>>::iterator end) {
+  std::size_t dropped = 0;
+  for (auto block = blocks.begin(); block != end; ++block) dropped += (*block)->count;
+  blocks.erase(blocks.begin(), end);
+  events -= dropped;
+  event_total -= dropped;
+  evicted_total += dropped;
+}
+
+// Memory only comes back from blocks no cursor holds, so the deficit is worked out once and held blocks are
+// passed over, they stay queued for a later reclaim. Chasing memory_used would empty every trace while an
+// export holds its cursors.
+void PinTrace::reclaim() {
+  std::scoped_lock reclaim_lock(store.reclaim_mutex);
+  const std::size_t used = memory_used, budget = memory_budget;
+  if (used <= budget) return;
+  std::size_t needed = (used - budget + block_size - 1) / block_size;
+  std::vector<SealedBlock> held;
+  while (needed) {
+    SealedBlock oldest;
+    std::vector<SpilledBlock> overwritten;
+    {
+      std::scoped_lock lock(store.store_mutex);
+      if (store.sealed.empty()) break;
+      oldest = store.sealed.front();
+      store.sealed.pop_front();
+
+      // The spill file is a ring, make room for a whole block at the write position
+      if (store.spill_file) {
+        if (store.spill_offset + block_size > store.spill_file->size()) store.spill_offset = 0;
+        while (store.spilled.size() && store.spilled.front().offset >= store.spill_offset && store.spilled.front().offset < store.spill_offset + block_size) {
+          overwritten.push_back(store.spilled.front());
+          store.overwriting.push_back(store.spilled.front().block);
+          store.spilled.pop_front();
+        }
+      }
+    }
+    for (auto& block : overwritten) block.trace->discard(block.id);
+
+    // A cursor may still be reading a dropped block, its bytes are only reused once it has let go
+    bool reusable;
+    {
+      std::scoped_lock lock(store.store_mutex);
+      store.overwriting.erase(std::remove_if(store.overwriting.begin(), store.overwriting.end(), [](auto& block){ return block.expired(); }), store.overwriting.end());
+      reusable = store.overwriting.empty();
+    }
+    int freed = oldest.trace->release(oldest.id, reusable);
+    if (freed < 0) held.push_back(oldest);
+    else needed -= std::min<std::size_t>(needed, freed);
+  }
+  if (held.size()) {
+    std::scoped_lock lock(store.store_mutex);
+    store.sealed.insert(store.sealed.begin(), held.begin(), held.end());
+  }
+}
+
+std::shared_ptr<PinTrace::Block> PinTrace::spill(const Block& block) {
+  std::scoped_lock lock(store.store_mutex);
+  if (!store.spill_file || store.spill_offset + block_size > store.spill_file->size()) return nullptr;
+  auto spilled = std::make_shared<Block>(block, store.spill_file, store.spill_file->data() + store.spill_offset);
+  store.spilled.push_back({this, block.id, store.spill_offset, spilled});
+  store.spill_offset += block.timestamp_bytes + block.value_bytes;
+  return spilled;
+}
+
+// Drops every spilled block from its trace, the spill file is going away
+void PinTrace::discard_spilled() {
+  std::deque<SpilledBlock> spilled;
+  {
+    std::scoped_lock lock(store.store_mutex);
+    spilled.swap(store.spilled);
+    store.overwriting.clear();
+    if (store.spill_file) store.retired_file = store.spill_file;
+    store.spill_file.reset();
+    store.spill_offset = 0;
+  }
+  for (auto& block : spilled) block.trace->discard(block.id);
+}
+
+// The spill file is sized up front and never remapped, spilled blocks point straight into the mapping.
+// Opening the file resizes it, so that can only happen once no block of a previous mapping of it is left.
+bool PinTrace::enable_spill(const std::string& path, std::size_t size) {
+  std::scoped_lock reclaim_lock(store.reclaim_mutex);
+  discard_spilled();
+  {
+    std::scoped_lock lock(store.store_mutex);
+    auto retired = store.retired_file.lock();
+    std::error_code error;
+    if (retired && (retired->path() == path || std::filesystem::equivalent(retired->path(), path, error))) {
+      logger::warning("PinTrace: %s is still being read, spill not enabled", path.c_str());
+      return false;
+    }
+  }
+  auto file = std::make_shared<MappedFile>();
+  if (size < block_size || !file->open(path, size)) return false;
+  std::scoped_lock lock(store.store_mutex);
+  store.spill_file = file;
+  return true;
+}
+
+void PinTrace::disable_spill() {
+  std::scoped_lock reclaim_lock(store.reclaim_mutex);
+  discard_spilled();
+}
+
+// Called once every trace has been cleared, the spill ring carries on where it was as cursors may still be reading it
+void PinTrace::reset_store() {
+  std::scoped_lock lock(store.store_mutex);
+  store.sealed.clear();
+}
+
+PinTrace::Statistics PinTrace::statistics() {
+  std::scoped_lock lock(store.store_mutex);
+  return { event_total.load(), evicted_total.load(), memory_used.load(), spill_used.load(), store.spill_file ? store.spill_file->size() : 0 };
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct pin_log_data {
+  uint64_t timestamp;
+  uint16_t value;
+};
+
+/**
+ * Compressed value change history of a single pin.
+ *
+ * Events are packed into fixed size blocks as two columns, varint timestamp deltas growing from the
+ * front of the block and zigzag varint value deltas growing from the back, a block is sealed when the
+ * columns meet. A step pin costs around 3 bytes per edge instead of a 16 byte deque entry.
+ *
+ * All traces share one memory budget. When it is exceeded the oldest sealed blocks are moved to the
+ * memory mapped spill file if one is enabled, otherwise they are dropped. The spill file is used as a
+ * ring, the oldest spilled blocks are dropped to make room. A trace is always a contiguous window
+ * ending at the newest event.
+ *
+ * append() is called from the simulation thread (and by Gpio::resetLogs()), cursors may be taken from
+ * any thread and iterate a snapshot of the blocks that existed when they were created.
+ */
+class PinTrace {
+public:
+  static constexpr std::size_t block_size = 4096;
+
+  struct Block {
+    Block(uint64_t timestamp, uint16_t value);
+    Block(const Block& source, std::shared_ptr<void> backing, uint8_t* destination);
+    ~Block();
+    bool append(uint64_t timestamp, uint16_t value);
+
+    uint64_t id;
+    uint64_t first_timestamp, last_timestamp;
+    uint16_t first_value, last_value;
+    uint32_t count = 0;
+    uint16_t timestamp_bytes = 0, value_bytes = 0;
+    const uint8_t* timestamps = nullptr;  // column read forwards
+    const uint8_t* values_end = nullptr;  // column read backwards from here
+    std::unique_ptr<uint8_t[]> storage;   // set for blocks held in memory
+    std::shared_ptr<void> backing;        // keeps the spill mapping alive for spilled blocks
+  };
+
+  class Cursor {
+  public:
+    bool next(pin_log_data& event);
+    bool peek(pin_log_data& event);
+    bool empty() const { return blocks.empty(); }
+
+  private:
+    friend class PinTrace;
+    struct Entry {
+      std::shared_ptr<const Block> block;
+      // the open block keeps growing, only what existed when the cursor was taken is visible
+      uint32_t count;
+      uint16_t timestamp_bytes, value_bytes;
+    };
+    struct State {
+      std::size_t block_index = 0;
+      uint32_t event_index = 0;
+      std::size_t timestamp_offset = 0, value_offset = 0;
+      pin_log_data last {};
+    };
+    void seek(uint64_t timestamp);
+
+    std::vector<Entry> blocks;
+    State state;
+  };
+
+  struct Statistics {
+    uint64_t events = 0;          // events held by every trace
+    uint64_t evicted = 0;         // events dropped to stay within budget
+    std::size_t memory = 0;       // bytes of block memory and accounted summaries
+    std::size_t spilled = 0;      // bytes held in the spill file
+    std::size_t spill_size = 0;   // spill file capacity, 0 when disabled
+  };
+
+  void append(uint64_t timestamp, uint16_t value);
+  void clear();
+
+  // Positioned on the last event at or before `from`, so the pin level at `from` is known, or the first event.
+  // Only blocks overlapping [from, to] are part of the snapshot.
+  Cursor cursor(uint64_t from = 0, uint64_t to = std::numeric_limits<uint64_t>::max()) const;
+
+  std::size_t size() const;
+  bool empty() const { return size() == 0; }
+  uint64_t first_timestamp() const;
+
+  // Shared by every trace
+  static void set_budget(std::size_t bytes) { memory_budget = bytes; }
+  static std::size_t budget() { return memory_budget; }
+  // Memory held on behalf of the traces, by their plot summaries, counted against the same budget
+  static void account(std::ptrdiff_t bytes) { memory_used += std::size_t(bytes); }
+  static bool enable_spill(const std::string& path, std::size_t size);
+  static void disable_spill();
+  static void reset_store();
+  static Statistics statistics();
+
+private:
+  void seal();
+  int release(uint64_t id, bool allow_spill);
+  void discard(uint64_t id);
+  static void discard_spilled();
+  std::deque<std::shared_ptr<Block>>::iterator find(uint64_t id);
+  void drop(std::deque<std::shared_ptr<Block>>::iterator end);
+  static void reclaim();
+  std::shared_ptr<Block> spill(const Block& block);
+
+  mutable std::mutex trace_mutex;
+  std::deque<std::shared_ptr<Block>> blocks;  // oldest first, the last block is open
+  std::size_t events = 0;
+
+  static std::atomic<std::size_t> memory_budget;
+  static std::atomic<std::size_t> memory_used, spill_used;
+  static std::atomic<uint64_t> event_total, evicted_total, next_id;
+};
@@ -0,0 +1,78 @@
+#include <algorithm>
+
+#include "pwm.h"
+
+Pwm::Channel Pwm::channels[Gpio::pin_count] = {};
+uint32_t Pwm::frequencies[Gpio::pin_count] = {};
+std::vector<pin_type> Pwm::active_pins;
+bool Pwm::logging = false;
+
+void Pwm::write(const pin_type pin, const uint32_t compare, const uint32_t period) {
+  if (!Gpio::valid_pin(pin) || period == 0) return;
+  uint64_t now = Kernel::SimulationRuntime::nanos();
+  auto& channel = channels[pin];
+  if (channel.active) synthesise(pin, now);
+  else active_pins.push_back(pin);
+
+  // the servo driver writes 16 bit pulse widths, everything else Marlin's 8 bit duty
+  uint32_t frequency = frequencies[pin] ? frequencies[pin] : period > 255 ? servo_frequency : default_frequency;
+  channel = {true, std::min(compare, period), period, std::max<uint64_t>(Kernel::TimeControl::ONE_BILLION / frequency, 1), now, now};
+  // a steady level has no edges to synthesise
+  if (channel.compare == 0 || channel.compare == period) Gpio::log(pin, now, channel.compare != 0);
+  Gpio::write(pin, channel.compare != 0);
+}
+
+void Pwm::set_frequency(const pin_type pin, const uint32_t frequency) {
+  if (Gpio::valid_pin(pin)) frequencies[pin] = frequency;
+}
+
+void Pwm::stop(const pin_type pin) {
+  if (!active(pin)) return;
+  uint64_t now = Kernel::SimulationRuntime::nanos();
+  auto& channel = channels[pin];
+  synthesise(pin, now);
+  uint16_t level = (now - channel.start) % channel.period_ns < channel.period_ns * channel.compare / channel.period;
+  channel.active = false;
+  active_pins.erase(std::find(active_pins.begin(), active_pins.end(), pin));
+  // the GPIO writes that follow compare against the level the output was left at
+  Gpio::log(pin, now, level);
+  Gpio::write(pin, level);
+}
+
+double Pwm::duty(const pin_type pin) {
+  if (!active(pin)) return Gpio::get_pin_value(pin) != 0;
+  return double(channels[pin].compare) / channels[pin].period;
+}
+
+double Pwm::frequency(const pin_type pin) {
+  if (!active(pin)) return 0;
+  return double(Kernel::TimeControl::ONE_BILLION) / channels[pin].period_ns;
+}
+
+void Pwm::synthesise(const uint64_t now) {
+  for (auto pin : active_pins) synthesise(pin, now);
+}
+
+void Pwm::synthesise(const pin_type pin, const uint64_t now) {
+  auto& channel = channels[pin];
+  bool enabled = Gpio::isLoggingEnabled();
+  if (enabled != logging) {
+    // the logs were reset after the last sync, edges from before then would land behind their seed values
+    logging = enabled;
+    for (auto active_pin : active_pins) channels[active_pin].synthesised = now;
+  }
+  if (!logging || channel.compare == 0 || channel.compare == channel.period) {
+    channel.synthesised = now;
+    return;
+  }
+
+  // at most 65536 periods per call, so a long stretch without a sync can't stall the simulation
+  uint64_t high = channel.period_ns * channel.compare / channel.period;
+  uint64_t from = std::max(channel.synthesised, now - std::min(now, channel.period_ns * 65536));
+  uint64_t begin = channel.start + (from - channel.start) / channel.period_ns * channel.period_ns;
+  for (; begin < now; begin += channel.period_ns) {
+    if (begin >= from) Gpio::log(pin, begin, 1);
+    if (begin + high >= from && begin + high < now) Gpio::log(pin, begin + high, 0);
+  }
+  channel.synthesised = now;
+}
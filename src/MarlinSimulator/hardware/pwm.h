@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "Gpio.h"
+
+/**
+ * Hardware PWM channels, modelled by their registers instead of as a stream of pin edges.
+ *
+ * analogWrite() programs a channel's compare and period, a new period starts at every write. Consumers
+ * read duty() and frequency() directly and get one SET_VALUE event per register write however fast the
+ * output toggles. The pin value is the level at the start of a period, 1 unless compare is 0.
+ *
+ * Edges are only synthesised into the pin trace while pin logging is enabled, by sync() from the kernel
+ * loop, so the Signal Analyser, decoders and exports still see the waveform. A digitalWrite() to the pin
+ * stops the channel and the pin is a plain GPIO again.
+ */
+class Pwm {
+public:
+  struct Channel {
+    bool active = false;
+    uint32_t compare = 0, period = 0;  // high for `compare` of every `period` counts
+    uint64_t period_ns = 0;
+    uint64_t start = 0;                // ns, the counter last wrapped to 0 here
+    uint64_t synthesised = 0;          // ns, edges before this are in the trace
+  };
+
+  static constexpr uint32_t default_frequency = 1000;  // Hz
+  static constexpr uint32_t servo_frequency = 50;      // Hz, for 16 bit writes
+
+  static void write(const pin_type pin, const uint32_t compare, const uint32_t period);
+  // Takes effect at the next write, in Hz
+  static void set_frequency(const pin_type pin, const uint32_t frequency);
+  static void stop(const pin_type pin);
+
+  static bool active(const pin_type pin) {
+    return Gpio::valid_pin(pin) && channels[pin].active;
+  }
+
+  // 0 - 1, the level of a pin without an active channel
+  static double duty(const pin_type pin);
+  // Hz, 0 for a pin without an active channel
+  static double frequency(const pin_type pin);
+
+  // Synthesise the logged edges of every active channel up to `now`, simulation thread
+  static void sync(const uint64_t now) {
+    if (active_pins.size()) synthesise(now);
+  }
+
+private:
+  static void synthesise(const uint64_t now);
+  static void synthesise(const pin_type pin, const uint64_t now);
+
+  static Channel channels[Gpio::pin_count];
+  static uint32_t frequencies[Gpio::pin_count];  // 0 for the default
+  static std::vector<pin_type> active_pins;
+  static bool logging;
+};
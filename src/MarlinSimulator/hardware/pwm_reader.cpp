@@ -3,7 +3,7 @@
 #include "pwm_reader.h"
 
 PWMReader::PWMReader(pin_type pwm_pin) : VirtualPrinter::Component("PWMReader"), pwm_pin(pwm_pin) {
-  Gpio::attach(this->pwm_pin, [this](GpioEvent& event){ this->interrupt(event); });
+  Gpio::attach(this->pwm_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::RISE, GpioEvent::FALL, GpioEvent::SET_VALUE));
 }
 
 PWMReader::~PWMReader() {
@@ -28,11 +28,19 @@ void PWMReader::ui_widget() {
       ImGui::Text("Software PWM (%.2fHz) Duty Cycle: %.2f%%", pwm_period ? float(Kernel::TimeControl::ONE_BILLION) / Kernel::TimeControl::ticksToNanos(pwm_period) : 0, pwm_period ? float(pwm_duty * 100) / pwm_period : 0);
       break;
     case Hardware:
-      ImGui::Text("Hardware PWM Duty Cycle : (%ld) %.2f%%", pwm_duty, pwm_period ? float(pwm_duty * 100) / pwm_period : 0);
+      ImGui::Text("Hardware PWM (%.2fHz) Duty Cycle: %.2f%%", Pwm::frequency(pwm_pin), duty() * 100.0);
       break;
   }
 }
 
+double PWMReader::duty() const {
+  switch (pwm_mode) {
+    case Software: return pwm_period ? double(pwm_duty) / pwm_period : 0;
+    case Hardware: return Pwm::duty(pwm_pin);
+    default: return Gpio::get_pin_value(pwm_pin) != 0;
+  }
+}
+
 void PWMReader::interrupt(GpioEvent& ev) {
   if (ev.pin_id == pwm_pin) {
     pwm_last_update = ev.timestamp;
@@ -45,10 +53,9 @@ void PWMReader::interrupt(GpioEvent& ev) {
     } else if ( ev.event == ev.FALL) {
       pwm_lowtick = ev.timestamp;
       pwm_duty = ev.timestamp - pwm_hightick;
-    } else if ( ev.event == ev.SET_VALUE) { // Hardware PWM
-      pwm_mode = Hardware;
-      pwm_duty = Gpio::get_pin_value(pwm_pin);
-      pwm_period = std::numeric_limits<uint16_t>::max();
+    } else if ( ev.event == ev.SET_VALUE) { // Hardware PWM, started, changed or stopped
+      pwm_mode = Pwm::active(pwm_pin) ? Hardware : Inactive;
+      pwm_hightick = 0;
     }
   }
 }
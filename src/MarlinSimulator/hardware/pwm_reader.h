@@ -4,6 +4,7 @@
 
 #include <cmath>
 #include "Gpio.h"
+#include "pwm.h"
 #include "../virtual_printer.h"
 
 class PWMReader: public VirtualPrinter::Component {
@@ -20,6 +21,8 @@ public:
   void interrupt(GpioEvent& ev);
   void update();
   void ui_widget();
+  // 0 - 1, measured from the edges for software PWM, read from the channel for hardware PWM
+  double duty() const;
 
   pin_type pwm_pin;
   uint64_t pwm_period = 0;
@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "../renderer/renderer.h"
+
+#include "tft_framebuffer.h"
+
+static constexpr uint16_t empty_start = std::numeric_limits<uint16_t>::max();
+
+TftFramebuffer::TftFramebuffer(uint32_t width, uint32_t height) : width(width), height(height), graphic_ram(new uint16_t[width * height]()) {
+  x_max = dirty_x1 = width - 1;
+  y_max = dirty_y1 = height - 1;
+}
+
+void TftFramebuffer::set_columns(uint16_t start, uint16_t end) {
+  x_min = std::min<uint16_t>(start, width - 1);
+  x_max = std::min<uint16_t>(end, width - 1);
+  x = x_min;
+}
+
+void TftFramebuffer::set_rows(uint16_t start, uint16_t end) {
+  y_min = std::min<uint16_t>(start, height - 1);
+  y_max = std::min<uint16_t>(end, height - 1);
+  y = y_min;
+}
+
+void TftFramebuffer::start_write() {
+  x = x_min;
+  y = y_min;
+  has_pending_byte = false;
+}
+
+// Fills the window a row run at a time, `source(i)` is the i-th pixel of the write
+template <typename Source>
+void TftFramebuffer::write(std::size_t count, Source source) {
+  for (std::size_t done = 0; done < count;) {
+    uint16_t run = uint16_t(std::min<std::size_t>(count - done, x <= x_max ? x_max - x + 1 : 1));
+    uint16_t* out = graphic_ram.get() + x + y * width;
+    for (uint16_t i = 0; i < run; i++) out[i] = source(done + i);
+    mark_dirty(x, y, run);
+    done += run;
+    x += run;
+    if (x > x_max) {
+      x = x_min;
+      y = y >= y_max ? y_min : y + 1;
+    }
+  }
+}
+
+void TftFramebuffer::write_bytes(const uint8_t* data, std::size_t count) {
+  if (count == 0) return;
+  if (has_pending_byte) {
+    uint16_t pixel = (pending_byte << 8) | data[0];
+    write(1, [pixel](std::size_t) { return pixel; });
+    has_pending_byte = false;
+    data++;
+    count--;
+  }
+  write(count / 2, [data](std::size_t i) { return uint16_t((data[i * 2] << 8) | data[i * 2 + 1]); });
+  if (count & 1) {
+    pending_byte = data[count - 1];
+    has_pending_byte = true;
+  }
+}
+
+void TftFramebuffer::write_pixels(const uint16_t* pixels, std::size_t count) {
+  write(count, [pixels](std::size_t i) { return pixels[i]; });
+}
+
+void TftFramebuffer::fill(uint16_t pixel, std::size_t count) {
+  write(count, [pixel](std::size_t) { return pixel; });
+}
+
+void TftFramebuffer::mark_dirty(uint16_t x, uint16_t y, uint16_t run) {
+  std::scoped_lock lock(dirty_mutex);
+  dirty_x0 = std::min(dirty_x0, x);
+  dirty_x1 = std::max<uint16_t>(dirty_x1, x + run - 1);
+  dirty_y0 = std::min(dirty_y0, y);
+  dirty_y1 = std::max(dirty_y1, y);
+}
+
+void TftFramebuffer::ui_init() {
+  renderer::gl_assert_call(glGenTextures, 1, &texture_id);
+  renderer::gl_assert_call(glBindTexture, GL_TEXTURE_2D, texture_id);
+  renderer::gl_assert_call(glTexParameteri, GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  renderer::gl_assert_call(glTexParameteri, GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  renderer::gl_assert_call(glTexParameteri, GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  renderer::gl_assert_call(glTexParameteri, GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  renderer::gl_assert_call(glTexImage2D, GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, nullptr);
+  renderer::gl_assert_call(glBindTexture, GL_TEXTURE_2D, 0);
+  renderer::gl_assert_call(glGenBuffers, 1, &pixel_buffer);
+}
+
+void TftFramebuffer::upload() {
+  auto now = std::chrono::steady_clock::now();
+  if (std::chrono::duration<float>(now - last_upload).count() < 1.0f / refresh_rate) return;
+
+  uint16_t x0, y0, x1, y1;
+  {
+    std::scoped_lock lock(dirty_mutex);
+    if (dirty_x0 > dirty_x1) return;
+    x0 = dirty_x0; y0 = dirty_y0; x1 = dirty_x1; y1 = dirty_y1;
+    dirty_x0 = dirty_y0 = empty_start;
+    dirty_x1 = dirty_y1 = 0;
+  }
+  last_upload = now;
+
+  // the rectangle is packed into an orphaned buffer, so the driver never waits on the previous upload
+  const std::size_t row_size = (x1 - x0 + 1) * sizeof(uint16_t), size = row_size * (y1 - y0 + 1);
+  renderer::gl_assert_call(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, pixel_buffer);
+  renderer::gl_assert_call(glBufferData, GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+  auto staging = (uint8_t*)renderer::gl_assert_call(glMapBufferRange, GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  const void* source = nullptr;  // offset into the pixel buffer
+  if (staging != nullptr) {
+    for (uint16_t row = y0; row <= y1; row++) memcpy(staging + (row - y0) * row_size, graphic_ram.get() + x0 + row * width, row_size);
+    renderer::gl_assert_call(glUnmapBuffer, GL_PIXEL_UNPACK_BUFFER);
+  } else {
+    renderer::gl_assert_call(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, 0);
+    renderer::gl_assert_call(glPixelStorei, GL_UNPACK_ROW_LENGTH, width);
+    source = graphic_ram.get() + x0 + y0 * width;
+  }
+
+  renderer::gl_assert_call(glBindTexture, GL_TEXTURE_2D, texture_id);
+  renderer::gl_assert_call(glPixelStorei, GL_UNPACK_ALIGNMENT, 2);
+  renderer::gl_assert_call(glTexSubImage2D, GL_TEXTURE_2D, 0, x0, y0, x1 - x0 + 1, y1 - y0 + 1, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, source);
+  renderer::gl_assert_call(glPixelStorei, GL_UNPACK_ALIGNMENT, 4);
+  renderer::gl_assert_call(glPixelStorei, GL_UNPACK_ROW_LENGTH, 0);
+  renderer::gl_assert_call(glBindTexture, GL_TEXTURE_2D, 0);
+  renderer::gl_assert_call(glBindBuffer, GL_PIXEL_UNPACK_BUFFER, 0);
+}
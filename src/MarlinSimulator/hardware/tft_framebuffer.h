@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+#include <gl.h>
+
+/**
+ * RGB565 display memory written through a column/row address window, as the MIPI DCS controllers do.
+ *
+ * set_columns()/set_rows() are CASET/RASET, start_write() is RAMWR. Pixels fill the window row by row
+ * and wrap to its first pixel after the last. Each row run is written with one tight loop, big endian
+ * bus bytes are swapped in a loop the compiler vectorises, host order pixels are copied directly.
+ *
+ * Writers run on the simulation thread and grow a dirty rectangle, upload() on the UI thread sends only
+ * that rectangle to the texture, staged through a pixel buffer object, at most `refresh_rate` times a second.
+ */
+class TftFramebuffer {
+public:
+  TftFramebuffer(uint32_t width, uint32_t height);
+
+  // Simulation thread
+  void set_columns(uint16_t start, uint16_t end);
+  void set_rows(uint16_t start, uint16_t end);
+  void start_write();
+  void write_bytes(const uint8_t* data, std::size_t count);    // big endian pixels, as they come off a byte bus
+  void write_pixels(const uint16_t* pixels, std::size_t count);
+  void fill(uint16_t pixel, std::size_t count);
+
+  // UI thread
+  void ui_init();
+  void upload();
+  GLuint texture() const { return texture_id; }
+
+  const uint32_t width, height;
+  float refresh_rate = 30.0f;
+
+private:
+  template <typename Source> void write(std::size_t count, Source source);
+  void mark_dirty(uint16_t x, uint16_t y, uint16_t run);
+
+  std::unique_ptr<uint16_t[]> graphic_ram;
+  uint16_t x_min = 0, x_max = 0, y_min = 0, y_max = 0;
+  uint16_t x = 0, y = 0;
+  uint8_t pending_byte = 0;
+  bool has_pending_byte = false;
+
+  std::mutex dirty_mutex;
+  uint16_t dirty_x0 = 0, dirty_y0 = 0, dirty_x1, dirty_y1;  // inclusive, the whole screen until the first upload
+  std::chrono::steady_clock::time_point last_upload;
+
+  GLuint texture_id = 0, pixel_buffer = 0;
+};
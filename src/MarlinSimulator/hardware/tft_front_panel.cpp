@@ -0,0 +1,87 @@
+#include <string>
+
+#include "../imgui_custom.h"
+
+#include "tft_front_panel.h"
+
+TftFrontPanel::TftFrontPanel(pin_type beeper, pin_type enc1, pin_type enc2, pin_type enc_but, pin_type back, pin_type kill)
+  : beeper_pin(beeper), enc1_pin(enc1), enc2_pin(enc2), enc_but_pin(enc_but), back_pin(back), kill_pin(kill) {
+  Gpio::attach(beeper_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::RISE, GpioEvent::FALL));
+  Gpio::attach(kill_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
+  Gpio::attach(enc_but_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
+  Gpio::attach(back_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
+  Gpio::attach(enc1_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
+  Gpio::attach(enc2_pin, [this](GpioEvent& event){ this->interrupt(event); }, GpioEvent::mask(GpioEvent::GET_VALUE));
+}
+
+void TftFrontPanel::interrupt(GpioEvent& ev) {
+  if (ev.pin_id == beeper_pin) {
+    if (ev.event == GpioEvent::RISE) {
+      // play sound
+    } else if (ev.event == GpioEvent::FALL) {
+      // stop sound
+    }
+  } else if (ev.pin_id == kill_pin) {
+    Gpio::set_pin_value(kill_pin,  !key_pressed[KeyName::KILL_BUTTON]);
+  } else if (ev.pin_id == enc_but_pin) {
+    Gpio::set_pin_value(enc_but_pin,  !key_pressed[KeyName::ENCODER_BUTTON]);
+  } else if (ev.pin_id == back_pin) {
+    Gpio::set_pin_value(back_pin,  !key_pressed[KeyName::BACK_BUTTON]);
+  } else if (ev.pin_id == enc1_pin || ev.pin_id == enc2_pin) {
+    const uint8_t encoder_state = encoder_position % 4;
+    Gpio::set_pin_value(enc1_pin,  encoder_table[encoder_state] & 0x01);
+    Gpio::set_pin_value(enc2_pin,  encoder_table[encoder_state] & 0x02);
+  }
+}
+
+void TftFrontPanel::ui_widget(const char* name, TftFramebuffer& framebuffer, XPT2046Device& touch) {
+  const uint32_t width = framebuffer.width, height = framebuffer.height;
+  bool popout_begin = false;
+  auto size = ImGui::GetContentRegionAvail();
+  size.y = ((size.x / (width / (float)height)) * !render_popout) + 60;
+
+  if (ImGui::BeginChild(name, size)) {
+    ImGui::GetCurrentWindow()->ScrollMax.y = 1.0f; // disable window scroll
+    ImGui::Checkbox("Integer Scaling", &render_integer_scaling);
+    ImGui::Checkbox("Popout", &render_popout);
+
+    if (render_popout) {
+      const imgui_custom::constraint_t constraint { width + imgui_custom::hfeat, height + imgui_custom::vfeat, (width) / (float)(height) };
+
+      // Init the window size to contain the 1x scaled screen, margin, and window features
+      ImGui::SetNextWindowSize(ImVec2(constraint.minw, constraint.minh), ImGuiCond_Once);
+      ImGui::SetNextWindowSizeConstraints(ImVec2(0, 0), ImVec2(FLT_MAX, FLT_MAX), imgui_custom::CustomConstraints::AspectRatio, (void*)&constraint);
+
+      popout_begin = ImGui::Begin((std::string(name) + "Render").c_str(), &render_popout);
+      if (!popout_begin) {
+        ImGui::End();
+        return;
+      }
+      size = ImGui::GetContentRegionAvail();
+    }
+
+    // Apply the smallest scale that fits the window. Maintain proportions.
+    size = imgui_custom::scale_proportionally(size, width, height, render_integer_scaling);
+
+    ImGui::Image((ImTextureID)(intptr_t)framebuffer.texture(), size, ImVec2(0,0), ImVec2(1,1));
+    if (ImGui::IsWindowFocused()) {
+      key_pressed[KeyName::KILL_BUTTON]    = ImGui::IsKeyDown(ImGuiKey_K);
+      key_pressed[KeyName::ENCODER_BUTTON] = ImGui::IsKeyDown(ImGuiKey_Space) || ImGui::IsKeyDown(ImGuiKey_Enter) || ImGui::IsKeyDown(ImGuiKey_RightArrow);
+      key_pressed[KeyName::BACK_BUTTON]    = ImGui::IsKeyDown(ImGuiKey_LeftArrow);
+
+      // Turn keypresses (and repeat) into encoder clicks
+      if (up_held) { up_held--; encoder_position--; }
+      else if (ImGui::IsKeyPressed(ImGuiKey_UpArrow)) up_held = 4;
+      if (down_held) { down_held--; encoder_position++; }
+      else if (ImGui::IsKeyPressed(ImGuiKey_DownArrow)) down_held = 4;
+
+      if (ImGui::IsItemHovered()) {
+        encoder_position += ImGui::GetIO().MouseWheel > 0 ? 1 : ImGui::GetIO().MouseWheel < 0 ? -1 : 0;
+      }
+    }
+    touch.ui_callback();
+
+    if (popout_begin) ImGui::End();
+  }
+  ImGui::EndChild();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Gpio.h"
+#include "XPT2046Device.h"
+#include "tft_framebuffer.h"
+
+/**
+ * The controls around a TFT display and its place in the UI, shared by the TFT device models.
+ *
+ * The kill, back and encoder buttons and the encoder answer the firmware's pin reads from the keyboard
+ * and mouse while the display has focus. ui_widget() shows the framebuffer scaled to fit, inline or in a
+ * popout window, and passes the touch screen its input.
+ */
+class TftFrontPanel {
+public:
+  enum KeyName {
+    KILL_BUTTON, ENCODER_BUTTON, BACK_BUTTON, COUNT
+  };
+
+  TftFrontPanel(pin_type beeper, pin_type enc1, pin_type enc2, pin_type enc_but, pin_type back, pin_type kill);
+  void interrupt(GpioEvent& ev);
+
+  // `name` identifies the child and popout windows
+  void ui_widget(const char* name, TftFramebuffer& framebuffer, XPT2046Device& touch);
+
+  pin_type beeper_pin, enc1_pin, enc2_pin, enc_but_pin, back_pin, kill_pin;
+
+  bool key_pressed[KeyName::COUNT] = {};
+  uint8_t encoder_position = 0;
+  static constexpr int8_t encoder_table[4] = {1, 3, 2, 0};
+  uint8_t up_held = 0, down_held = 0;
+
+  bool render_integer_scaling = false, render_popout = false;
+};
@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+
+#include "virtual_fat_volume.h"
+#include "../logger.h"
+
+namespace {
+
+constexpr uint8_t ATTR_VOLUME_ID = 0x08, ATTR_DIRECTORY = 0x10, ATTR_ARCHIVE = 0x20, ATTR_LONG_NAME = 0x0F;
+constexpr uint32_t FAT32_EOC = 0x0FFFFFFF, FAT32_MEDIA = 0x0FFFFFF8;
+constexpr std::size_t max_long_name = 255;
+
+void put16(uint8_t* destination, uint16_t value) {
+  destination[0] = value & 0xFF;
+  destination[1] = value >> 8;
+}
+
+void put32(uint8_t* destination, uint32_t value) {
+  put16(destination, value & 0xFFFF);
+  put16(destination + 2, value >> 16);
+}
+
+// UCS-2 as long name entries hold it, characters outside the basic plane become '_'
+std::vector<uint16_t> utf16(const std::string& text) {
+  std::vector<uint16_t> units;
+  for (std::size_t i = 0; i < text.size();) {
+    const uint8_t lead = text[i];
+    uint32_t code = lead;
+    std::size_t length = 1;
+    if (lead >= 0xF0)      { length = 4; code = lead & 0x07; }
+    else if (lead >= 0xE0) { length = 3; code = lead & 0x0F; }
+    else if (lead >= 0xC0) { length = 2; code = lead & 0x1F; }
+    for (std::size_t k = 1; k < length && i + k < text.size(); k++) code = (code << 6) | (text[i + k] & 0x3F);
+    i += length;
+    units.push_back(code > 0xFFFF ? '_' : uint16_t(code));
+  }
+  return units;
+}
+
+// Upper case, with '_' for anything a short name can't hold, `lossy` is set when anything but case changed
+std::string short_part(const std::string& text, bool& lossy) {
+  static constexpr char extra[] = "$%'-_@~`!(){}^#&";
+  std::string result;
+  for (unsigned char c : text) {
+    if (c == ' ' || c == '.') { lossy = true; continue; }
+    if (c < 0x80 && std::isalnum(c)) result += char(std::toupper(c));
+    else if (c < 0x80 && std::strchr(extra, c)) result += char(c);
+    else { lossy = true; result += '_'; }
+  }
+  return result;
+}
+
+// 8 + 3 characters, space padded
+std::string pack_short_name(const std::string& base, const std::string& extension) {
+  std::string packed = base.substr(0, 8);
+  packed.resize(8, ' ');
+  std::string packed_extension = extension.substr(0, 3);
+  packed_extension.resize(3, ' ');
+  return packed + packed_extension;
+}
+
+void fat_timestamp(const std::filesystem::path& path, uint16_t& date, uint16_t& time) {
+  date = (1 << 5) | 1;  // 1980-01-01
+  time = 0;
+  std::error_code error;
+  auto modified = std::filesystem::last_write_time(path, error);
+  if (error) return;
+  auto system_time = std::chrono::time_point_cast<std::chrono::system_clock::duration>(modified - std::filesystem::file_time_type::clock::now() + std::chrono::system_clock::now());
+  std::time_t seconds = std::chrono::system_clock::to_time_t(system_time);
+  std::tm* local = std::localtime(&seconds);
+  if (local == nullptr || local->tm_year < 80 || local->tm_year > 207) return;
+  date = ((local->tm_year - 80) << 9) | ((local->tm_mon + 1) << 5) | local->tm_mday;
+  time = (local->tm_hour << 11) | (local->tm_min << 5) | (local->tm_sec / 2);
+}
+
+}
+
+bool VirtualFatVolume::scan(const std::string& path) {
+  nodes.clear();
+  extents.clear();
+  next_cluster = 2;
+  files = 0;
+  root_path = path;
+  std::error_code error;
+  if (!std::filesystem::is_directory(path, error)) return false;
+
+  add_directory(path, 0);
+  cluster_count = (next_cluster - 2) + uint32_t(free_space / cluster_size);
+  fat_blocks = uint32_t(((uint64_t(cluster_count) + 2) * 4 + block_size - 1) / block_size);
+  data_start = reserved_blocks + fat_count * fat_blocks;
+  total_blocks = data_start + uint64_t(cluster_count) * blocks_per_cluster;
+  if (total_blocks > 0xFFFFFFFF) {
+    logger::error("VirtualFatVolume: %s is too large for a FAT32 volume", path.c_str());
+    return false;
+  }
+  logger::info("VirtualFatVolume: %s, %llu files in %u clusters", path.c_str(), (unsigned long long)files, next_cluster - 2);
+  return true;
+}
+
+uint32_t VirtualFatVolume::allocate(std::size_t node, uint64_t bytes) {
+  const auto clusters = uint32_t((bytes + cluster_size - 1) / cluster_size);
+  if (clusters == 0) return 0;
+  nodes[node].first_cluster = next_cluster;
+  nodes[node].clusters = clusters;
+  extents.emplace_back(next_cluster, node);
+  next_cluster += clusters;
+  return nodes[node].first_cluster;
+}
+
+// Lays out the directory's own clusters, then its children's, then builds its entries, by node index as nodes grows
+std::size_t VirtualFatVolume::add_directory(const std::filesystem::path& host_path, uint32_t parent_cluster) {
+  const bool root = nodes.empty();
+  const std::size_t index = nodes.size();
+  nodes.emplace_back();
+  nodes[index].host_path = host_path;
+  nodes[index].directory = true;
+
+  // children in name order, so the same content always gets the same layout
+  std::vector<std::pair<std::string, std::filesystem::directory_entry>> children;
+  std::error_code error;
+  for (auto& child : std::filesystem::directory_iterator(host_path, error)) {
+    const auto filename = child.path().filename().u8string();
+    std::string name(filename.begin(), filename.end());
+    if (name.empty() || name[0] == '.' || utf16(name).size() > max_long_name) continue;
+    std::error_code status_error;
+    // a linked directory can lead back to itself or a parent, the walk would never end
+    if (child.is_directory(status_error) && child.is_symlink(status_error)) continue;
+    if (child.is_directory(status_error) || (child.is_regular_file(status_error) && child.file_size(status_error) < (1ull << 32) && !status_error)) {
+      children.emplace_back(name, child);
+    }
+  }
+  std::sort(children.begin(), children.end(), [](auto& a, auto& b){ return a.first < b.first; });
+
+  // the volume label or the dot entries, then at most one long name entry per 13 characters and the short entry
+  std::size_t entry_count = root ? 1 : 2;
+  for (auto& [name, child] : children) entry_count += 1 + (utf16(name).size() + 12) / 13;
+  const uint32_t first_cluster = allocate(index, entry_count * 32);
+
+  std::vector<std::pair<std::string, std::size_t>> child_nodes;
+  for (auto& [name, child] : children) {
+    std::error_code status_error;
+    if (child.is_directory(status_error)) {
+      child_nodes.emplace_back(name, add_directory(child.path(), root ? 0 : first_cluster));
+    } else {
+      const std::size_t file = nodes.size();
+      nodes.emplace_back();
+      nodes[file].host_path = child.path();
+      nodes[file].size = child.file_size(status_error);
+      allocate(file, nodes[file].size);
+      child_nodes.emplace_back(name, file);
+      files++;
+    }
+  }
+
+  std::vector<uint8_t> entries;
+  std::unordered_set<std::string> short_names;
+  auto add_special = [&entries](const char* name, uint8_t attributes, uint32_t cluster) {
+    uint8_t entry[32] {};
+    memcpy(entry, name, 11);
+    entry[11] = attributes;
+    put16(entry + 20, cluster >> 16);
+    put16(entry + 26, cluster & 0xFFFF);
+    entries.insert(entries.end(), entry, entry + sizeof(entry));
+  };
+  if (root) {
+    add_special("MARLIN SIM ", ATTR_VOLUME_ID, 0);
+  } else {
+    add_special(".          ", ATTR_DIRECTORY, first_cluster);
+    add_special("..         ", ATTR_DIRECTORY, parent_cluster);
+  }
+  for (auto& [name, child] : child_nodes) add_entry(entries, short_names, name, nodes[child]);
+  nodes[index].entries = std::move(entries);
+  nodes[index].size = nodes[index].entries.size();
+  return index;
+}
+
+// A short name entry, after long name entries when the name doesn't survive as an upper case 8.3 name
+void VirtualFatVolume::add_entry(std::vector<uint8_t>& entries, std::unordered_set<std::string>& short_names, const std::string& name, const Node& node) {
+  const auto dot = name.find_last_of('.');
+  bool lossy = false;
+  std::string base = short_part(name.substr(0, dot), lossy);
+  std::string extension = dot == std::string::npos ? "" : short_part(name.substr(dot + 1), lossy);
+  const bool fits = !lossy && !base.empty() && base.size() <= 8 && extension.size() <= 3;
+  if (base.empty()) base = "_";
+
+  std::string short_name = fits ? pack_short_name(base, extension) : "";
+  if (!fits || short_names.count(short_name)) {
+    short_name.clear();
+    for (uint32_t n = 1; short_name.empty(); n++) {
+      const std::string tail = "~" + std::to_string(n);
+      const auto candidate = pack_short_name(base.substr(0, 8 - tail.size()) + tail, extension);
+      if (!short_names.count(candidate)) short_name = candidate;
+    }
+  }
+  short_names.insert(short_name);
+
+  std::string display = short_name.substr(0, short_name.find_last_not_of(' ', 7) + 1);
+  if (short_name[8] != ' ') display += "." + short_name.substr(8, short_name.find_last_not_of(' ') - 7);
+  if (display != name) {
+    uint8_t checksum = 0;
+    for (char c : short_name) checksum = ((checksum & 1) << 7) + (checksum >> 1) + uint8_t(c);
+    static constexpr uint8_t offsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    const auto units = utf16(name);
+    const std::size_t count = (units.size() + 12) / 13;
+    for (std::size_t sequence = count; sequence >= 1; sequence--) {
+      uint8_t entry[32] {};
+      entry[0] = sequence | (sequence == count ? 0x40 : 0);
+      entry[11] = ATTR_LONG_NAME;
+      entry[13] = checksum;
+      for (std::size_t i = 0; i < 13; i++) {
+        const std::size_t unit = (sequence - 1) * 13 + i;
+        put16(entry + offsets[i], unit < units.size() ? units[unit] : unit == units.size() ? 0x0000 : 0xFFFF);
+      }
+      entries.insert(entries.end(), entry, entry + sizeof(entry));
+    }
+  }
+
+  uint8_t entry[32] {};
+  uint16_t date, time;
+  fat_timestamp(node.host_path, date, time);
+  memcpy(entry, short_name.data(), 11);
+  entry[11] = node.directory ? ATTR_DIRECTORY : ATTR_ARCHIVE;
+  put16(entry + 14, time);
+  put16(entry + 16, date);
+  put16(entry + 18, date);
+  put16(entry + 20, node.first_cluster >> 16);
+  put16(entry + 22, time);
+  put16(entry + 24, date);
+  put16(entry + 26, node.first_cluster & 0xFFFF);
+  put32(entry + 28, node.directory ? 0 : uint32_t(node.size));
+  entries.insert(entries.end(), entry, entry + sizeof(entry));
+}
+
+VirtualFatVolume::Node* VirtualFatVolume::node_at(uint32_t cluster) {
+  auto extent = std::upper_bound(extents.begin(), extents.end(), cluster, [](uint32_t value, auto& entry){ return value < entry.first; });
+  if (extent == extents.begin()) return nullptr;
+  auto& node = nodes[std::prev(extent)->second];
+  return cluster < node.first_cluster + node.clusters ? &node : nullptr;
+}
+
+void VirtualFatVolume::fill_boot_sector() {
+  uint8_t* bpb = sector.data();
+  memcpy(bpb, "\xEB\x58\x90" "MARLNSIM", 11);
+  put16(bpb + 11, block_size);
+  bpb[13] = blocks_per_cluster;
+  put16(bpb + 14, reserved_blocks);
+  bpb[16] = fat_count;
+  bpb[21] = 0xF8;                    // fixed media
+  put16(bpb + 24, 63);               // sectors per track
+  put16(bpb + 26, 255);              // heads
+  put32(bpb + 32, uint32_t(total_blocks));
+  put32(bpb + 36, fat_blocks);
+  put32(bpb + 44, 2);                // root directory cluster
+  put16(bpb + 48, 1);                // FSInfo block
+  put16(bpb + 50, 6);                // backup boot block
+  bpb[64] = 0x80;                    // drive number
+  bpb[66] = 0x29;                    // extended boot signature
+  put32(bpb + 67, 0x4D534D31);       // volume id
+  memcpy(bpb + 71, "MARLIN SIM FAT32   ", 19);
+  bpb[510] = 0x55;
+  bpb[511] = 0xAA;
+}
+
+void VirtualFatVolume::fill_fat(uint64_t fat_block) {
+  const uint32_t first_entry = uint32_t(fat_block * (block_size / 4));
+  for (uint32_t i = 0; i < block_size / 4; i++) {
+    const uint32_t cluster = first_entry + i;
+    uint32_t value = 0;
+    if (cluster == 0) value = FAT32_MEDIA;
+    else if (cluster == 1) value = FAT32_EOC;
+    else if (auto node = node_at(cluster)) value = cluster + 1 == node->first_cluster + node->clusters ? FAT32_EOC : cluster + 1;
+    put32(sector.data() + i * 4, value);
+  }
+}
+
+const uint8_t* VirtualFatVolume::block(uint64_t index) {
+  sector.fill(0);
+  if (index == 0 || index == 6) {
+    fill_boot_sector();
+  } else if (index == 1 || index == 7) {
+    // FSInfo, with the free count unknown so the firmware counts it
+    put32(sector.data(), 0x41615252);
+    put32(sector.data() + 484, 0x61417272);
+    put32(sector.data() + 488, 0xFFFFFFFF);
+    put32(sector.data() + 492, 0xFFFFFFFF);
+    put32(sector.data() + 508, 0xAA550000);
+  } else if (index >= reserved_blocks && index < data_start) {
+    fill_fat((index - reserved_blocks) % fat_blocks);
+  } else if (index >= data_start && index < total_blocks) {
+    const uint64_t data_block = index - data_start;
+    const uint32_t cluster = uint32_t(2 + data_block / blocks_per_cluster);
+    auto node = node_at(cluster);
+    if (node == nullptr) return sector.data();
+    const uint64_t offset = (uint64_t(cluster - node->first_cluster) * blocks_per_cluster + data_block % blocks_per_cluster) * block_size;
+    if (node->directory) {
+      if (offset < node->entries.size()) memcpy(sector.data(), node->entries.data() + offset, std::min<uint64_t>(block_size, node->entries.size() - offset));
+      return sector.data();
+    }
+    if (!node->file) {
+      node->file = std::make_unique<MappedFile>();
+      node->file->open_read_only(node->host_path.string());
+    }
+    const uint64_t size = std::min<uint64_t>(node->size, node->file->size());
+    if (offset + block_size <= size) return node->file->data() + offset;
+    if (offset < size) memcpy(sector.data(), node->file->data() + offset, size - offset);
+  }
+  return sector.data();
+}
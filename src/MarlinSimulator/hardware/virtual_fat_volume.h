@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "../mapped_file.h"
+
+/**
+ * A read only FAT32 view of a host directory, served to the SD card a block at a time.
+ *
+ * scan() walks the directory once and lays every file and subdirectory out in contiguous clusters,
+ * building only the directory entries. The boot sector, FSInfo and FAT sectors are generated when they
+ * are read, file sectors come straight from the host file, mapped on first access. So a mount costs the
+ * same whatever the size of the content. Hidden files, files of 4 GiB or more and links to directories
+ * are left out.
+ *
+ * The volume is never written, the SD card keeps writes in its overlay.
+ */
+class VirtualFatVolume {
+public:
+  static constexpr std::size_t block_size = 512;
+  static constexpr uint32_t blocks_per_cluster = 8;
+  static constexpr std::size_t cluster_size = block_size * blocks_per_cluster;
+  static constexpr uint64_t free_space = 1ull << 30;  // bytes, after the content, at least the FAT32 minimum
+
+  bool scan(const std::string& path);
+  const std::string& path() const { return root_path; }
+  uint64_t block_count() const { return total_blocks; }
+  std::size_t file_count() const { return files; }
+
+  // The block's bytes, valid until the next call
+  const uint8_t* block(uint64_t index);
+
+private:
+  struct Node {
+    std::filesystem::path host_path;
+    bool directory = false;
+    uint64_t size = 0;                 // bytes, of the entries for a directory
+    uint32_t first_cluster = 0, clusters = 0;
+    std::vector<uint8_t> entries;      // directories, 32 bytes each
+    std::unique_ptr<MappedFile> file;  // files, mapped on first read
+  };
+
+  uint32_t allocate(std::size_t node, uint64_t bytes);
+  std::size_t add_directory(const std::filesystem::path& host_path, uint32_t parent_cluster);
+  void add_entry(std::vector<uint8_t>& entries, std::unordered_set<std::string>& short_names, const std::string& name, const Node& node);
+  Node* node_at(uint32_t cluster);
+  void fill_boot_sector();
+  void fill_fat(uint64_t fat_block);
+
+  std::string root_path;
+  std::vector<Node> nodes;
+  std::vector<std::pair<uint32_t, std::size_t>> extents;  // first cluster and node, in cluster order
+  uint32_t next_cluster = 2;
+  std::size_t files = 0;
+
+  static constexpr uint32_t reserved_blocks = 32, fat_count = 2;
+  uint32_t cluster_count = 0, fat_blocks = 0;
+  uint64_t data_start = 0, total_blocks = 0;
+  std::array<uint8_t, block_size> sector {};
+};
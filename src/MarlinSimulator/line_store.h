@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <regex>
+#include <algorithm>
+
+/**
+ * Bounded text history for the terminal style windows.
+ *
+ * Line text is packed into fixed size chunks, appending never moves existing text and the
+ * oldest chunk (and the lines stored in it) is released once the byte limit is exceeded.
+ * Lines are hard wrapped at a column count, each line records the display row it starts on
+ * so a visible row can be mapped back to its line with a binary search.
+ */
+class LineStore {
+public:
+  static constexpr std::size_t chunk_size = 64 * 1024;
+
+  struct Line {
+    const char* text;
+    uint32_t length;
+    uint32_t count;      // consecutive identical lines are collapsed
+    uint64_t chunk;      // sequence number of the chunk holding the text
+    uint64_t row_start;  // absolute display row, see set_columns()
+  };
+
+  LineStore(std::size_t byte_limit = 16 * 1024 * 1024) : byte_limit(byte_limit) {}
+
+  void append(std::string_view text) {
+    if (lines.size() && lines.back().length == text.size() && std::memcmp(lines.back().text, text.data(), text.size()) == 0) {
+      lines.back().count++;
+      return;
+    }
+
+    if (chunks.empty() || chunks.back().capacity - chunks.back().used < text.size()) {
+      auto capacity = std::max(chunk_size, text.size());
+      chunks.push_back({std::make_unique<char[]>(capacity), capacity, 0, next_chunk++});
+      allocated += capacity;
+    }
+    auto& chunk = chunks.back();
+    char* destination = chunk.data.get() + chunk.used;
+    std::memcpy(destination, text.data(), text.size());
+    chunk.used += text.size();
+
+    uint64_t row_start = lines.size() ? lines.back().row_start + rows(lines.back()) : 0;
+    lines.push_back({destination, uint32_t(text.size()), 1, chunk.sequence, row_start});
+    enforce_limit();
+  }
+
+  void clear() {
+    first_id += lines.size();
+    lines.clear();
+    chunks.clear();
+    allocated = 0;
+  }
+
+  void set_byte_limit(std::size_t limit) {
+    byte_limit = limit;
+    enforce_limit();
+  }
+
+  // Rebuilds the row index when the wrap width changes, appends keep it current otherwise
+  void set_columns(std::size_t value) {
+    value = std::max<std::size_t>(value, 1);
+    if (value == columns) return;
+    columns = value;
+    uint64_t row = lines.size() ? lines.front().row_start : 0;
+    for (auto& line : lines) {
+      line.row_start = row;
+      row += rows(line);
+    }
+  }
+
+  static std::size_t prefix_length(const Line& line) {
+    if (line.count < 2) return 0;
+    return std::to_string(line.count).size() + 3; // "[N] "
+  }
+
+  std::size_t rows(const Line& line) const {
+    return std::max<std::size_t>(1, (prefix_length(line) + line.length + columns - 1) / columns);
+  }
+
+  uint64_t total_rows() const {
+    if (lines.empty()) return 0;
+    return lines.back().row_start + rows(lines.back()) - lines.front().row_start;
+  }
+
+  // Maps a display row (0 = first retained row) to the line id containing it and the row within that line
+  std::pair<uint64_t, std::size_t> find_row(uint64_t row) const {
+    uint64_t target = lines.front().row_start + row;
+    auto it = std::upper_bound(lines.begin(), lines.end(), target, [](uint64_t value, const Line& line){ return value < line.row_start; });
+    auto index = std::distance(lines.begin(), it) - 1;
+    return {first_id + index, std::size_t(target - lines[index].row_start)};
+  }
+
+  // Text of one display row, including the repeat count prefix on the first row of a line
+  std::string row_text(const Line& line, std::size_t row) const {
+    std::string text;
+    if (line.count > 1) text = "[" + std::to_string(line.count) + "] ";
+    text.append(line.text, line.length);
+    return text.substr(std::min(text.size(), row * columns), columns);
+  }
+
+  bool contains(uint64_t id) const { return id >= first_id && id < end_id(); }
+  const Line& line(uint64_t id) const { return lines[id - first_id]; }
+  std::string_view text(uint64_t id) const { return {line(id).text, line(id).length}; }
+  uint64_t begin_id() const { return first_id; }
+  uint64_t end_id() const { return first_id + lines.size(); }
+  std::size_t size() const { return lines.size(); }
+  bool empty() const { return lines.empty(); }
+  std::size_t bytes() const { return allocated + lines.size() * sizeof(Line); }
+  std::size_t limit() const { return byte_limit; }
+
+private:
+  struct Chunk {
+    std::unique_ptr<char[]> data;
+    std::size_t capacity, used;
+    uint64_t sequence;
+  };
+
+  void enforce_limit() {
+    while (chunks.size() > 1 && bytes() > byte_limit) {
+      auto sequence = chunks.front().sequence;
+      while (lines.size() && lines.front().chunk == sequence) {
+        lines.pop_front();
+        first_id++;
+      }
+      allocated -= chunks.front().capacity;
+      chunks.pop_front();
+    }
+  }
+
+  std::deque<Chunk> chunks;
+  std::deque<Line> lines;
+  uint64_t first_id = 0, next_chunk = 0;
+  std::size_t allocated = 0, byte_limit = 0, columns = 1;
+};
+
+/**
+ * Incremental filter over a LineStore, only lines appended since the last update are scanned,
+ * bounded by a per call budget so a new pattern over a large history is spread across frames.
+ */
+class LineSearch {
+public:
+  struct Match {
+    uint64_t id;
+    uint64_t row_start;
+  };
+
+  bool set_pattern(std::string_view value, bool use_regex) {
+    if (value == pattern && use_regex == regex_enabled) return true;
+    pattern = value;
+    regex_enabled = use_regex;
+    matches.clear();
+    next_id = 0;
+    error.clear();
+    expression.reset();
+    if (regex_enabled && pattern.size()) {
+      try {
+        expression.emplace(pattern, std::regex::ECMAScript | std::regex::optimize);
+      } catch (const std::regex_error& e) {
+        error = e.what();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool active() const { return pattern.size() && error.empty(); }
+  bool complete(const LineStore& store) const { return next_id >= store.end_id(); }
+
+  void update(const LineStore& store, std::size_t budget = 20000) {
+    if (!active()) return;
+    prune(store);
+    next_id = std::max(next_id, store.begin_id());
+    for (; next_id < store.end_id() && budget; next_id++, budget--) {
+      auto text = store.text(next_id);
+      bool found = expression ? std::regex_search(text.begin(), text.end(), *expression) : text.find(pattern) != std::string_view::npos;
+      if (found) {
+        uint64_t row_start = matches.size() ? matches.back().row_start + store.rows(store.line(matches.back().id)) : 0;
+        matches.push_back({next_id, row_start});
+      }
+    }
+  }
+
+  // Must be called after LineStore::set_columns, row offsets are recomputed when the wrap width changes
+  void set_columns(const LineStore& store, std::size_t value) {
+    if (value == columns) return;
+    columns = value;
+    prune(store);
+    uint64_t row = matches.size() ? matches.front().row_start : 0;
+    for (auto& match : matches) {
+      match.row_start = row;
+      row += store.rows(store.line(match.id));
+    }
+  }
+
+  uint64_t total_rows(const LineStore& store) const {
+    if (matches.empty()) return 0;
+    return matches.back().row_start + store.rows(store.line(matches.back().id)) - matches.front().row_start;
+  }
+
+  std::pair<uint64_t, std::size_t> find_row(uint64_t row) const {
+    uint64_t target = matches.front().row_start + row;
+    auto it = std::upper_bound(matches.begin(), matches.end(), target, [](uint64_t value, const Match& match){ return value < match.row_start; });
+    auto& match = *std::prev(it);
+    return {match.id, std::size_t(target - match.row_start)};
+  }
+
+  std::size_t size() const { return matches.size(); }
+  const std::deque<Match>& results() const { return matches; }
+
+  std::string pattern, error;
+  bool regex_enabled = false;
+
+private:
+  void prune(const LineStore& store) {
+    while (matches.size() && !store.contains(matches.front().id)) matches.pop_front();
+  }
+
+  std::optional<std::regex> expression;
+  std::deque<Match> matches;
+  uint64_t next_id = 0;
+  std::size_t columns = 0;
+};
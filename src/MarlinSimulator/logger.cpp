@@ -1,11 +1,189 @@
 #include "logger.h"
+#include "spsc_queue.h"
 
+#include <cstddef>
+#include <cstring>
 #include <functional>
 #include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <condition_variable>
 
 namespace logger {
 
 std::function<void(const std::string_view)> logger_callback {};
-std::mutex log_write_mutex;
+std::atomic<LogLevel> runtime_level { minimum_level };
+
+namespace {
+
+struct ThreadQueue {
+  SpscQueue<Record, 1024> records;
+  std::atomic<uint64_t> dropped {0};
+  std::atomic_bool orphaned {false};  // owning thread has exited, removed once drained
+};
+
+class Backend {
+public:
+  Backend() {
+    if constexpr (async_enabled) {
+      running = true;
+      worker = std::thread(&Backend::execute, this);
+    }
+  }
+
+  ~Backend() {
+    stop();
+  }
+
+  void stop() {
+    if (!running.exchange(false)) return;
+    wake.notify_one();
+    worker.join();
+    drain();
+  }
+
+  void submit(const Record& record) {
+    if (!running.load(std::memory_order_acquire)) {
+      std::scoped_lock drain_lock(drain_mutex);
+      write(record);
+      return;
+    }
+
+    auto& queue = thread_queue();
+    auto slot = queue.records.acquire();
+    if (slot == nullptr) {
+      queue.dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    std::memcpy(slot, &record, offsetof(Record, text) + record.length);
+    slot->sequence = sequence.fetch_add(1, std::memory_order_relaxed);
+    queue.records.commit();
+    if (!pending.exchange(true, std::memory_order_acq_rel)) wake.notify_one();
+  }
+
+  // Collects everything queued so far from every thread and writes it out in submission order
+  void drain() {
+    std::scoped_lock drain_lock(drain_mutex);
+    {
+      std::scoped_lock queues_lock(queues_mutex);
+      for (auto& queue : queues) {
+        while (auto record = queue->records.front()) {
+          batch.push_back(*record);
+          queue->records.pop();
+        }
+        lost += queue->dropped.exchange(0, std::memory_order_relaxed);
+      }
+      queues.erase(std::remove_if(queues.begin(), queues.end(), [](auto& queue){ return queue->orphaned && queue->records.empty(); }), queues.end());
+    }
+
+    std::sort(batch.begin(), batch.end(), [](const Record& a, const Record& b){ return a.sequence < b.sequence; });
+    for (auto& record : batch) write(record);
+    batch.clear();
+
+    if (lost != reported_lost) {
+      Record record {};
+      record.level = LogLevel::WARN;
+      record.length = snprintf(record.text, sizeof(record.text), "[%*s] logger: %llu records dropped, queue full", 8, loglevel_to_sv_lookup.at(to_integral(record.level)), (unsigned long long)(lost - reported_lost));
+      write(record);
+      reported_lost = lost;
+    }
+  }
+
+  std::size_t add_sink(Sink sink) {
+    std::scoped_lock drain_lock(drain_mutex);
+    sinks.push_back({++sink_id, sink});
+    return sink_id;
+  }
+
+  void remove_sink(std::size_t id) {
+    std::scoped_lock drain_lock(drain_mutex);
+    sinks.erase(std::remove_if(sinks.begin(), sinks.end(), [id](auto& sink){ return sink.first == id; }), sinks.end());
+  }
+
+  uint64_t dropped() {
+    std::scoped_lock drain_lock(drain_mutex);
+    return lost;
+  }
+
+private:
+  struct ThreadQueueOwner {
+    std::shared_ptr<ThreadQueue> queue = std::make_shared<ThreadQueue>();
+    ~ThreadQueueOwner() { queue->orphaned = true; }
+  };
+
+  ThreadQueue& thread_queue() {
+    thread_local ThreadQueueOwner owner {};
+    thread_local bool registered = false;
+    if (!registered) {
+      std::scoped_lock queues_lock(queues_mutex);
+      queues.push_back(owner.queue);
+      registered = true;
+    }
+    return *owner.queue;
+  }
+
+  // Called with drain_mutex held
+  void write(const Record& record) {
+    std::string_view text(record.text, record.length);
+    if (logger_callback) logger_callback(text);
+    for (auto& sink : sinks) sink.second(record.level, text);
+    if constexpr (enabled_default_output) {
+      if (record.level > LogLevel::WARN) fprintf(stderr, "%.*s\n", static_cast<int>(text.size()), text.data());
+      fprintf(stdout, "%.*s\n", static_cast<int>(text.size()), text.data());
+    }
+  }
+
+  void execute() {
+    while (running.load(std::memory_order_acquire)) {
+      {
+        std::unique_lock wake_lock(wake_mutex);
+        wake.wait_for(wake_lock, std::chrono::milliseconds(10), [this](){ return pending.load() || !running.load(); });
+      }
+      pending = false;
+      drain();
+    }
+  }
+
+  std::atomic_bool running {false}, pending {false};
+  std::atomic<uint64_t> sequence {0};
+  std::thread worker;
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+
+  std::mutex queues_mutex;
+  std::vector<std::shared_ptr<ThreadQueue>> queues;
+
+  std::mutex drain_mutex;
+  std::vector<Record> batch;
+  std::vector<std::pair<std::size_t, Sink>> sinks;
+  std::size_t sink_id = 0;
+  uint64_t lost = 0, reported_lost = 0;
+};
+
+Backend& backend() {
+  static Backend instance {};
+  return instance;
+}
+
+}
+
+void submit(const Record& record) { backend().submit(record); }
+void flush() { backend().drain(); }
+void shutdown() { backend().stop(); }
+uint64_t dropped() { return backend().dropped(); }
+std::size_t add_sink(Sink sink) { return backend().add_sink(sink); }
+void remove_sink(std::size_t id) { backend().remove_sink(id); }
+
+std::size_t add_file_sink(const std::filesystem::path& path, const LogLevel level) {
+  std::shared_ptr<FILE> file(fopen(path.string().c_str(), "a"), [](FILE* fp){ if (fp) fclose(fp); });
+  if (!file) return 0;
+  return add_sink([file, level](const LogLevel record_level, const std::string_view text) {
+    if (record_level < level) return;
+    fprintf(file.get(), "%.*s\n", static_cast<int>(text.size()), text.data());
+    fflush(file.get());
+  });
+}
 
 }
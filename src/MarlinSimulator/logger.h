@@ -2,7 +2,10 @@
 
 #include <cstdio>
 #include <array>
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <filesystem>
 #include <string_view>
 #include <mutex>
 
@@ -16,8 +19,12 @@ namespace logger {
 #ifndef LOGGER_MIN_LOG_LEVEL
   #define LOGGER_MIN_LOG_LEVEL TRACE
 #endif
+#ifndef LOGGER_ASYNC
+  #define LOGGER_ASYNC 1
+#endif
 
 constexpr const int enabled_default_output = LOGGER_DEFAULT_ENABLED;
+constexpr const bool async_enabled = LOGGER_ASYNC;
 
 enum class LogLevel : uint8_t {
   TRACE,
@@ -31,29 +38,51 @@ enum class LogLevel : uint8_t {
 inline constexpr LogLevel minimum_level = LogLevel::LOGGER_MIN_LOG_LEVEL;
 constexpr const std::array loglevel_to_sv_lookup {"trace", "debug", "info", "warning", "error", "critical"};
 
+/**
+ * Records are formatted on the calling thread and handed to the sinks by a background thread
+ * through a per thread lock free queue, so a log call never waits on the console or the UI.
+ * When a thread's queue is full the record is dropped and counted rather than stalling the caller.
+ * With LOGGER_ASYNC 0, or after shutdown(), records are written to the sinks synchronously.
+ */
+struct Record {
+  uint64_t sequence;
+  LogLevel level;
+  uint16_t length;
+  char text[496];
+};
+
+using Sink = std::function<void(const LogLevel, const std::string_view)>;
+
+// Sinks are called from the logger thread, one record at a time in the order they were logged,
+// the returned id (never 0) is used to remove them again
+std::size_t add_sink(Sink sink);
+void remove_sink(std::size_t id);
+std::size_t add_file_sink(const std::filesystem::path& path, const LogLevel level = LogLevel::TRACE);
+
 extern std::function<void(const std::string_view)> logger_callback;
 inline void set_logger_callback(std::function<void(const std::string_view)> callback) {
   logger_callback = callback;
 }
 
-thread_local static char buffer[512] {};
-extern std::mutex log_write_mutex;
-template <typename... Args> inline void log(const LogLevel level, const char* fmt, Args&&... args) {
-  size_t length = 0;
-  length += snprintf(buffer, sizeof(buffer), "[%*s] ", 8, loglevel_to_sv_lookup.at(to_integral(level)));
-  if constexpr (sizeof...(Args)) length += snprintf(buffer + length, sizeof(buffer) - length, fmt, std::forward<Args>(args)...);
-  else length += snprintf(buffer + length, sizeof(buffer) - length, "%s", fmt);
+// Runtime filter on top of the compile time minimum_level
+extern std::atomic<LogLevel> runtime_level;
+inline void set_level(const LogLevel level) { runtime_level.store(level, std::memory_order_relaxed); }
+inline LogLevel level() { return runtime_level.load(std::memory_order_relaxed); }
 
-  {
-    std::scoped_lock log_write_lock(log_write_mutex);
-    if (logger_callback) {
-      logger_callback(buffer);
-    }
-    if constexpr (enabled_default_output) {
-      if (level > LogLevel::WARN) fprintf(stderr, "%.*s\n", static_cast<int>(length), buffer);
-      fprintf(stdout, "%.*s\n", static_cast<int>(length), buffer);
-    }
-  }
+void submit(const Record& record);
+void flush();     // write out everything logged so far before returning
+void shutdown();  // stop the logger thread, later records are written synchronously
+uint64_t dropped();
+
+thread_local static Record record {};
+template <typename... Args> inline void log(const LogLevel level, const char* fmt, Args&&... args) {
+  if (level < runtime_level.load(std::memory_order_relaxed)) return;
+  int length = snprintf(record.text, sizeof(record.text), "[%*s] ", 8, loglevel_to_sv_lookup.at(to_integral(level)));
+  if constexpr (sizeof...(Args)) length += snprintf(record.text + length, sizeof(record.text) - length, fmt, std::forward<Args>(args)...);
+  else length += snprintf(record.text + length, sizeof(record.text) - length, "%s", fmt);
+  record.level = level;
+  record.length = std::min<std::size_t>(length, sizeof(record.text) - 1);
+  submit(record);
 }
 
 template <typename... Args> inline void trace(const char* fmt, Args&&... args) {
@@ -3,6 +3,8 @@
 
 #include "application.h"
 #include "execution_control.h"
+#include "logger.h"
+#include "serial_capture.h"
 
 #include "src/inc/MarlinConfig.h"
 
@@ -84,6 +86,8 @@ int main(int, char**) {
   Kernel::quit_requested = true;
   simulation_loop.join();
   net_serial.stop();
+  serial_capture::stop();
+  logger::shutdown();
 
   SDLNet_Quit();
   SDL_Quit();
@@ -0,0 +1,168 @@
+#include "mapped_file.h"
+#include "logger.h"
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path, std::size_t size) {
+  close();
+  writable = true;
+  file_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_handle == INVALID_HANDLE_VALUE) {
+    file_handle = nullptr;
+    logger::error("MappedFile: unable to open %s", path.c_str());
+    return false;
+  }
+  filename = path;
+  LARGE_INTEGER file_size {};
+  GetFileSizeEx(file_handle, &file_size);
+  length = std::size_t(file_size.QuadPart);
+  if (size) return resize(size);
+  return map();
+}
+
+bool MappedFile::open_read_only(const std::string& path) {
+  close();
+  writable = false;
+  file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file_handle == INVALID_HANDLE_VALUE) {
+    file_handle = nullptr;
+    logger::error("MappedFile: unable to open %s", path.c_str());
+    return false;
+  }
+  filename = path;
+  LARGE_INTEGER file_size {};
+  GetFileSizeEx(file_handle, &file_size);
+  length = std::size_t(file_size.QuadPart);
+  return map();
+}
+
+bool MappedFile::resize(std::size_t size) {
+  if (file_handle == nullptr || !writable) return false;
+  unmap();
+  LARGE_INTEGER position {};
+  position.QuadPart = LONGLONG(size);
+  if (!SetFilePointerEx(file_handle, position, nullptr, FILE_BEGIN) || !SetEndOfFile(file_handle)) {
+    logger::error("MappedFile: unable to resize %s", filename.c_str());
+    return false;
+  }
+  length = size;
+  return map();
+}
+
+bool MappedFile::map() {
+  if (length == 0) return true;
+  mapping_handle = CreateFileMappingA(file_handle, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_handle != nullptr) mapping = (uint8_t*)MapViewOfFile(mapping_handle, writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, length);
+  if (mapping == nullptr) {
+    logger::error("MappedFile: unable to map %s", filename.c_str());
+    unmap();
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::unmap() {
+  if (mapping) UnmapViewOfFile(mapping);
+  if (mapping_handle) CloseHandle(mapping_handle);
+  mapping = nullptr;
+  mapping_handle = nullptr;
+}
+
+bool MappedFile::sync(std::size_t offset, std::size_t size) {
+  if (mapping == nullptr || !writable) return false;
+  return FlushViewOfFile(mapping + offset, size ? size : length - offset) && FlushFileBuffers(file_handle);
+}
+
+void MappedFile::close() {
+  unmap();
+  if (file_handle) CloseHandle(file_handle);
+  file_handle = nullptr;
+  length = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path, std::size_t size) {
+  close();
+  writable = true;
+  file_descriptor = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (file_descriptor < 0) {
+    logger::error("MappedFile: unable to open %s", path.c_str());
+    return false;
+  }
+  filename = path;
+  struct stat status {};
+  fstat(file_descriptor, &status);
+  length = std::size_t(status.st_size);
+  if (size) return resize(size);
+  return map();
+}
+
+bool MappedFile::open_read_only(const std::string& path) {
+  close();
+  writable = false;
+  file_descriptor = ::open(path.c_str(), O_RDONLY);
+  if (file_descriptor < 0) {
+    logger::error("MappedFile: unable to open %s", path.c_str());
+    return false;
+  }
+  filename = path;
+  struct stat status {};
+  fstat(file_descriptor, &status);
+  length = std::size_t(status.st_size);
+  return map();
+}
+
+bool MappedFile::resize(std::size_t size) {
+  if (file_descriptor < 0 || !writable) return false;
+  unmap();
+  if (ftruncate(file_descriptor, off_t(size)) != 0) {
+    logger::error("MappedFile: unable to resize %s", filename.c_str());
+    return false;
+  }
+  length = size;
+  return map();
+}
+
+bool MappedFile::map() {
+  if (length == 0) return true;
+  void* address = mmap(nullptr, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file_descriptor, 0);
+  if (address == MAP_FAILED) {
+    logger::error("MappedFile: unable to map %s", filename.c_str());
+    return false;
+  }
+  mapping = (uint8_t*)address;
+  return true;
+}
+
+void MappedFile::unmap() {
+  if (mapping) munmap(mapping, length);
+  mapping = nullptr;
+}
+
+bool MappedFile::sync(std::size_t offset, std::size_t size) {
+  if (mapping == nullptr || !writable) return false;
+  // msync needs a page aligned start
+  std::size_t page = std::size_t(sysconf(_SC_PAGESIZE));
+  std::size_t start = offset & ~(page - 1);
+  std::size_t end = size ? offset + size : length;
+  return msync(mapping + start, end - start, MS_SYNC) == 0;
+}
+
+void MappedFile::close() {
+  unmap();
+  if (file_descriptor >= 0) ::close(file_descriptor);
+  file_descriptor = -1;
+  length = 0;
+}
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+/**
+ * A file mapped read/write into memory (MAP_SHARED / a Win32 file mapping).
+ *
+ * The whole file is mapped, resize() remaps and therefore invalidates data(). Callers that hand out
+ * pointers into the mapping map fixed size files instead and never resize them. A file opened with
+ * open_read_only() is shared with other processes as is, writing through data() faults.
+ */
+class MappedFile {
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  // Opens (creating when missing) and maps the file, a non zero size grows or truncates it first
+  bool open(const std::string& path, std::size_t size = 0);
+  // Maps an existing file read only, it is never created or resized
+  bool open_read_only(const std::string& path);
+  bool resize(std::size_t size);
+  // Writes the byte range back to the file, the whole mapping when length is 0
+  bool sync(std::size_t offset = 0, std::size_t length = 0);
+  void close();
+
+  #ifdef _WIN32
+    bool is_open() const { return file_handle != nullptr; }
+  #else
+    bool is_open() const { return file_descriptor >= 0; }
+  #endif
+  uint8_t* data() { return mapping; }
+  const uint8_t* data() const { return mapping; }
+  std::size_t size() const { return length; }
+  const std::string& path() const { return filename; }
+  bool is_writable() const { return writable; }
+
+private:
+  bool map();
+  void unmap();
+
+  std::string filename;
+  uint8_t* mapping = nullptr;
+  std::size_t length = 0;
+  bool writable = true;
+  #ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+  #else
+    int file_descriptor = -1;
+  #endif
+};
@@ -23,6 +23,7 @@
 #include <iostream>
 #include <src/inc/MarlinConfig.h>
 #include <MarlinSimulator/execution_control.h>
+#include <MarlinSimulator/hardware/pwm.h>
 #include <src/HAL/shared/Delay.h>
 
 // Interrupts
@@ -63,9 +64,17 @@ void pinMode(const pin_t pin, const uint8_t mode) {
 
 void digitalWrite(pin_t pin, uint8_t pin_status) {
   if (!isValidPin(pin)) return;
+  if (Pwm::active(pin)) Pwm::stop(pin);
   Gpio::set(pin, pin_status);
 }
 
+void digitalWritePort(const pin_t* pins, uint8_t count, uint32_t mask, uint32_t value) {
+  for (uint8_t i = 0; i < count && i < 32; i++) {
+    if (!isValidPin(pins[i])) mask &= ~(1u << i);
+  }
+  Gpio::write_port(pins, count, mask, value);
+}
+
 bool digitalRead(pin_t pin) {
   if (!isValidPin(pin)) return false;
   return Gpio::get(pin);
@@ -73,7 +82,13 @@ bool digitalRead(pin_t pin) {
 
 void analogWrite(pin_t pin, int pwm_value) {  // 1 - 254: pwm_value, 0: LOW, 255: HIGH
   if (!isValidPin(pin)) return;
-  Gpio::set(pin, pwm_value);
+  if (pwm_value < 0) pwm_value = 0;
+  Pwm::write(pin, pwm_value, pwm_value > 255 ? 65535 : 255);  // servos write 16 bit pulse widths
+}
+
+void analogWriteFrequency(pin_t pin, uint32_t frequency) {
+  if (!isValidPin(pin)) return;
+  Pwm::set_frequency(pin, frequency);
 }
 
 uint16_t analogRead(pin_t adc_pin) {
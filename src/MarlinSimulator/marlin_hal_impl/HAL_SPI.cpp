@@ -46,6 +46,7 @@ void spiBegin() {
 
 void spiInit(uint8_t spiRate) {
   // SPI_speed = swSpiInit(spiRate, SD_SCK_PIN, SD_MOSI_PIN);
+  spi_bus.set_clock(SPISettings::spiRate2Clock(spiRate));
   WRITE(SD_MOSI_PIN, HIGH);
   WRITE(SD_SCK_PIN, LOW);
 }
@@ -85,6 +86,7 @@ void SPIClass::end() {
 
 void SPIClass::beginTransaction(const SPISettings& s) {
   setClock(s.clock);
+  spi_bus.set_clock(s.clock);
   setDataMode(s.dataMode);
   setDataSize(s.dataSize);
   setBitOrder(s.bitOrder);
@@ -116,12 +118,8 @@ void SPIClass::read(uint8_t *buf, uint32_t len) {
 }
 
 void SPIClass::dmaSend(void *buf, uint16_t length, bool minc) {
-  uint8_t *ptr = (uint8_t*)buf;
-  while(length--) {
-    if (_currentSetting->dataSize == DATA_SIZE_16BIT) spiSend(*(ptr + 1));
-    spiSend(*ptr);
-    if (minc) ptr += _currentSetting->dataSize;
-  }
+  if (_currentSetting->dataSize == DATA_SIZE_16BIT) spi_bus.transfer<uint16_t>((uint16_t*)buf, nullptr, length, minc);
+  else spi_bus.transfer<uint8_t>((uint8_t*)buf, nullptr, length, minc);
 }
 
 uint8_t SPIClass::dmaTransfer(const void * transmitBuf, void * receiveBuf, uint16_t length) {
@@ -24,57 +24,83 @@
 #if ENABLED(EEPROM_SETTINGS)
 
 #include <src/HAL/shared/eeprom_api.h>
-#include <stdio.h>
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+
+#include <MarlinSimulator/mapped_file.h>
+#include <MarlinSimulator/logger.h>
 
 #ifndef MARLIN_EEPROM_SIZE
   #define MARLIN_EEPROM_SIZE 0x1000 // 4KB of Emulated EEPROM
 #endif
+// MARLIN_SIMULATOR_EEPROM in the environment overrides it, so instances can run side by side
+#ifndef MARLIN_EEPROM_FILE
+  #define MARLIN_EEPROM_FILE "eeprom.dat"
+#endif
 
-uint8_t buffer[MARLIN_EEPROM_SIZE];
-char filename[] = "eeprom.dat";
+/**
+ * The store is a mapped file. A session reads and writes `buffer`, and access_finish() copies only the
+ * range of bytes that changed into the mapping and syncs it. A process killed mid save leaves the file
+ * as it was, and a save that changes nothing writes nothing.
+ */
+static uint8_t buffer[MARLIN_EEPROM_SIZE];
+static MappedFile store;
+static std::size_t dirty_begin = 0, dirty_end = 0;
+static bool saving = false;
+static uint32_t save_count = 0;
+static uint64_t bytes_saved = 0;
 
 size_t PersistentStore::capacity() { return MARLIN_EEPROM_SIZE; }
 
 bool PersistentStore::access_start() {
-  const char eeprom_erase_value = 0xFF;
-  FILE * eeprom_file = fopen(filename, "rb");
-  if (eeprom_file == nullptr) {
-    eeprom_file = fopen(filename, "wb");
-    if (eeprom_file == nullptr) return false;
-    for (size_t i = 0; i < MARLIN_EEPROM_SIZE; i++) fputc('\0', eeprom_file);
-    fclose(eeprom_file);
-    eeprom_file = fopen(filename, "rb");
-    if (eeprom_file == nullptr) return false;
-  }
-
-  fseek(eeprom_file, 0L, SEEK_END);
-  std::size_t file_size = ftell(eeprom_file);
-
-  if (file_size < MARLIN_EEPROM_SIZE) {
-    memset(buffer + file_size, eeprom_erase_value, MARLIN_EEPROM_SIZE - file_size);
-  }
-  else {
-    fseek(eeprom_file, 0L, SEEK_SET);
-    fread(buffer, sizeof(uint8_t), sizeof(buffer), eeprom_file);
+  const uint8_t eeprom_erase_value = 0xFF;
+  if (!store.is_open()) {
+    const char* path = getenv("MARLIN_SIMULATOR_EEPROM");
+    if (path == nullptr || *path == '\0') path = MARLIN_EEPROM_FILE;
+    std::error_code error;
+    std::size_t file_size = std::filesystem::exists(path, error) ? std::filesystem::file_size(path, error) : 0;
+    if (error) file_size = 0;
+    // a larger file is kept as it is
+    if (!store.open(path, std::max<std::size_t>(file_size, MARLIN_EEPROM_SIZE))) return false;
+    const std::size_t existing = std::min<std::size_t>(file_size, MARLIN_EEPROM_SIZE);
+    // a new file, or the part a shorter one did not cover, reads as erased
+    memset(store.data() + existing, eeprom_erase_value, MARLIN_EEPROM_SIZE - existing);
   }
-
-  fclose(eeprom_file);
+  // the file may have been changed from outside since the last session
+  memcpy(buffer, store.data(), MARLIN_EEPROM_SIZE);
+  dirty_begin = dirty_end = 0;
+  saving = false;
   return true;
 }
 
 bool PersistentStore::access_finish() {
-  FILE * eeprom_file = fopen(filename, "wb");
-  if (!eeprom_file) return false;
-  fwrite(buffer, sizeof(uint8_t), sizeof(buffer), eeprom_file);
-  fclose(eeprom_file);
+  if (!store.is_open()) return false;
+  if (!saving) return true;
+  saving = false;
+  save_count++;
+  if (dirty_end > dirty_begin) {
+    memcpy(store.data() + dirty_begin, buffer + dirty_begin, dirty_end - dirty_begin);
+    if (!store.sync(dirty_begin, dirty_end - dirty_begin)) return false;
+    bytes_saved += dirty_end - dirty_begin;
+  }
+  logger::info("EEPROM: save %u wrote %zu bytes, %llu in total", save_count, dirty_end - dirty_begin, (unsigned long long)bytes_saved);
+  dirty_begin = dirty_end = 0;
   return true;
 }
 
 bool PersistentStore::write_data(int &pos, const uint8_t *value, size_t size, uint16_t *crc) {
   std::size_t bytes_written = 0;
 
+  saving = true;
   for (std::size_t i = 0; i < size; i++) {
-    buffer[pos+i] = value[i];
+    if (pos + i >= MARLIN_EEPROM_SIZE) break;
+    if (buffer[pos+i] != value[i]) {
+      // grow the dirty range to cover the changed byte
+      dirty_begin = dirty_end > dirty_begin ? std::min<std::size_t>(dirty_begin, pos + i) : pos + i;
+      dirty_end = std::max<std::size_t>(dirty_end, pos + i + 1);
+      buffer[pos+i] = value[i];
+    }
     bytes_written ++;
   }
 
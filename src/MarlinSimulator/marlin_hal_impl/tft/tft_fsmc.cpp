@@ -0,0 +1,79 @@
+/**
+ * Marlin 3D Printer Firmware
+ * Copyright (c) 2020 MarlinFirmware [https://github.com/MarlinFirmware/Marlin]
+ *
+ * Based on Sprinter and grbl.
+ * Copyright (c) 2011 Camiel Gubbels / Erik van der Zalm
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <src/inc/MarlinConfig.h>
+
+#if HAS_FSMC_TFT
+
+#include "tft_fsmc.h"
+#include "../../hardware/bus/fsmc.h"
+
+static FsmcBus &fsmc_bus = FsmcBus0;
+
+#define TFT_RST_H WRITE(TFT_RESET_PIN, HIGH)
+
+#define TFT_BLK_H WRITE(TFT_BACKLIGHT_PIN, HIGH)
+
+void TFT_FSMC::init() {
+  #if PIN_EXISTS(TFT_RESET)
+    SET_OUTPUT(TFT_RESET_PIN);
+    TFT_RST_H;
+    delay(100);
+  #endif
+
+  #if PIN_EXISTS(TFT_BACKLIGHT)
+    SET_OUTPUT(TFT_BACKLIGHT_PIN);
+    TFT_BLK_H;
+  #endif
+}
+
+uint32_t TFT_FSMC::getID() {
+  uint32_t id;
+  writeReg(0x0000);
+  id = fsmc_bus.read_data();
+  if (id == 0)
+    id = readID(LCD_READ_ID);
+  if ((id & 0xFFFF) == 0 || (id & 0xFFFF) == 0xFFFF)
+    id = readID(LCD_READ_ID4);
+  return id;
+}
+
+uint32_t TFT_FSMC::readID(const uint16_t inReg) {
+  uint32_t id;
+  writeReg(inReg);
+  id = fsmc_bus.read_data(); // dummy read
+  id = inReg << 24;
+  id |= (fsmc_bus.read_data() & 0x00FF) << 16;
+  id |= (fsmc_bus.read_data() & 0x00FF) << 8;
+  id |= fsmc_bus.read_data() & 0x00FF;
+  return id;
+}
+
+void TFT_FSMC::writeReg(const uint16_t inReg) { fsmc_bus.write_register(inReg); }
+void TFT_FSMC::transmit(uint16_t data) { fsmc_bus.write_data(data); }
+
+// The words go to the device in one block, there is no transfer size limit to split at
+void TFT_FSMC::transmit(uint32_t memoryIncrease, uint16_t *data, uint32_t count) {
+  fsmc_bus.write_block(data, count, memoryIncrease == DMA_MINC_ENABLE);
+}
+
+#endif // HAS_FSMC_TFT
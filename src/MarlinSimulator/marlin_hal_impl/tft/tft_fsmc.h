@@ -0,0 +1,69 @@
+/**
+ * Marlin 3D Printer Firmware
+ * Copyright (c) 2020 MarlinFirmware [https://github.com/MarlinFirmware/Marlin]
+ *
+ * Based on Sprinter and grbl.
+ * Copyright (c) 2011 Camiel Gubbels / Erik van der Zalm
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ *
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * The simulated FSMC bank has no DMA channel to set up or wait on, a write to the RAM address is the
+ * device's write, so the DMA and polled variants are the same call and isBusy() is always false.
+ */
+
+#ifndef LCD_READ_ID
+  #define LCD_READ_ID  0x04   // Read display identification information
+#endif
+#ifndef LCD_READ_ID4
+  #define LCD_READ_ID4 0xD3   // Read display identification information (0xD3 on ILI9341)
+#endif
+
+#define DATASIZE_8BIT    1
+#define DATASIZE_16BIT   2
+#define TFT_IO_DRIVER    TFT_FSMC
+#define DMA_MAX_WORDS    0xFFFF
+
+#define DMA_MINC_ENABLE  1
+#define DMA_MINC_DISABLE 0
+
+class TFT_FSMC {
+  private:
+    static uint32_t readID(const uint16_t inReg);
+    static void transmit(uint16_t data);
+    static void transmit(uint32_t memoryIncrease, uint16_t *data, uint32_t count);
+
+  public:
+    static void init();
+    static uint32_t getID();
+    static bool isBusy() { return false; }
+    static void abort() {}
+
+    static void dataTransferBegin(uint16_t dataWidth=DATASIZE_16BIT) {}
+    static void dataTransferEnd() {}
+
+    static void writeData(uint16_t data) { transmit(data); }
+    static void writeReg(const uint16_t inReg);
+
+    static void writeSequence_DMA(uint16_t *data, uint16_t count) { transmit(DMA_MINC_ENABLE, data, count); }
+    static void writeMultiple_DMA(uint16_t color, uint16_t count) { static uint16_t data; data = color; transmit(DMA_MINC_DISABLE, &data, count); }
+
+    static void writeSequence(uint16_t *data, uint16_t count) { transmit(DMA_MINC_ENABLE, data, count); }
+    static void writeMultiple(uint16_t color, uint32_t count) { static uint16_t data; data = color; transmit(DMA_MINC_DISABLE, &data, count); }
+};
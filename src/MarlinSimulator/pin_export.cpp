@@ -0,0 +1,233 @@
+#include "pin_export.h"
+#include "logger.h"
+
+#include <chrono>
+#include <limits>
+#include <ctime>
+#include <map>
+#include <queue>
+
+namespace {
+
+class VcdStream {
+public:
+  VcdStream(FILE* file, const std::vector<PinExport::Signal>& signals) : file(file), last(signals.size(), -1) {
+    char date[64] = "";
+    auto now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+    fprintf(file, "$date %s $end\n$version MarlinSimulator $end\n$timescale 1 ns $end\n", date);
+
+    // scope is the pin name up to the first '_', X_STEP_PIN belongs to X
+    std::map<std::string, std::vector<std::size_t>> scopes;
+    for (std::size_t i = 0; i < signals.size(); i++) {
+      identifiers.push_back(identifier(i));
+      scopes[signals[i].name.substr(0, signals[i].name.find_first_of('_'))].push_back(i);
+    }
+    for (auto& [scope, members] : scopes) {
+      fprintf(file, "$scope module %s $end\n", scope.c_str());
+      for (auto i : members) fprintf(file, "$var wire 1 %s %s $end\n", identifiers[i].c_str(), signals[i].name.c_str());
+      fprintf(file, "$upscope $end\n");
+    }
+    fprintf(file, "$enddefinitions $end\n");
+  }
+
+  // Times must not go backwards, an unchanged value is not written
+  bool change(std::size_t index, uint64_t time, uint16_t value) {
+    int level = value != 0;
+    if (last[index] == level) return false;
+    if (time != current) fprintf(file, "#%llu\n", (unsigned long long)time);
+    current = time;
+    fprintf(file, "%d%s\n", level, identifiers[index].c_str());
+    last[index] = level;
+    return true;
+  }
+
+private:
+  static std::string identifier(std::size_t index) {
+    std::string code;
+    do {
+      code.push_back(char('!' + index % 94));
+      index /= 94;
+    } while (index);
+    return code;
+  }
+
+  FILE* file;
+  uint64_t current = std::numeric_limits<uint64_t>::max();
+  std::vector<std::string> identifiers;
+  std::vector<int> last;
+};
+
+// Merges per signal event runs that are each sorted by time
+template <typename Source, typename Output>
+void merge(std::vector<Source>& sources, Output output, const std::atomic_bool& cancel) {
+  struct Head {
+    uint64_t timestamp;
+    std::size_t index;
+    bool operator>(const Head& other) const { return timestamp > other.timestamp || (timestamp == other.timestamp && index > other.index); }
+  };
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+  std::vector<pin_log_data> current(sources.size());
+  for (std::size_t i = 0; i < sources.size(); i++) {
+    if (sources[i].next(current[i])) heads.push({current[i].timestamp, i});
+  }
+  while (heads.size() && !cancel) {
+    auto head = heads.top();
+    heads.pop();
+    output(head.index, current[head.index]);
+    if (sources[head.index].next(current[head.index])) heads.push({current[head.index].timestamp, head.index});
+  }
+}
+
+// A run of events already copied out of a trace
+struct EventRun {
+  std::vector<pin_log_data> events;
+  std::size_t position = 0;
+  bool next(pin_log_data& event) {
+    if (position == events.size()) return false;
+    event = events[position++];
+    return true;
+  }
+};
+
+}
+
+bool PinExport::begin(const std::string& filename, FILE*& file) {
+  if (running) return false;
+  if (worker.joinable()) worker.join();
+  file = fopen(filename.c_str(), "w");
+  if (file == nullptr) {
+    logger::error("PinExport: unable to open %s", filename.c_str());
+    std::scoped_lock lock(status_mutex);
+    status_text = "Unable to open " + filename;
+    return false;
+  }
+  cancel = false;
+  processed = total = 0;
+  running = true;
+  std::scoped_lock lock(status_mutex);
+  status_text.clear();
+  return true;
+}
+
+void PinExport::finish(FILE* file, const char* result) {
+  fclose(file);
+  {
+    std::scoped_lock lock(status_mutex);
+    status_text = result;
+  }
+  logger::info("PinExport: %s, %llu changes", result, (unsigned long long)processed.load());
+  running = false;
+}
+
+bool PinExport::export_file(const std::string& filename, std::vector<Signal> signals) {
+  FILE* file = nullptr;
+  if (!begin(filename, file)) return false;
+  continuous = false;
+  worker = std::thread(&PinExport::execute_export, this, file, std::move(signals));
+  return true;
+}
+
+bool PinExport::record(const std::string& filename, std::vector<Signal> signals) {
+  FILE* file = nullptr;
+  if (!begin(filename, file)) return false;
+  continuous = true;
+  worker = std::thread(&PinExport::execute_record, this, file, std::move(signals));
+  return true;
+}
+
+bool PinExport::export_events(const std::string& filename, std::vector<Signal> signals, std::vector<std::vector<pin_log_data>> runs) {
+  FILE* file = nullptr;
+  if (signals.size() != runs.size() || !begin(filename, file)) return false;
+  continuous = false;
+  worker = std::thread(&PinExport::execute_events, this, file, std::move(signals), std::move(runs));
+  return true;
+}
+
+void PinExport::stop() {
+  cancel = true;
+  if (worker.joinable()) worker.join();
+}
+
+std::string PinExport::status() {
+  std::scoped_lock lock(status_mutex);
+  return status_text;
+}
+
+void PinExport::execute_export(FILE* file, std::vector<Signal> signals) {
+  std::vector<PinTrace::Cursor> cursors;
+  uint64_t origin = std::numeric_limits<uint64_t>::max(), events = 0;
+  for (auto& signal : signals) {
+    auto& trace = Gpio::trace(signal.pin);
+    cursors.push_back(trace.cursor());
+    pin_log_data first;
+    if (cursors.back().peek(first)) origin = std::min(origin, first.timestamp);
+    events += trace.size();
+  }
+  total = events;
+
+  VcdStream vcd(file, signals);
+  merge(cursors, [&](std::size_t index, const pin_log_data& event) {
+    vcd.change(index, event.timestamp - origin, event.value);
+    processed++;
+  }, cancel);
+  finish(file, cancel ? "Export cancelled" : "Export complete");
+}
+
+void PinExport::execute_events(FILE* file, std::vector<Signal> signals, std::vector<std::vector<pin_log_data>> runs) {
+  std::vector<EventRun> sources(runs.size());
+  uint64_t origin = std::numeric_limits<uint64_t>::max(), events = 0;
+  for (std::size_t i = 0; i < runs.size(); i++) {
+    if (runs[i].size()) origin = std::min(origin, runs[i].front().timestamp);
+    events += runs[i].size();
+    sources[i].events = std::move(runs[i]);
+  }
+  total = events;
+
+  VcdStream vcd(file, signals);
+  merge(sources, [&](std::size_t index, const pin_log_data& event) {
+    vcd.change(index, event.timestamp - origin, event.value);
+    processed++;
+  }, cancel);
+  finish(file, cancel ? "Export cancelled" : "Export complete");
+}
+
+// Every pass writes the events in [horizon, now), everything before the simulation time read at the
+// start of a pass has already been appended to the traces
+void PinExport::execute_record(FILE* file, std::vector<Signal> signals) {
+  VcdStream vcd(file, signals);
+  uint64_t origin = Kernel::SimulationRuntime::nanos(), horizon = origin;
+
+  // the level each pin had when recording started
+  for (std::size_t i = 0; i < signals.size(); i++) {
+    pin_log_data event;
+    auto cursor = Gpio::trace(signals[i].pin).cursor(origin);
+    vcd.change(i, 0, cursor.next(event) && event.timestamp <= origin ? event.value : Gpio::get_pin_value(signals[i].pin));
+  }
+
+  std::vector<EventRun> runs(signals.size());
+  std::atomic_bool uncancelled {false};
+  for (bool last_pass = false; !last_pass;) {
+    last_pass = cancel;
+    uint64_t now = Kernel::SimulationRuntime::nanos();
+    for (std::size_t i = 0; i < signals.size(); i++) {
+      runs[i].events.clear();
+      runs[i].position = 0;
+      pin_log_data event;
+      for (auto cursor = Gpio::trace(signals[i].pin).cursor(horizon, now); cursor.next(event) && event.timestamp < now;) {
+        if (event.timestamp >= horizon) runs[i].events.push_back(event);
+      }
+    }
+    merge(runs, [&](std::size_t index, const pin_log_data& event) {
+      if (vcd.change(index, event.timestamp - origin, event.value)) processed++;
+    }, uncancelled);
+    fflush(file);
+    horizon = now;
+
+    if (!last_pass) {
+      auto wake = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+      while (!cancel && std::chrono::steady_clock::now() < wake) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+  }
+  finish(file, "Recording stopped");
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hardware/Gpio.h"
+
+/**
+ * Value Change Dump output of the pin traces, written on a worker thread.
+ *
+ * export_file() writes the history currently held by the traces, merging the per pin logs (each
+ * already in time order) with a k-way merge rather than sorting every event. record() keeps a file
+ * open and appends everything logged from then on until stop() is called.
+ *
+ * Timestamps are written in nanoseconds relative to the first exported event as 64 bit values, the
+ * vendored vcd-writer is limited to 32 bit timestamps which overflows after a few seconds at 1 ns.
+ */
+class PinExport {
+public:
+  struct Signal {
+    pin_type pin;
+    std::string name;
+  };
+
+  ~PinExport() { stop(); }
+
+  bool export_file(const std::string& filename, std::vector<Signal> signals);
+  bool record(const std::string& filename, std::vector<Signal> signals);
+  // Writes events held outside the traces, such as a triggered capture, one time ordered run per signal
+  bool export_events(const std::string& filename, std::vector<Signal> signals, std::vector<std::vector<pin_log_data>> runs);
+  // Ends a recording, or cancels an export in progress
+  void stop();
+
+  bool busy() const { return running; }
+  bool recording() const { return running && continuous; }
+  float progress() const { return total ? float(processed) / total : 0.0f; }
+  uint64_t changes() const { return processed; }
+  std::string status();
+
+private:
+  void execute_export(FILE* file, std::vector<Signal> signals);
+  void execute_record(FILE* file, std::vector<Signal> signals);
+  void execute_events(FILE* file, std::vector<Signal> signals, std::vector<std::vector<pin_log_data>> runs);
+  bool begin(const std::string& filename, FILE*& file);
+  void finish(FILE* file, const char* result);
+
+  std::thread worker;
+  std::atomic_bool running {false}, cancel {false};
+  bool continuous = false;
+  std::atomic<uint64_t> processed {0}, total {0};
+  std::mutex status_mutex;
+  std::string status_text;
+};
@@ -0,0 +1,208 @@
+#include "serial_capture.h"
+#include "logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+namespace serial_capture {
+
+std::atomic_bool capture_active {false};
+
+namespace {
+
+// Byte ring written by the simulation thread one whole record at a time and read by the writer thread.
+// Only whole records are published, so a read of everything available ends on a record boundary.
+class ByteRing {
+public:
+  static constexpr std::size_t capacity = 8 * 1024 * 1024;
+
+  std::size_t available() const { return index_write.load(std::memory_order_acquire) - index_read.load(std::memory_order_relaxed); }
+  std::size_t free() const { return capacity - (index_write.load(std::memory_order_relaxed) - index_read.load(std::memory_order_acquire)); }
+
+  // Producer: copy without publishing, publish() makes everything written visible at once
+  void write(const uint8_t* data, std::size_t length) {
+    for (std::size_t copied = 0; copied < length;) {
+      auto offset = (index_write.load(std::memory_order_relaxed) + pending + copied) & (capacity - 1);
+      auto count = std::min(length - copied, capacity - offset);
+      std::memcpy(buffer.get() + offset, data + copied, count);
+      copied += count;
+    }
+    pending += length;
+  }
+
+  void publish() {
+    index_write.store(index_write.load(std::memory_order_relaxed) + pending, std::memory_order_release);
+    pending = 0;
+  }
+
+  std::size_t read(uint8_t* output, std::size_t length) {
+    length = std::min(length, available());
+    auto read = index_read.load(std::memory_order_relaxed);
+    for (std::size_t copied = 0; copied < length;) {
+      auto offset = (read + copied) & (capacity - 1);
+      auto count = std::min(length - copied, capacity - offset);
+      std::memcpy(output + copied, buffer.get() + offset, count);
+      copied += count;
+    }
+    index_read.store(read + length, std::memory_order_release);
+    return length;
+  }
+
+  void reset() {
+    index_write = index_read = 0;
+    pending = 0;
+  }
+
+private:
+  std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(capacity);
+  alignas(64) std::atomic<std::size_t> index_write {0};
+  alignas(64) std::atomic<std::size_t> index_read {0};
+  std::size_t pending = 0;
+};
+
+struct Writer {
+  std::mutex control_mutex;
+  std::unique_ptr<ByteRing> ring;
+  std::unique_ptr<uint8_t[]> chunk;  // ring sized, a flush drains everything published as one chunk
+  FILE* file = nullptr;
+  std::thread thread;
+  std::atomic_bool running {false};
+  std::mutex wake_mutex;
+  std::condition_variable wake;
+
+  // producer state, simulation thread only
+  uint64_t last_tick = 0;
+  uint64_t gap_bytes = 0;
+
+  std::atomic<uint64_t> captured {0}, dropped {0}, written {0};
+  std::atomic_bool producer_busy {false};
+
+  void write_chunk(const uint8_t* payload, std::size_t length) {
+    uint8_t prefix[4] = { uint8_t(length), uint8_t(length >> 8), uint8_t(length >> 16), uint8_t(length >> 24) };
+    fwrite(prefix, 1, sizeof(prefix), file);
+    fwrite(payload, 1, length, file);
+    written += sizeof(prefix) + length;
+  }
+
+  // Never cut a record in two, the converter parses each chunk on its own
+  void flush() {
+    if (std::size_t length = ring->read(chunk.get(), ByteRing::capacity)) write_chunk(chunk.get(), length);
+    fflush(file);
+  }
+
+  void execute() {
+    while (running) {
+      {
+        std::unique_lock wake_lock(wake_mutex);
+        wake.wait_for(wake_lock, std::chrono::milliseconds(50));
+      }
+      flush();
+    }
+  }
+} writer;
+
+void append(uint8_t port, Direction direction, uint64_t tick, const uint8_t* data, std::size_t length) {
+  auto& ring = *writer.ring;
+  uint8_t header[1 + 10 + 10];
+  uint64_t delta = tick >= writer.last_tick ? tick - writer.last_tick : 0;
+  uint8_t flags = (port & PORT_MASK) | (direction == FIRMWARE_TO_HOST ? DIRECTION : 0);
+
+  if (writer.gap_bytes) {
+    std::size_t gap_length = 0;
+    header[gap_length++] = flags | GAP;
+    gap_length += encode_varint(delta, header + gap_length);
+    gap_length += encode_varint(writer.gap_bytes, header + gap_length);
+    if (ring.free() < gap_length) {
+      writer.gap_bytes += length;
+      writer.dropped += length;
+      return;
+    }
+    ring.write(header, gap_length);
+    ring.publish();
+    writer.gap_bytes = 0;
+    writer.last_tick = tick;
+    delta = 0;
+  }
+
+  std::size_t header_length = 0;
+  header[header_length++] = flags;
+  header_length += encode_varint(delta, header + header_length);
+  header_length += encode_varint(length, header + header_length);
+  if (ring.free() < header_length + length) {
+    writer.gap_bytes += length;
+    writer.dropped += length;
+    return;
+  }
+  ring.write(header, header_length);
+  ring.write(data, length);
+  ring.publish();
+  writer.last_tick = tick;
+  writer.captured += length;
+
+  if (ring.available() > ByteRing::capacity / 2) writer.wake.notify_one();
+}
+
+}
+
+bool start(const std::string& filename, uint32_t tick_frequency) {
+  std::scoped_lock lock(writer.control_mutex);
+  if (writer.running) return false;
+
+  writer.file = fopen(filename.c_str(), "wb");
+  if (writer.file == nullptr) {
+    logger::error("serial_capture: unable to open %s", filename.c_str());
+    return false;
+  }
+
+  uint8_t header[header_size] = {};
+  std::memcpy(header, magic, sizeof(magic));
+  header[8] = uint8_t(version);
+  header[9] = uint8_t(version >> 8);
+  for (std::size_t i = 0; i < 4; i++) header[12 + i] = uint8_t(tick_frequency >> (i * 8));
+  fwrite(header, 1, sizeof(header), writer.file);
+
+  if (!writer.ring) writer.ring = std::make_unique<ByteRing>();
+  if (!writer.chunk) writer.chunk = std::make_unique<uint8_t[]>(ByteRing::capacity);
+  writer.ring->reset();
+  writer.last_tick = 0;
+  writer.gap_bytes = 0;
+  writer.captured = writer.dropped = 0;
+  writer.written = sizeof(header);
+  writer.running = true;
+  writer.thread = std::thread(&Writer::execute, &writer);
+  capture_active = true;
+  logger::info("serial_capture: recording to %s", filename.c_str());
+  return true;
+}
+
+void stop() {
+  std::scoped_lock lock(writer.control_mutex);
+  if (!writer.running) return;
+  // wait for the simulation thread to leave record_bytes before the ring and file are touched
+  capture_active = false;
+  while (writer.producer_busy) std::this_thread::yield();
+  writer.running = false;
+  writer.wake.notify_one();
+  writer.thread.join();
+  writer.flush();
+  fclose(writer.file);
+  writer.file = nullptr;
+  logger::info("serial_capture: stopped, %llu bytes captured, %llu dropped", (unsigned long long)writer.captured.load(), (unsigned long long)writer.dropped.load());
+}
+
+Statistics statistics() {
+  return { writer.captured.load(), writer.dropped.load(), writer.written.load() };
+}
+
+void record_bytes(uint8_t port, Direction direction, uint64_t tick, const uint8_t* data, std::size_t length) {
+  writer.producer_busy = true;
+  if (capture_active) append(port, direction, tick, data, length);
+  writer.producer_busy = false;
+}
+
+}
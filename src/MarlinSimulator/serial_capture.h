@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <string>
+
+/**
+ * Capture of the bytes crossing the simulated serial ports, timestamped in simulation ticks.
+ *
+ * File layout (all integers little endian):
+ *   header  : "MSIMCAP\0", u16 version, u16 reserved, u32 tick frequency (Hz)
+ *   chunk*  : u32 payload length, payload of whole records
+ *   record  : u8 flags, varint tick delta from the previous record, then
+ *               data record (flags & GAP == 0): varint length, bytes
+ *               gap record  (flags & GAP)     : varint number of bytes lost
+ *   flags   : bits 0-1 port, bit 2 direction (0 host -> firmware, 1 firmware -> host), bit 7 gap
+ *
+ * record() only encodes into a preallocated ring, the file is written by a background thread.
+ * When the ring is full the bytes are dropped and a gap record is written in their place.
+ * The offline converter lives in tools/serial_capture_convert.cpp.
+ */
+namespace serial_capture {
+
+constexpr char magic[8] = {'M', 'S', 'I', 'M', 'C', 'A', 'P', '\0'};
+constexpr uint16_t version = 1;
+constexpr std::size_t header_size = 16;
+
+enum Direction : uint8_t {
+  HOST_TO_FIRMWARE = 0,
+  FIRMWARE_TO_HOST = 1
+};
+
+enum Flags : uint8_t {
+  PORT_MASK = 0x03,
+  DIRECTION = 0x04,
+  GAP       = 0x80
+};
+
+inline std::size_t encode_varint(uint64_t value, uint8_t* output) {
+  std::size_t length = 0;
+  while (value >= 0x80) {
+    output[length++] = uint8_t(value) | 0x80;
+    value >>= 7;
+  }
+  output[length++] = uint8_t(value);
+  return length;
+}
+
+inline bool decode_varint(const uint8_t*& input, const uint8_t* end, uint64_t& value) {
+  value = 0;
+  for (uint32_t shift = 0; input < end && shift < 64; shift += 7) {
+    uint8_t byte = *input++;
+    value |= uint64_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+struct Statistics {
+  uint64_t captured = 0;  // payload bytes recorded
+  uint64_t dropped = 0;   // payload bytes lost to a full ring
+  uint64_t written = 0;   // bytes written to the file
+};
+
+bool start(const std::string& filename, uint32_t tick_frequency);
+void stop();
+Statistics statistics();
+
+extern std::atomic_bool capture_active;
+inline bool active() { return capture_active.load(std::memory_order_relaxed); }
+
+void record_bytes(uint8_t port, Direction direction, uint64_t tick, const uint8_t* data, std::size_t length);
+
+// Hot path, only pays for an atomic load when no capture is running
+inline void record(uint8_t port, Direction direction, uint64_t tick, const uint8_t* data, std::size_t length) {
+  if (active() && length) record_bytes(port, direction, tick, data, length);
+}
+
+}
@@ -0,0 +1,419 @@
+#include "signal_decoders.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <cstdarg>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+std::size_t SignalDecoder::track_limit = 1000000;
+
+namespace {
+
+std::string format(const char* format, ...) {
+  char buffer[64];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  return buffer;
+}
+
+// Words shifted in on the sampling clock edge, MSB first, while chip select (active low) is asserted
+class SpiDecoder : public SignalDecoder {
+public:
+  enum { MOSI_IN, MISO_IN, CS_IN, SCK_IN };
+  enum { MODE_PARAM, BITS_PARAM };
+  enum { MOSI_TRACK, MISO_TRACK };
+
+  SpiDecoder() : SignalDecoder(SPI, {{"MOSI", true}, {"MISO", true}, {"CS", true}, {"SCK", false}}, {{"Mode (0-3)", 0}, {"Bits per word", 8}}, {{"MOSI", true}, {"MISO", true}}) {}
+
+  void restart() override { bits = 0; }
+
+  void edge(std::size_t input, uint64_t timestamp, uint16_t value) override {
+    if (input == CS_IN) {
+      bits = 0;
+      return;
+    }
+    if (input != SCK_IN || (connected(CS_IN) && level(CS_IN))) return;
+
+    int mode = int(parameter(MODE_PARAM)) & 3;
+    bool leading = (value != 0) != bool(mode & 2);
+    if (leading != !(mode & 1)) return;
+
+    if (bits == 0) {
+      word_start = timestamp;
+      mosi = miso = 0;
+    }
+    mosi = (mosi << 1) | (level(MOSI_IN) != 0);
+    miso = (miso << 1) | (level(MISO_IN) != 0);
+    if (++bits < std::clamp(int(parameter(BITS_PARAM)), 1, 32)) return;
+
+    if (connected(MOSI_IN)) label(MOSI_TRACK, word_start, timestamp, format("%02X", mosi));
+    if (connected(MISO_IN)) label(MISO_TRACK, word_start, timestamp, format("%02X", miso));
+    bits = 0;
+  }
+
+private:
+  int bits = 0;
+  uint32_t mosi = 0, miso = 0;
+  uint64_t word_start = 0;
+};
+
+// 8N1 frames on an idle high line, bits are sampled in the middle of their period
+class UartDecoder : public SignalDecoder {
+public:
+  enum { LINE_IN };
+  enum { BAUD_PARAM, DATA_BITS_PARAM };
+
+  UartDecoder() : SignalDecoder(UART, {{"RX/TX", false}}, {{"Baud rate", 115200}, {"Data bits", 8}}, {{"Data", true}}) {}
+
+  void restart() override { framing = false; }
+
+  void edge(std::size_t input, uint64_t timestamp, uint16_t value) override {
+    sample_until(timestamp, !value);
+    if (!framing && value == 0) {
+      framing = true;
+      frame_start = timestamp;
+      bit = 0;
+      data = 0;
+    }
+  }
+
+  void advance(uint64_t timestamp) override { sample_until(timestamp, level(LINE_IN)); }
+
+private:
+  // Samples every bit whose midpoint is before `timestamp`, the line was at `line` until then
+  void sample_until(uint64_t timestamp, bool line) {
+    double period = 1e9 / std::max(parameter(BAUD_PARAM), 1.0);
+    int data_bits = std::clamp(int(parameter(DATA_BITS_PARAM)), 5, 9);
+    while (framing) {
+      uint64_t midpoint = frame_start + uint64_t((bit + 0.5) * period);
+      if (midpoint >= timestamp) return;
+      if (bit == 0 && line) {
+        framing = false;  // glitch, not a start bit
+        return;
+      }
+      if (bit > 0 && bit <= data_bits) data |= uint32_t(line) << (bit - 1);
+      if (bit == data_bits + 1) {
+        uint64_t end = frame_start + uint64_t((data_bits + 2) * period);
+        if (!line) label(0, frame_start, end, format("%02X!", data));
+        else if (data >= 0x20 && data < 0x7F) label(0, frame_start, end, format("'%c'", char(data)));
+        else label(0, frame_start, end, format("%02X", data));
+        framing = false;
+        return;
+      }
+      bit++;
+    }
+  }
+
+  bool framing = false;
+  int bit = 0;
+  uint32_t data = 0;
+  uint64_t frame_start = 0;
+};
+
+// Instantaneous step rate and axis velocity from the interval between step pulses
+class StepDirDecoder : public SignalDecoder {
+public:
+  enum { DIR_IN, STEP_IN };
+  enum { STEPS_PER_MM_PARAM, INVERT_DIR_PARAM, IDLE_TIMEOUT_PARAM };
+  enum { RATE_TRACK, VELOCITY_TRACK };
+
+  StepDirDecoder() : SignalDecoder(STEP_DIR, {{"DIR", true}, {"STEP", false}}, {{"Steps per mm", 80}, {"Invert DIR", 0}, {"Idle timeout (ms)", 50}}, {{"Step rate (steps/s)", false}, {"Velocity (mm/s)", false}}) {}
+
+  void restart() override { last_step = 0; }
+
+  void edge(std::size_t input, uint64_t timestamp, uint16_t value) override {
+    if (input != STEP_IN || !value) return;
+    advance(timestamp);
+    if (last_step) {
+      double rate = 1e9 / std::max<uint64_t>(timestamp - last_step, 1);
+      bool forward = !connected(DIR_IN) || (level(DIR_IN) != 0) != (parameter(INVERT_DIR_PARAM) != 0);
+      sample(RATE_TRACK, timestamp, rate);
+      sample(VELOCITY_TRACK, timestamp, (forward ? rate : -rate) / std::max(parameter(STEPS_PER_MM_PARAM), 1e-6));
+    }
+    last_step = timestamp;
+  }
+
+  // Once stepping stops the rate falls to zero, the next step starts a new move
+  void advance(uint64_t timestamp) override {
+    uint64_t timeout = uint64_t(std::max(parameter(IDLE_TIMEOUT_PARAM), 0.001) * 1e6);
+    if (last_step == 0 || timestamp - last_step <= timeout) return;
+    sample(RATE_TRACK, last_step + timeout, 0);
+    sample(VELOCITY_TRACK, last_step + timeout, 0);
+    last_step = 0;
+  }
+
+private:
+  uint64_t last_step = 0;
+};
+
+// Duty cycle and frequency per period, hardware PWM channels decode through the edges they synthesise
+class PwmDecoder : public SignalDecoder {
+public:
+  enum { PWM_IN };
+  enum { IDLE_TIMEOUT_PARAM };
+  enum { DUTY_TRACK, FREQUENCY_TRACK };
+
+  PwmDecoder() : SignalDecoder(PWM, {{"PWM", false}}, {{"Idle timeout (ms)", 100}}, {{"Duty (%)", false}, {"Frequency (Hz)", false}}) {}
+
+  void restart() override { last_rise = last_fall = last_edge = 0; }
+
+  void edge(std::size_t input, uint64_t timestamp, uint16_t value) override {
+    advance(timestamp);
+    if (value) {
+      if (last_rise && last_fall > last_rise) {
+        uint64_t period = timestamp - last_rise;
+        sample(DUTY_TRACK, timestamp, (last_fall - last_rise) * 100.0 / period);
+        sample(FREQUENCY_TRACK, timestamp, 1e9 / period);
+      }
+      last_rise = timestamp;
+    } else {
+      last_fall = timestamp;
+    }
+    last_edge = timestamp;
+  }
+
+  // A pin left at one level is at 0 or 100% duty
+  void advance(uint64_t timestamp) override {
+    uint64_t timeout = uint64_t(std::max(parameter(IDLE_TIMEOUT_PARAM), 0.001) * 1e6);
+    if (last_edge == 0 || timestamp - last_edge <= timeout) return;
+    if (level(PWM_IN) <= 1) {
+      sample(DUTY_TRACK, last_edge + timeout, level(PWM_IN) ? 100 : 0);
+      sample(FREQUENCY_TRACK, last_edge + timeout, 0);
+    }
+    last_rise = last_fall = last_edge = 0;
+  }
+
+private:
+  uint64_t last_rise = 0, last_fall = 0, last_edge = 0;
+};
+
+// WS2812 pulse width coding, a long high pulse is a 1, a low period over the reset time latches the chain
+class Ws2812Decoder : public SignalDecoder {
+public:
+  enum { DIN_IN };
+  enum { THRESHOLD_PARAM, RESET_TIME_PARAM, BITS_PER_LED_PARAM };
+
+  Ws2812Decoder() : SignalDecoder(WS2812, {{"DIN", false}}, {{"1 bit above (ns)", 625}, {"Reset (us)", 50}, {"Bits per LED", 24}}, {{"LEDs", true}}) {}
+
+  void restart() override {
+    bits = 0;
+    led = 0;
+    last_rise = last_fall = 0;
+  }
+
+  void edge(std::size_t input, uint64_t timestamp, uint16_t value) override {
+    if (value) {
+      if (last_fall && timestamp - last_fall > uint64_t(parameter(RESET_TIME_PARAM) * 1000)) {
+        label(0, last_fall, timestamp, "reset");
+        bits = 0;
+        led = 0;
+      }
+      last_rise = timestamp;
+      return;
+    }
+    last_fall = timestamp;
+    if (!last_rise) return;
+    if (bits == 0) {
+      word_start = last_rise;
+      word = 0;
+    }
+    word = (word << 1) | (timestamp - last_rise > uint64_t(parameter(THRESHOLD_PARAM)));
+    int bits_per_led = parameter(BITS_PER_LED_PARAM) > 24 ? 32 : 24;
+    if (++bits < bits_per_led) return;
+
+    // transmitted as GRB(W)
+    uint32_t grb = bits_per_led == 32 ? word >> 8 : word;
+    uint8_t green = grb >> 16, red = grb >> 8, blue = grb;
+    if (bits_per_led == 32) label(0, word_start, timestamp, format("%u:#%02X%02X%02X W%02X", led, red, green, blue, uint8_t(word)));
+    else label(0, word_start, timestamp, format("%u:#%02X%02X%02X", led, red, green, blue));
+    led++;
+    bits = 0;
+  }
+
+private:
+  int bits = 0;
+  unsigned led = 0;
+  uint32_t word = 0;
+  uint64_t word_start = 0, last_rise = 0, last_fall = 0;
+};
+
+}
+
+const char* SignalDecoder::type_name(Type type) {
+  static const char* names[TYPE_COUNT] = {"SPI", "UART", "Step/Dir", "PWM", "WS2812"};
+  return type < TYPE_COUNT ? names[type] : "";
+}
+
+std::unique_ptr<SignalDecoder> SignalDecoder::create(Type type) {
+  switch (type) {
+    case SPI: return std::make_unique<SpiDecoder>();
+    case UART: return std::make_unique<UartDecoder>();
+    case STEP_DIR: return std::make_unique<StepDirDecoder>();
+    case PWM: return std::make_unique<PwmDecoder>();
+    case WS2812: return std::make_unique<Ws2812Decoder>();
+    default: return nullptr;
+  }
+}
+
+bool SignalDecoder::ready() const {
+  return std::all_of(inputs.begin(), inputs.end(), [](auto& input){ return input.optional || input.pin >= 0; });
+}
+
+void SignalDecoder::reset() {
+  horizon = 0;
+  levels.clear();
+  primed.clear();
+  for (auto& track : tracks) {
+    track.labels.clear();
+    track.samples.clear();
+  }
+  restart();
+}
+
+void SignalDecoder::update(uint64_t now, std::size_t budget) {
+  if (!ready()) return;
+  // the logs were reset, or evicted before they were decoded
+  for (auto& input : inputs) {
+    if (horizon && input.pin >= 0 && Gpio::trace(input.pin).first_timestamp() > horizon) {
+      reset();
+      break;
+    }
+  }
+  if (levels.size() != inputs.size()) {
+    levels.assign(inputs.size(), 0);
+    primed.assign(inputs.size(), false);
+  }
+
+  // merge the inputs, each trace is already in time order and there are only a few of them
+  std::vector<PinTrace::Cursor> cursors(inputs.size());
+  std::vector<pin_log_data> heads(inputs.size());
+  std::vector<bool> pending(inputs.size(), false);
+  for (std::size_t i = 0; i < inputs.size(); i++) {
+    if (inputs[i].pin < 0) continue;
+    cursors[i] = Gpio::trace(inputs[i].pin).cursor(horizon, now);
+    pending[i] = cursors[i].next(heads[i]) && heads[i].timestamp < now;
+  }
+
+  std::size_t consumed = 0;
+  uint64_t last_timestamp = horizon, resume = now;
+  for (;;) {
+    std::size_t input = inputs.size();
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+      if (pending[i] && (input == inputs.size() || heads[i].timestamp < heads[input].timestamp)) input = i;
+    }
+    if (input == inputs.size()) break;
+    auto event = heads[input];
+    // never split events sharing a timestamp between calls
+    if (consumed >= budget && event.timestamp != last_timestamp) {
+      resume = event.timestamp;
+      break;
+    }
+    pending[input] = cursors[input].next(heads[input]) && heads[input].timestamp < now;
+    last_timestamp = event.timestamp;
+
+    // the cursor starts on the level each pin had at the horizon
+    if (event.timestamp < horizon || !primed[input]) {
+      levels[input] = event.value;
+      primed[input] = true;
+      continue;
+    }
+    consumed++;
+    if (event.value == levels[input]) continue;
+    levels[input] = event.value;
+    edge(input, event.timestamp, event.value);
+  }
+  horizon = resume;
+  advance(horizon);
+}
+
+void SignalDecoder::label(std::size_t track, uint64_t start, uint64_t end, std::string text) {
+  auto& labels = tracks[track].labels;
+  labels.push_back({start, end, std::move(text)});
+  if (labels.size() > track_limit) labels.pop_front();
+}
+
+void SignalDecoder::sample(std::size_t track, uint64_t timestamp, double value) {
+  auto& samples = tracks[track].samples;
+  samples.push_back({timestamp, value});
+  if (samples.size() > track_limit) samples.pop_front();
+}
+
+// When there are more entries in view than pixels only the first entry starting in each pixel column
+// is drawn, found by binary search, so the cost follows the plot width rather than the entry count
+void SignalDecoder::query(std::size_t index, uint64_t start, uint64_t end, std::size_t pixels, double offset, double height, std::vector<Point>& points, std::vector<Text>& texts) const {
+  points.clear();
+  texts.clear();
+  auto& track = tracks[index];
+  pixels = std::max<std::size_t>(pixels, 1);
+  uint64_t per_pixel = std::max<uint64_t>((end - std::min(end, start)) / pixels, 1);
+
+  auto visit = [&](auto& entries, auto timestamp, auto&& draw) {
+    auto first = std::lower_bound(entries.begin(), entries.end(), start, [&](auto& entry, uint64_t value){ return timestamp(entry) < value; });
+    // labels overlapping the start of the view, samples holding their value into it
+    if (first != entries.begin()) --first;
+    auto last = std::upper_bound(first, entries.end(), end, [&](uint64_t value, auto& entry){ return value < timestamp(entry); });
+    if (std::size_t(std::distance(first, last)) <= pixels * 2) {
+      for (auto entry = first; entry != last; ++entry) draw(*entry);
+      return;
+    }
+    for (auto entry = first; entry != last;) {
+      draw(*entry);
+      uint64_t column = (std::max(timestamp(*entry), start) - start) / per_pixel + 1;
+      entry = std::lower_bound(std::next(entry), last, start + column * per_pixel, [&](auto& entry, uint64_t value){ return timestamp(entry) < value; });
+    }
+  };
+
+  if (track.labelled) {
+    // bus style, a raised segment per label
+    double low = offset + height * 0.2, high = offset + height * 0.8;
+    bool room = true;
+    points.push_back({double(start), low});
+    visit(track.labels, [](const Label& label){ return label.start; }, [&](const Label& label) {
+      points.push_back({double(label.start), low});
+      points.push_back({double(label.start), high});
+      points.push_back({double(label.end), high});
+      points.push_back({double(label.end), low});
+      // roughly 7 pixels per character
+      room = room && (label.end - label.start) / per_pixel + 4 >= label.text.size() * 7;
+      if (room) texts.push_back({double(label.start + label.end) / 2, label.text.c_str()});
+    });
+    points.push_back({double(end), low});
+    if (!room) texts.clear();
+    return;
+  }
+
+  double maximum = 0;
+  visit(track.samples, [](const Sample& sample){ return sample.timestamp; }, [&](const Sample& sample) {
+    if (points.size()) points.push_back({std::max(double(sample.timestamp), double(start)), points.back().y});
+    points.push_back({std::max(double(sample.timestamp), double(start)), sample.value});
+    maximum = std::max(maximum, std::fabs(sample.value));
+  });
+  if (points.empty()) return;
+  points.push_back({double(end), points.back().y});
+
+  // signed values are centred in the lane
+  bool is_signed = std::any_of(points.begin(), points.end(), [](auto& point){ return point.y < 0; });
+  double scale = maximum > 0 ? height * (is_signed ? 0.45 : 0.9) / maximum : 0;
+  double base = offset + (is_signed ? height * 0.5 : height * 0.05);
+  for (auto& point : points) point.y = base + point.y * scale;
+}
+
+bool SignalDecoder::export_csv(const std::string& filename) const {
+  FILE* file = fopen(filename.c_str(), "w");
+  if (file == nullptr) {
+    logger::error("SignalDecoder: unable to open %s", filename.c_str());
+    return false;
+  }
+  fprintf(file, "track,start_ns,end_ns,value\n");
+  for (auto& track : tracks) {
+    for (auto& label : track.labels) fprintf(file, "\"%s\",%llu,%llu,\"%s\"\n", track.name.c_str(), (unsigned long long)label.start, (unsigned long long)label.end, label.text.c_str());
+    for (auto& sample : track.samples) fprintf(file, "\"%s\",%llu,,%.9g\n", track.name.c_str(), (unsigned long long)sample.timestamp, sample.value);
+  }
+  fclose(file);
+  logger::info("SignalDecoder: exported %s decoder to %s", type_name(type), filename.c_str());
+  return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hardware/Gpio.h"
+
+/**
+ * Streaming protocol decoders over the pin traces.
+ *
+ * A decoder reads the traces of its input pins merged in time order and turns them into tracks, either
+ * timed labels (SPI and UART words, WS2812 colours) or sampled values (step rate, PWM duty). Like the
+ * SignalPyramid, update() consumes only the events appended since the previous call, so decoding costs
+ * O(new events) and the history is never rescanned. Events sharing a timestamp are delivered in input
+ * order, decoders list their data inputs before their clocks. Tracks keep at most `track_limit` entries,
+ * the oldest are dropped. The UI thread owns the decoders.
+ */
+class SignalDecoder {
+public:
+  enum Type { SPI, UART, STEP_DIR, PWM, WS2812, TYPE_COUNT };
+
+  struct Input {
+    const char* role;
+    bool optional;
+    pin_type pin = -1;  // -1 while unassigned
+  };
+
+  struct Parameter {
+    const char* name;
+    double value;
+  };
+
+  struct Label {
+    uint64_t start, end;
+    std::string text;
+  };
+
+  struct Sample {
+    uint64_t timestamp;
+    double value;
+  };
+
+  struct Track {
+    std::string name;
+    bool labelled;  // labels, otherwise samples
+    std::deque<Label> labels;
+    std::deque<Sample> samples;
+  };
+
+  struct Point {
+    double x, y;
+  };
+
+  struct Text {
+    double x;
+    const char* text;
+  };
+
+  static const char* type_name(Type type);
+  static std::unique_ptr<SignalDecoder> create(Type type);
+
+  virtual ~SignalDecoder() = default;
+
+  bool ready() const;
+  // Consume new events, at most `budget` per call so a long history is decoded over several frames
+  void update(uint64_t now, std::size_t budget = 1000000);
+  bool complete(uint64_t now) const { return horizon >= now; }
+  // Start over from the oldest logged event, after changing inputs or parameters
+  void reset();
+
+  // Plot shape of `track` covering [start, end] for a plot `pixels` wide, between offset and offset + height.
+  // Values are scaled to the largest one in view, label texts are only returned when there is room to draw them.
+  void query(std::size_t track, uint64_t start, uint64_t end, std::size_t pixels, double offset, double height, std::vector<Point>& points, std::vector<Text>& texts) const;
+  bool export_csv(const std::string& filename) const;
+
+  const Type type;
+  std::vector<Input> inputs;
+  std::vector<Parameter> parameters;
+  std::vector<Track> tracks;
+
+  static std::size_t track_limit;
+
+protected:
+  SignalDecoder(Type type, std::vector<Input> inputs, std::vector<Parameter> parameters, std::vector<Track> tracks)
+    : type(type), inputs(std::move(inputs)), parameters(std::move(parameters)), tracks(std::move(tracks)) {}
+
+  // Forget any partially decoded word
+  virtual void restart() = 0;
+  // `input` changed to `value`, level() already returns the new value
+  virtual void edge(std::size_t input, uint64_t timestamp, uint16_t value) = 0;
+  // No input changes before `timestamp`, for decoders that act on the passing of time
+  virtual void advance(uint64_t timestamp) {}
+
+  bool connected(std::size_t input) const { return inputs[input].pin >= 0; }
+  uint16_t level(std::size_t input) const { return levels[input]; }
+  double parameter(std::size_t index) const { return parameters[index].value; }
+  void label(std::size_t track, uint64_t start, uint64_t end, std::string text);
+  void sample(std::size_t track, uint64_t timestamp, double value);
+
+private:
+  uint64_t horizon = 0;  // events before this have been decoded
+  std::vector<uint16_t> levels;
+  std::vector<bool> primed;  // the first event of an input only sets its level
+};
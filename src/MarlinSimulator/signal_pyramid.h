@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include "hardware/pin_trace.h"
+
+/**
+ * Multi resolution min/max summary of a pin trace for plotting.
+ *
+ * Level n groups events into buckets of base_width * 4^n nanoseconds, only buckets that saw an event
+ * are stored. update() consumes the events appended to the trace since the last call, so keeping the
+ * summary current costs O(new events). query() picks the coarsest level whose buckets are no wider
+ * than a pixel, or the raw events when zoomed in past the finest level, so a plot costs O(pixels)
+ * whatever the event rate. The UI thread owns the summary.
+ *
+ * A bucket is larger than the few bytes an event costs in the trace, so a level averaging fewer than
+ * min_events_per_bucket events per bucket is given up, finer views read the trace instead. What is
+ * left is charged to the PinTrace memory budget.
+ */
+class SignalPyramid {
+public:
+  static constexpr uint64_t base_width = 65536;  // ns, finer views read the trace directly
+  static constexpr std::size_t level_count = 10;
+  static constexpr uint64_t min_events_per_bucket = 16;
+  static constexpr uint64_t rate_sample = 4096;  // events seen before a level is judged
+
+  SignalPyramid() = default;
+  SignalPyramid(const SignalPyramid&) = delete;
+  SignalPyramid& operator=(const SignalPyramid&) = delete;
+  ~SignalPyramid() { PinTrace::account(-std::ptrdiff_t(charged)); }
+
+  struct Bucket {
+    uint64_t index;
+    uint16_t min, max, close;
+  };
+
+  struct Point {
+    double x, y;
+  };
+
+  static constexpr uint64_t width(std::size_t level) { return base_width << (2 * level); }
+
+  // Consume new events, at most `budget` per call so a long history is summarised over several frames
+  void update(const PinTrace& trace, uint64_t now, std::size_t budget = 1000000) {
+    if (trace.first_timestamp() > horizon) clear();
+    pin_log_data event;
+    auto cursor = trace.cursor(horizon, now);
+    std::size_t consumed = 0;
+    bool stopped = false;
+    while (cursor.peek(event) && event.timestamp < now) {
+      // never split events sharing a timestamp between calls
+      if (consumed >= budget && event.timestamp != last.timestamp) {
+        stopped = true;
+        break;
+      }
+      cursor.next(event);
+      if (event.timestamp < horizon) continue;
+      add(event);
+      consumed++;
+    }
+    horizon = stopped ? event.timestamp : now;
+    prune(trace.first_timestamp());
+    charge();
+  }
+
+  bool complete(uint64_t now) const { return horizon >= now; }
+
+  void clear() {
+    for (auto& level : levels) level.clear();
+    horizon = 0;
+    last = {};
+    have_value = false;
+    finest = 0;
+    events_added = 0;
+    std::fill(std::begin(created), std::end(created), 0);
+    charge();
+  }
+
+  // Step plot points covering [start, end] for a plot `pixels` wide, values are scaled and offset for stacking
+  void query(const PinTrace& trace, uint64_t start, uint64_t end, std::size_t pixels, double scale, double offset, std::vector<Point>& points) const {
+    points.clear();
+    uint64_t per_pixel = (end - std::min(end, start)) / std::max<std::size_t>(pixels, 1);
+    if (per_pixel < width(finest) || levels[finest].empty()) return query_raw(trace, start, end, scale, offset, points);
+
+    std::size_t level = finest;
+    while (level + 1 < level_count && width(level + 1) <= per_pixel) level++;
+    auto& buckets = levels[level];
+    auto bucket_width = width(level);
+
+    auto first = std::lower_bound(buckets.begin(), buckets.end(), start / bucket_width, [](const Bucket& bucket, uint64_t index){ return bucket.index < index; });
+    // the level entering the window is the close of the previous bucket
+    double level_value = first != buckets.begin() ? std::prev(first)->close : first != buckets.end() ? first->min : last.value;
+    points.push_back({double(start), level_value * scale + offset});
+    for (auto bucket = first; bucket != buckets.end() && bucket->index * bucket_width <= end; ++bucket) {
+      double x = double(bucket->index * bucket_width);
+      points.push_back({x, level_value * scale + offset});
+      points.push_back({x, bucket->min * scale + offset});
+      points.push_back({x, bucket->max * scale + offset});
+      level_value = bucket->close;
+      points.push_back({x, level_value * scale + offset});
+    }
+    points.push_back({double(end), level_value * scale + offset});
+  }
+
+  std::size_t size() const {
+    std::size_t count = 0;
+    for (auto& level : levels) count += level.size();
+    return count;
+  }
+
+private:
+  void add(const pin_log_data& event) {
+    for (std::size_t level = finest; level < level_count; level++) {
+      auto index = event.timestamp / width(level);
+      auto& buckets = levels[level];
+      if (buckets.empty() || buckets.back().index != index) {
+        // include the level the bucket starts at so an edge on its first event is drawn
+        uint16_t open = have_value ? last.value : event.value;
+        buckets.push_back({index, std::min(open, event.value), std::max(open, event.value), event.value});
+        created[level]++;
+      } else {
+        auto& bucket = buckets.back();
+        bucket.min = std::min(bucket.min, event.value);
+        bucket.max = std::max(bucket.max, event.value);
+        bucket.close = event.value;
+      }
+    }
+    last = event;
+    have_value = true;
+
+    // a level too fine to be smaller than the events it summarises is given up, the next is four times wider
+    events_added++;
+    while (finest + 1 < level_count && events_added >= rate_sample && created[finest] * min_events_per_bucket > events_added) {
+      levels[finest].clear();
+      levels[finest].shrink_to_fit();
+      finest++;
+    }
+  }
+
+  void charge() {
+    std::size_t bytes = size() * sizeof(Bucket);
+    PinTrace::account(std::ptrdiff_t(bytes) - std::ptrdiff_t(charged));
+    charged = bytes;
+  }
+
+  void prune(uint64_t first_timestamp) {
+    for (std::size_t level = 0; level < level_count; level++) {
+      auto& buckets = levels[level];
+      while (buckets.size() > 1 && (buckets[1].index * width(level)) <= first_timestamp) buckets.pop_front();
+    }
+  }
+
+  void query_raw(const PinTrace& trace, uint64_t start, uint64_t end, double scale, double offset, std::vector<Point>& points) const {
+    pin_log_data event, previous {};
+    bool have_previous = false;
+    for (auto cursor = trace.cursor(start, end); cursor.next(event) && event.timestamp <= end;) {
+      if (have_previous) points.push_back({double(std::max(event.timestamp, start)), previous.value * scale + offset});
+      else points.push_back({double(start), event.value * scale + offset});
+      points.push_back({double(std::max(event.timestamp, start)), event.value * scale + offset});
+      previous = event;
+      have_previous = true;
+    }
+    if (have_previous) points.push_back({double(end), previous.value * scale + offset});
+  }
+
+  std::deque<Bucket> levels[level_count];
+  std::size_t finest = 0;         // finer levels have been given up
+  uint64_t events_added = 0, created[level_count] = {};
+  std::size_t charged = 0;        // bytes accounted to the trace budget
+  uint64_t horizon = 0;  // events before this have been summarised
+  pin_log_data last {};
+  bool have_value = false;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <type_traits>
+
+/**
+ * Single producer single consumer queue, wait free on both sides.
+ * The producer fills the slot returned by acquire() in place and then commit()s it,
+ * the consumer reads front() and pop()s, so no element is copied through the queue.
+ */
+template<typename T, std::size_t S> class SpscQueue {
+public:
+  static_assert(S > 1 && ((S & (S - 1)) == 0), "SpscQueue<T, S>: Implementation Requires S is a power of 2");
+
+  // Producer side, returns nullptr when full
+  T* acquire() {
+    auto write = index_write.load(std::memory_order_relaxed);
+    if (write - index_read.load(std::memory_order_acquire) == S) return nullptr;
+    return &buffer[write & (S - 1)];
+  }
+
+  void commit() {
+    index_write.store(index_write.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  bool push(const T& value) {
+    auto slot = acquire();
+    if (slot == nullptr) return false;
+    *slot = value;
+    commit();
+    return true;
+  }
+
+  // Consumer side, returns nullptr when empty
+  T* front() {
+    auto read = index_read.load(std::memory_order_relaxed);
+    if (read == index_write.load(std::memory_order_acquire)) return nullptr;
+    return &buffer[read & (S - 1)];
+  }
+
+  void pop() {
+    index_read.store(index_read.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  std::size_t size() const {
+    return index_write.load(std::memory_order_acquire) - index_read.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+  static constexpr std::size_t capacity() { return S; }
+
+private:
+  alignas(64) std::atomic<std::size_t> index_write {0};
+  alignas(64) std::atomic<std::size_t> index_read {0};
+  T buffer[S] {};
+};
@@ -0,0 +1,218 @@
+#include "trigger_capture.h"
+#include "hardware/Gpio.h"
+#include "logger.h"
+
+#include <algorithm>
+#include <regex>
+
+std::mutex TriggerCapture::config_mutex;
+TriggerCapture::Settings TriggerCapture::shared_settings;
+std::vector<TriggerCapture::Trigger> TriggerCapture::shared_triggers;
+std::deque<std::shared_ptr<const TriggerCapture::Snapshot>> TriggerCapture::frozen;
+std::atomic<uint32_t> TriggerCapture::generation {0};
+std::atomic_bool TriggerCapture::armed {false}, TriggerCapture::post_trigger {false};
+
+uint32_t TriggerCapture::loaded_generation = 0;
+TriggerCapture::Settings TriggerCapture::active_settings;
+std::vector<TriggerCapture::Trigger> TriggerCapture::active_triggers;
+std::vector<TriggerCapture::Event> TriggerCapture::ring;
+std::size_t TriggerCapture::ring_head = 0, TriggerCapture::ring_count = 0;
+uint64_t TriggerCapture::last_change[256] = {};
+std::size_t TriggerCapture::fired_trigger = 0;
+uint64_t TriggerCapture::trigger_time = 0;
+std::string TriggerCapture::serial_line[4][2];
+
+namespace {
+// compiled SERIAL_MATCH expressions, by trigger index
+std::vector<std::regex> expressions;
+}
+
+std::string TriggerCapture::Trigger::describe() const {
+  static const char* edge_names[] = {"rising", "falling", "any"};
+  char text[128];
+  switch (kind) {
+    case EDGE:
+      snprintf(text, sizeof(text), "%s edge on pin %d", edge_names[edge], pin);
+      return text;
+    case PATTERN: {
+      std::string result = "pattern";
+      for (auto& [pattern_pin, pattern_level] : pattern) result += " " + std::to_string(pattern_pin) + "=" + std::to_string(pattern_level);
+      return result;
+    }
+    case PULSE_WIDTH:
+      snprintf(text, sizeof(text), "%s pulse on pin %d outside %llu-%llu ns", level ? "high" : "low", pin, (unsigned long long)min_width, (unsigned long long)max_width);
+      return text;
+    case SERIAL_MATCH:
+      return "serial line matching /" + expression + "/";
+    case ISR_TIMING:
+      snprintf(text, sizeof(text), "isr timing error over %llu ns", (unsigned long long)threshold);
+      return text;
+    default:
+      return "";
+  }
+}
+
+void TriggerCapture::configure(const Settings& settings, const std::vector<Trigger>& triggers) {
+  std::scoped_lock lock(config_mutex);
+  shared_settings = settings;
+  shared_settings.ring_size = std::max<std::size_t>(settings.ring_size, 1);
+  shared_triggers = triggers;
+  armed = std::any_of(triggers.begin(), triggers.end(), [](auto& trigger){ return trigger.armed; });
+  generation++;
+}
+
+TriggerCapture::Settings TriggerCapture::settings() {
+  std::scoped_lock lock(config_mutex);
+  return shared_settings;
+}
+
+std::vector<TriggerCapture::Trigger> TriggerCapture::triggers() {
+  std::scoped_lock lock(config_mutex);
+  return shared_triggers;
+}
+
+std::vector<std::shared_ptr<const TriggerCapture::Snapshot>> TriggerCapture::snapshots() {
+  std::scoped_lock lock(config_mutex);
+  return {frozen.begin(), frozen.end()};
+}
+
+void TriggerCapture::clear_snapshots() {
+  std::scoped_lock lock(config_mutex);
+  frozen.clear();
+}
+
+// Takes over the configuration published by configure(), any capture in progress is abandoned
+void TriggerCapture::reload() {
+  std::scoped_lock lock(config_mutex);
+  loaded_generation = generation;
+  active_settings = shared_settings;
+  active_triggers = shared_triggers;
+  expressions.assign(active_triggers.size(), {});
+  for (std::size_t i = 0; i < active_triggers.size(); i++) {
+    if (active_triggers[i].kind != Trigger::SERIAL_MATCH) continue;
+    try {
+      expressions[i] = std::regex(active_triggers[i].expression);
+    } catch (const std::regex_error& e) {
+      logger::error("TriggerCapture: invalid expression '%s': %s", active_triggers[i].expression.c_str(), e.what());
+      active_triggers[i].armed = false;
+    }
+  }
+  // the ring is restarted so it never holds a gap from while nothing was armed
+  if (ring.size() != active_settings.ring_size) {
+    ring.assign(active_settings.ring_size, {});
+    ring.shrink_to_fit();
+  }
+  ring_head = ring_count = 0;
+  std::fill(std::begin(last_change), std::end(last_change), 0);
+  post_trigger = false;
+}
+
+void TriggerCapture::record(int16_t pin, uint64_t timestamp, uint16_t value, uint16_t previous) {
+  if (generation != loaded_generation) reload();
+  if (pin < 0 || pin >= int16_t(std::size(last_change))) return;
+
+  ring[ring_head] = {timestamp, pin, value, previous};
+  ring_head = (ring_head + 1) % ring.size();
+  ring_count = std::min(ring_count + 1, ring.size());
+  uint64_t since = last_change[pin];
+  last_change[pin] = timestamp;
+  if (capturing()) return;
+
+  auto is_high = [](uint16_t level){ return level != 0; };
+  for (std::size_t i = 0; i < active_triggers.size(); i++) {
+    auto& trigger = active_triggers[i];
+    if (!trigger.armed) continue;
+    bool fires = false;
+    switch (trigger.kind) {
+      case Trigger::EDGE:
+        fires = trigger.pin == pin && (trigger.edge == Trigger::ANY_EDGE || (trigger.edge == Trigger::RISING_EDGE ? value > previous : value < previous));
+        break;
+      case Trigger::PATTERN:
+        fires = std::any_of(trigger.pattern.begin(), trigger.pattern.end(), [pin](auto& entry){ return entry.first == pin; })
+             && std::all_of(trigger.pattern.begin(), trigger.pattern.end(), [&](auto& entry){ return is_high(Gpio::get_pin_value(entry.first)) == is_high(entry.second); });
+        break;
+      case Trigger::PULSE_WIDTH:
+        // the pulse ends when the pin leaves `level`, its width is the time since the pin entered it
+        fires = trigger.pin == pin && since && is_high(previous) == is_high(trigger.level) && (timestamp - since < trigger.min_width || timestamp - since > trigger.max_width);
+        break;
+      default:
+        break;
+    }
+    if (fires) return fire(i, timestamp);
+  }
+}
+
+void TriggerCapture::match_serial(uint8_t port, bool from_firmware, uint64_t timestamp, const uint8_t* data, std::size_t length) {
+  if (generation != loaded_generation) reload();
+  auto& line = serial_line[port & 3][from_firmware];
+  for (std::size_t i = 0; i < length; i++) {
+    if (data[i] != '\n' && data[i] != '\r') {
+      if (line.size() < 256) line.push_back(char(data[i]));
+      continue;
+    }
+    if (line.empty()) continue;
+    for (std::size_t t = 0; t < active_triggers.size() && !capturing(); t++) {
+      auto& trigger = active_triggers[t];
+      if (trigger.armed && trigger.kind == Trigger::SERIAL_MATCH && std::regex_search(line, expressions[t])) fire(t, timestamp);
+    }
+    line.clear();
+  }
+}
+
+void TriggerCapture::check_timing(uint64_t timestamp, uint64_t timing_error) {
+  if (generation != loaded_generation) reload();
+  for (std::size_t i = 0; i < active_triggers.size() && !capturing(); i++) {
+    auto& trigger = active_triggers[i];
+    if (trigger.armed && trigger.kind == Trigger::ISR_TIMING && timing_error > trigger.threshold) fire(i, timestamp);
+  }
+}
+
+void TriggerCapture::fire(std::size_t trigger, uint64_t timestamp) {
+  fired_trigger = trigger;
+  trigger_time = timestamp;
+  active_triggers[trigger].fired++;
+  post_trigger = true;
+  logger::info("TriggerCapture: %s at %llu ns", active_triggers[trigger].describe().c_str(), (unsigned long long)timestamp);
+  finish(timestamp);
+}
+
+void TriggerCapture::finish(uint64_t timestamp) {
+  if (generation != loaded_generation) {
+    reload();
+    return;
+  }
+  if (timestamp < trigger_time + active_settings.post_window) return;
+
+  auto snapshot = std::make_shared<Snapshot>();
+  auto& trigger = active_triggers[fired_trigger];
+  snapshot->trigger = trigger.describe();
+  snapshot->trigger_time = trigger_time;
+  snapshot->start = trigger_time - std::min(trigger_time, active_settings.pre_window);
+  snapshot->end = trigger_time + active_settings.post_window;
+
+  std::size_t oldest = (ring_head + ring.size() - ring_count) % ring.size();
+  snapshot->truncated = ring_count == ring.size() && ring[oldest].timestamp > snapshot->start;
+  for (std::size_t i = 0; i < ring_count; i++) {
+    auto& event = ring[(oldest + i) % ring.size()];
+    if (event.timestamp >= snapshot->start && event.timestamp <= snapshot->end) snapshot->events.push_back(event);
+  }
+
+  if (!trigger.rearm) trigger.armed = false;
+  post_trigger = false;
+  publish();
+
+  std::scoped_lock lock(config_mutex);
+  frozen.push_back(std::move(snapshot));
+  while (frozen.size() > std::max<std::size_t>(active_settings.max_snapshots, 1)) frozen.pop_front();
+}
+
+// Hands the armed state and fire counts back for the UI, unless it has replaced the configuration meanwhile
+void TriggerCapture::publish() {
+  std::scoped_lock lock(config_mutex);
+  if (generation != loaded_generation || shared_triggers.size() != active_triggers.size()) return;
+  for (std::size_t i = 0; i < active_triggers.size(); i++) {
+    shared_triggers[i].armed = active_triggers[i].armed;
+    shared_triggers[i].fired = active_triggers[i].fired;
+  }
+  armed = std::any_of(active_triggers.begin(), active_triggers.end(), [](auto& trigger){ return trigger.armed; });
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Logic analyser style triggered capture of pin value changes.
+ *
+ * While a trigger is armed every pin change is written into a fixed size ring, so only the recent history
+ * is held however long the run. When a trigger fires capture carries on for the post-trigger window, then
+ * the changes from pre_window before the trigger to post_window after it are frozen into a snapshot. The
+ * newest max_snapshots are kept. A trigger with rearm set is armed again once its snapshot is frozen.
+ *
+ *   EDGE         a rising, falling or any edge on a pin
+ *   PATTERN      every listed pin at its level, checked when one of them changes
+ *   PULSE_WIDTH  a pulse at `level` shorter than min_width or longer than max_width
+ *   SERIAL_MATCH a line on any serial port, in either direction, matching a regular expression
+ *   ISR_TIMING   Kernel::isr_timing_error above threshold
+ *
+ * The hooks are called from the simulation thread. Callers check active() (capturing() for poll()) before
+ * working out a timestamp, so nothing armed costs an atomic load per hook.
+ * configure() and the accessors may be called from any thread, the simulation thread picks up a new
+ * configuration on its next hook.
+ */
+class TriggerCapture {
+public:
+  struct Event {
+    uint64_t timestamp;
+    int16_t pin;
+    uint16_t value, previous;
+  };
+
+  struct Trigger {
+    enum Kind : uint8_t { EDGE, PATTERN, PULSE_WIDTH, SERIAL_MATCH, ISR_TIMING, KIND_COUNT };
+    enum Edge : uint8_t { RISING_EDGE, FALLING_EDGE, ANY_EDGE };
+    static constexpr const char* kind_names[KIND_COUNT] = {"Edge", "Pattern", "Pulse width", "Serial regex", "ISR timing error"};
+
+    Kind kind = EDGE;
+    bool armed = true;
+    bool rearm = true;
+    int16_t pin = -1;                                   // EDGE, PULSE_WIDTH
+    Edge edge = RISING_EDGE;                            // EDGE
+    std::vector<std::pair<int16_t, uint16_t>> pattern;  // PATTERN, pin and level
+    uint16_t level = 1;                                 // PULSE_WIDTH
+    uint64_t min_width = 0, max_width = 1'000'000;      // PULSE_WIDTH, ns
+    std::string expression;                             // SERIAL_MATCH
+    uint64_t threshold = 100'000;                       // ISR_TIMING, ns
+    uint64_t fired = 0;
+
+    std::string describe() const;
+  };
+
+  struct Settings {
+    uint64_t pre_window = 10'000'000;   // ns
+    uint64_t post_window = 10'000'000;  // ns
+    std::size_t ring_size = 1 << 20;    // events
+    std::size_t max_snapshots = 16;
+  };
+
+  struct Snapshot {
+    std::string trigger;
+    uint64_t trigger_time, start, end;
+    bool truncated;  // the ring wrapped inside the pre-trigger window
+    std::vector<Event> events;
+  };
+
+  static void configure(const Settings& settings, const std::vector<Trigger>& triggers);
+  static Settings settings();
+  static std::vector<Trigger> triggers();  // with their current armed state and fire counts
+  static std::vector<std::shared_ptr<const Snapshot>> snapshots();
+  static void clear_snapshots();
+  static bool capturing() { return post_trigger.load(std::memory_order_relaxed); }
+
+  static bool active() { return armed.load(std::memory_order_relaxed); }
+
+  // Simulation thread hooks
+  static void pin_changed(int16_t pin, uint64_t timestamp, uint16_t value, uint16_t previous) {
+    if (active()) record(pin, timestamp, value, previous);
+  }
+  static void serial_bytes(uint8_t port, bool from_firmware, uint64_t timestamp, const uint8_t* data, std::size_t length) {
+    if (active()) match_serial(port, from_firmware, timestamp, data, length);
+  }
+  static void isr_timing(uint64_t timestamp, uint64_t timing_error) {
+    if (active()) check_timing(timestamp, timing_error);
+  }
+  // Freezes the snapshot once the post-trigger window has passed, called every kernel loop
+  static void poll(uint64_t timestamp) {
+    if (capturing()) finish(timestamp);
+  }
+
+private:
+  static void record(int16_t pin, uint64_t timestamp, uint16_t value, uint16_t previous);
+  static void match_serial(uint8_t port, bool from_firmware, uint64_t timestamp, const uint8_t* data, std::size_t length);
+  static void check_timing(uint64_t timestamp, uint64_t timing_error);
+  static void finish(uint64_t timestamp);
+  static void reload();
+  static void fire(std::size_t trigger, uint64_t timestamp);
+  static void publish();
+
+  // shared, guarded by config_mutex
+  static std::mutex config_mutex;
+  static Settings shared_settings;
+  static std::vector<Trigger> shared_triggers;
+  static std::deque<std::shared_ptr<const Snapshot>> frozen;
+  static std::atomic<uint32_t> generation;
+  static std::atomic_bool armed, post_trigger;
+
+  // simulation thread
+  static uint32_t loaded_generation;
+  static Settings active_settings;
+  static std::vector<Trigger> active_triggers;
+  static std::vector<Event> ring;
+  static std::size_t ring_head, ring_count;
+  static uint64_t last_change[256];
+  static std::size_t fired_trigger;
+  static uint64_t trigger_time;
+  static std::string serial_line[4][2];
+};
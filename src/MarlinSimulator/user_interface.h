@@ -7,16 +7,21 @@
 #include <string>
 #include <sstream>
 #include <algorithm>
+#include <limits>
 #include <filesystem>
 
 #include <gl.h>
 #include <imgui.h>
 #include <imgui_internal.h>
+#include <implot.h>
 #include <ImGuiFileDialog.h>
 
 #include "RingBuffer.h"
 #include "logger.h"
 #include "execution_control.h"
+#include "command_latency.h"
+#include "emergency_latency.h"
+#include "line_store.h"
 
 class UiWindow {
 public:
@@ -128,11 +133,12 @@ struct SerialMonitor : public UiWindow {
   SerialMonitor(std::string name) : UiWindow(name) {};
   char InputBuf[256] = {};
   std::string working_buffer;
-  struct line_meta {
-    std::size_t count = {};
-    std::string text = {};
-  };
-  std::deque<line_meta> line_buffer{};
+  LineStore line_buffer{};
+  LineSearch line_filter{};
+  char filter_input[256] = {};
+  bool filter_regex = false;
+  int history_limit_mb = 16;
+  static constexpr std::size_t max_line_length = 4096;
   std::deque<std::string> command_history{};
   std::size_t history_index = 0;
   std::string input_buffer = {};
@@ -150,6 +156,10 @@ struct SerialMonitor : public UiWindow {
   InOutRingBuffer<uint8_t, 32768> serial_buffer;
   std::vector<InOutRingBuffer<uint8_t, 32768>*> serial_endpoints;
 
+  // Optional taps on the traffic between this terminal and the firmware, called from the simulation thread
+  // as bytes cross the simulated serial line (receive: host -> firmware, transmit: firmware -> host)
+  std::function<void(const uint8_t*, std::size_t)> on_firmware_receive, on_firmware_transmit;
+
   void register_endpoint(InOutRingBuffer<uint8_t, 32768>* endpoint) {
     serial_endpoints.push_back(endpoint);
   }
@@ -185,18 +195,39 @@ struct SerialMonitor : public UiWindow {
     return 0;
   }
 
-  void insert_text(std::string text) {
-    working_buffer.append(text);
-    std::size_t index = working_buffer.find('\n');
+  void insert_text(std::string_view text) {
+    std::size_t index = text.find('\n');
     while (index != std::string::npos) {
-      if (line_buffer.size() == 0 || line_buffer.back().text != working_buffer.substr(0, index)) {
-        line_buffer.push_back({1, working_buffer.substr(0, index)});
-      } else line_buffer.back().count++;
-      working_buffer = working_buffer.substr(index + 1);
-      index = working_buffer.find('\n');
+      std::string_view line = text.substr(0, index);
+      if (working_buffer.size()) {
+        working_buffer.append(line);
+        line = working_buffer;
+      }
+      if (line.size() && line.back() == '\r') line.remove_suffix(1);
+      line_buffer.append(line);
+      working_buffer.clear();
+      text.remove_prefix(index + 1);
+      index = text.find('\n');
+    }
+    working_buffer.append(text);
+    if (working_buffer.size() > max_line_length) {
+      line_buffer.append(working_buffer);
+      working_buffer.clear();
     }
   }
 
+  std::string buffer_text() {
+    std::string text;
+    auto append = [this, &text](uint64_t id) {
+      for (uint32_t i = 0; i < line_buffer.line(id).count; i++) text.append(line_buffer.text(id)).push_back('\n');
+    };
+    if (line_filter.active()) {
+      for (const auto& match : line_filter.results()) append(match.id);
+    }
+    else for (auto id = line_buffer.begin_id(); id < line_buffer.end_id(); id++) append(id);
+    return text;
+  }
+
   void show() {
     // File read into serial port
     if (input_file.is_open() && serial_buffer.out.free() && streaming) {
@@ -215,13 +246,12 @@ struct SerialMonitor : public UiWindow {
     }
 
     while (serial_buffer.in.available()) {
-      static char buffer[32768 + 1];
-      auto count = serial_buffer.in.read((uint8_t*)buffer, 32768);
+      static char buffer[32768];
+      auto count = serial_buffer.in.read((uint8_t*)buffer, sizeof(buffer));
       for (auto endpoint : serial_endpoints) {
         endpoint->in.write((uint8_t*)buffer, count);
       }
-      buffer[count] = '\0';
-      insert_text(buffer);
+      insert_text({buffer, count});
     }
     for (auto endpoint : serial_endpoints) {
       endpoint->out.read(serial_buffer.out);
@@ -262,10 +292,19 @@ struct SerialMonitor : public UiWindow {
       if (ImGui::BeginMenu("Edit")) {
         if (ImGui::MenuItem("Copy Buffer")) {
           copy_buffer_signal = true;
-          ImGui::LogToClipboard();
+        }
+        if (ImGui::MenuItem("Clear")) {
+          line_buffer.clear();
         }
         ImGui::EndMenu();
       }
+      if (ImGui::BeginMenu("View")) {
+        if (ImGui::SliderInt("History (MiB)", &history_limit_mb, 1, 1024)) {
+          line_buffer.set_byte_limit(std::size_t(history_limit_mb) * 1024 * 1024);
+        }
+        ImGui::Text("%zu lines, %.1f MiB", line_buffer.size(), line_buffer.bytes() / (1024.0 * 1024.0));
+        ImGui::EndMenu();
+      }
       ImGui::EndMenuBar();
     }
 
@@ -284,31 +323,52 @@ struct SerialMonitor : public UiWindow {
     if (stream_total) {
       ImGui::ProgressBar((float)stream_sent / stream_total);
     }
+    ImGui::PushItemWidth(-140);
+    bool filter_changed = ImGui::InputTextWithHint("##SerialFilter", "Filter", filter_input, IM_ARRAYSIZE(filter_input));
+    ImGui::PopItemWidth();
+    ImGui::SameLine();
+    filter_changed |= ImGui::Checkbox("Regex", &filter_regex);
+    if (filter_changed) line_filter.set_pattern(filter_input, filter_regex);
+    line_filter.update(line_buffer);
+    if (line_filter.error.size()) {
+      ImGui::SameLine();
+      ImGui::TextColored(ImVec4{1.0f, 0.0f, 0.0f, 1.0f}, "(!)");
+      if (ImGui::IsItemHovered()) ImGui::SetTooltip("%s", line_filter.error.c_str());
+    } else if (line_filter.active() && !line_filter.complete(line_buffer)) {
+      ImGui::SameLine();
+      ImGui::TextUnformatted("...");
+    }
+
+    if (copy_buffer_signal) {
+      copy_buffer_signal = false;
+      ImGui::SetClipboardText(buffer_text().c_str());
+    }
+
     ImGui::BeginGroup();
     const ImGuiWindowFlags child_flags = 0;
     const ImGuiID child_id = ImGui::GetID((void*)(intptr_t)0);
     auto size = ImGui::GetContentRegionAvail();
     size.y -= 25; // TODO: there must be a better way to fill 2 items on a line
     if (ImGui::BeginChild(child_id, size, true, child_flags)) {
-      if (copy_buffer_signal) {
-        ImGui::LogToClipboard();
-      }
+      // Lines are hard wrapped at a fixed column count so the row count of the history is known without measuring text
+      auto width = ImGui::GetContentRegionAvail().x - ImGui::GetStyle().ScrollbarSize;
+      std::size_t columns = std::max(1.0f, width / ImGui::CalcTextSize("M").x);
+      line_buffer.set_columns(columns);
+      line_filter.set_columns(line_buffer, columns);
+
+      bool filtered = line_filter.active();
+      uint64_t rows = filtered ? line_filter.total_rows(line_buffer) : line_buffer.total_rows();
       ImGuiListClipper clipper;
-      clipper.Begin(line_buffer.size());
+      clipper.Begin(int(std::min<uint64_t>(rows, std::numeric_limits<int>::max())), ImGui::GetTextLineHeightWithSpacing());
       while(clipper.Step()) {
-        for (int line_no = clipper.DisplayStart; line_no < clipper.DisplayEnd; line_no++) {
-          if (line_buffer.at(line_no).count > 1) ImGui::TextWrapped("[%ld] %s", line_buffer.at(line_no).count, (char *)line_buffer.at(line_no).text.c_str());
-          else  ImGui::TextWrapped("%s", (char *)line_buffer.at(line_no).text.c_str());
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+          auto [id, line_row] = filtered ? line_filter.find_row(row) : line_buffer.find_row(row);
+          auto text = line_buffer.row_text(line_buffer.line(id), line_row);
+          ImGui::TextUnformatted(text.c_str(), text.c_str() + text.size());
         }
-        //ImGui::TextWrapped("%s", (char *)working_buffer.c_str());
       }
       clipper.End();
 
-      if (copy_buffer_signal) {
-        copy_buffer_signal = false;
-        ImGui::LogFinish();
-      }
-
       // Automatically set follow when scrolled to max
       if (ImGui::GetScrollY() != ImGui::GetScrollMaxY() || scroll_follow_state == 2) scroll_follow = false;
       else scroll_follow = true;
@@ -361,37 +421,152 @@ struct SerialMonitor : public UiWindow {
 
 struct SerialController : public UiWindow {
   SerialController(std::string name) : UiWindow(name) {
-    UserInterface::getElement<SerialMonitor>("Serial Monitor(0)")->register_endpoint(&serial_buffer);
+    auto monitor = UserInterface::getElement<SerialMonitor>("Serial Monitor(0)");
+    monitor->register_endpoint(&serial_buffer);
+    monitor->on_firmware_receive = [this](const uint8_t* data, std::size_t length) {
+      split_lines(command_line, data, length, [this](std::string_view line){ latency.command_sent(line, Kernel::SimulationRuntime::nanos()); });
+    };
+    monitor->on_firmware_transmit = [this](const uint8_t* data, std::size_t length) {
+      split_lines(response_line, data, length, [this](std::string_view line){ process_response(line, Kernel::SimulationRuntime::nanos()); });
+    };
   };
   InOutRingBuffer<uint8_t, 32768> serial_buffer;
 
-  void process_response(std::string_view buffer) {
-    // logger::info(buffer.data());
+  CommandLatencyTracker latency;
+  std::string command_line, response_line;
+  std::mutex report_mutex;
+  std::string last_position_report, last_temperature_report;
+  uint64_t response_count[HostResponse::ERROR + 1] = {};
+  std::string selected_code;
+
+  bool emergency_repeat = false;
+  int emergency_repeat_command = 1;
+  float emergency_repeat_interval = 2.0f;
+  uint64_t emergency_repeat_next = 0;
+  std::string selected_effect;
+
+  template <typename Callback>
+  static void split_lines(std::string& working, const uint8_t* data, std::size_t length, Callback callback) {
+    for (std::size_t i = 0; i < length; i++) {
+      if (data[i] == '\n') {
+        callback(std::string_view(working));
+        working.clear();
+      } else if (working.size() < 512) working.push_back(data[i]);
+    }
+  }
 
-    if (buffer.substr(0, 2).compare("ok") == 0) {
-      if (buffer.size() > 2) {
-        // logger::info("is advanced ok");
-      } else {
-        // logger::info("is ok");
+  void process_response(std::string_view buffer, uint64_t timestamp) {
+    auto response = HostResponse::parse(buffer);
+    latency.response_received(response, timestamp);
+
+    std::scoped_lock lock(report_mutex);
+    response_count[response.type]++;
+    if (response.type == HostResponse::POSITION) last_position_report = buffer;
+    if (response.type == HostResponse::TEMPERATURE || response.has_temperature) last_temperature_report = buffer;
+  }
+
+  void latency_panel() {
+    if (ImGui::Button("Clear##Latency")) latency.clear();
+    ImGui::SameLine();
+    if (ImGui::Button("Export CSV##Latency")) {
+      IGFD::FileDialogConfig config { "." };
+      config.flags |= ImGuiFileDialogFlags_Modal;
+      ImGuiFileDialog::Instance()->OpenDialog("LatencyExportDlgKey", "Choose File", "Comma Separated Values (*.csv){.csv},.*", config);
+    }
+    if (ImGuiFileDialog::Instance()->Display("LatencyExportDlgKey", ImGuiWindowFlags_NoDocking))  {
+      if (ImGuiFileDialog::Instance()->IsOk()) {
+        auto filename = ImGuiFileDialog::Instance()->GetFilePathName();
+        if (!latency.export_csv(filename)) logger::error("Unable to export command latency to %s", filename.c_str());
       }
+      ImGuiFileDialog::Instance()->Close();
     }
 
-    if (buffer.substr(0, 2).compare("//") == 0) {
-      // logger::info("is info for host");
+    std::vector<double> histogram;
+    std::scoped_lock lock(latency.data_mutex);
+    ImGui::Text("Outstanding: %zu  Dropped: %llu  Unmatched ok: %llu", latency.pending.size(), (unsigned long long)latency.dropped, (unsigned long long)latency.unmatched);
+    if (ImGui::BeginTable("##LatencyTable", 7, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollY, ImVec2(0, 150))) {
+      ImGui::TableSetupScrollFreeze(0, 1);
+      for (auto column : {"Code", "Count", "Mean ms", "p50 ms", "p95 ms", "Max ms", "Total s"}) ImGui::TableSetupColumn(column);
+      ImGui::TableHeadersRow();
+      for (const auto& [code, stats] : latency.statistics) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        if (ImGui::Selectable(code.c_str(), code == selected_code, ImGuiSelectableFlags_SpanAllColumns)) selected_code = code;
+        ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)stats.count);
+        ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.mean() / 1e6);
+        ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.percentile(0.5) / 1e6);
+        ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.percentile(0.95) / 1e6);
+        ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.max / 1e6);
+        ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.total / 1e9);
+      }
+      ImGui::EndTable();
     }
 
-    if (buffer.substr(0, 4).compare("echo") == 0) {
-      // logger::info("is echo");
+    auto selected = latency.statistics.find(selected_code);
+    if (selected == latency.statistics.end()) return;
+    for (const auto& sample : selected->second.samples) histogram.push_back(sample.latency / 1e6);
+    if (ImPlot::BeginPlot("##LatencyHistogram", ImVec2(-1, 150))) {
+      ImPlot::SetupAxes("ms", "count", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+      ImPlot::PlotHistogram(selected_code.c_str(), histogram.data(), histogram.size(), ImPlotBin_Sturges);
+      ImPlot::EndPlot();
     }
+  }
 
-    if (buffer.substr(0, 2).compare("X:") == 0) {
-      // logger::info("is position report");
-    }
+  void emergency_panel() {
+    // M112 halts the firmware, only M108 and M410 can be injected repeatedly
+    static const char* commands[] = {"M108\n", "M410\n"};
+    if (ImGui::Button("Inject M108")) serial_buffer.out.write((uint8_t*)"M108\n", 5);
+    ImGui::SameLine();
+    if (ImGui::Button("Inject M410")) serial_buffer.out.write((uint8_t*)"M410\n", 5);
+    ImGui::SameLine();
+    if (ImGui::Button("Inject M112")) serial_buffer.out.write((uint8_t*)"M112\n", 5);
+    if (ImGui::IsItemHovered()) ImGui::SetTooltip("Halts the firmware, the simulator must be restarted afterwards");
+    ImGui::SameLine();
+    if (ImGui::Button("Clear##Emergency")) EmergencyLatency::clear();
 
-    if (buffer.substr(0, 3).compare(" T:") == 0) {
-      // logger::info("is temp report");
+    ImGui::Checkbox("Repeat", &emergency_repeat);
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(80);
+    ImGui::Combo("##RepeatCommand", &emergency_repeat_command, "M108\0M410\0");
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(120);
+    ImGui::InputFloat("every (s)", &emergency_repeat_interval, 0.1f, 1.0f, "%.2f");
+    emergency_repeat_interval = std::max(emergency_repeat_interval, 0.01f);
+    auto now = Kernel::SimulationRuntime::nanos();
+    if (emergency_repeat && now >= emergency_repeat_next) {
+      serial_buffer.out.write((uint8_t*)commands[emergency_repeat_command], strlen(commands[emergency_repeat_command]));
+      emergency_repeat_next = now + uint64_t(emergency_repeat_interval * Kernel::TimeControl::ONE_BILLION);
+    }
+
+    ImGui::Text("Injected  M112: %llu  M108: %llu  M410: %llu", (unsigned long long)EmergencyLatency::injections(EmergencyLatency::M112),
+                (unsigned long long)EmergencyLatency::injections(EmergencyLatency::M108), (unsigned long long)EmergencyLatency::injections(EmergencyLatency::M410));
+
+    auto results = EmergencyLatency::results();
+    if (ImGui::BeginTable("##EmergencyTable", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+      for (auto column : {"Effect", "Count", "Mean ms", "p50 ms", "p95 ms", "Max ms"}) ImGui::TableSetupColumn(column);
+      ImGui::TableHeadersRow();
+      for (const auto& [effect, stats] : results) {
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        if (ImGui::Selectable(effect.c_str(), effect == selected_effect, ImGuiSelectableFlags_SpanAllColumns)) selected_effect = effect;
+        ImGui::TableNextColumn(); ImGui::Text("%llu", (unsigned long long)stats.count);
+        ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.mean() / 1e6);
+        ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.percentile(0.5) / 1e6);
+        ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.percentile(0.95) / 1e6);
+        ImGui::TableNextColumn(); ImGui::Text("%.3f", stats.max / 1e6);
+      }
+      ImGui::EndTable();
     }
 
+    auto selected = results.find(selected_effect);
+    if (selected == results.end()) return;
+    std::vector<double> histogram;
+    for (const auto& sample : selected->second.samples) histogram.push_back(sample.latency / 1e6);
+    if (ImPlot::BeginPlot("##EmergencyHistogram", ImVec2(-1, 150))) {
+      ImPlot::SetupAxes("ms", "count", ImPlotAxisFlags_AutoFit, ImPlotAxisFlags_AutoFit);
+      ImPlot::PlotHistogram(selected_effect.c_str(), histogram.data(), histogram.size(), ImPlotBin_Sturges);
+      ImPlot::EndPlot();
+    }
   }
 
   virtual void panel() override {
@@ -399,13 +574,21 @@ struct SerialController : public UiWindow {
       return serial_buffer.out.write((uint8_t*)str, strlen(str));
     };
 
-    std::size_t index = 0;
-    while (serial_buffer.in.find_next_index_of(uint8_t('\n'), index)) {
-      static char buffer[513] {};
-      serial_buffer.in.read((uint8_t*)buffer, index);
-      serial_buffer.in.drop(1);
-      buffer[index] = 0;
-      process_response(buffer);
+    // responses are processed from the simulation thread tap, the echo here is not needed
+    serial_buffer.in.drop(serial_buffer.in.available());
+
+    if (ImGui::CollapsingHeader("Responses")) {
+      std::scoped_lock lock(report_mutex);
+      ImGui::Text("ok: %llu  echo: %llu  busy: %llu  resend: %llu  error: %llu", (unsigned long long)response_count[HostResponse::OK], (unsigned long long)response_count[HostResponse::ECHO],
+                  (unsigned long long)response_count[HostResponse::BUSY], (unsigned long long)response_count[HostResponse::RESEND], (unsigned long long)response_count[HostResponse::ERROR]);
+      ImGui::TextWrapped("Position: %s", last_position_report.c_str());
+      ImGui::TextWrapped("Temperature: %s", last_temperature_report.c_str());
+    }
+    if (ImGui::CollapsingHeader("Command Latency")) {
+      latency_panel();
+    }
+    if (ImGui::CollapsingHeader("Emergency Latency")) {
+      emergency_panel();
     }
 
     if (ImGui::Button("Home All")) {
@@ -525,21 +708,25 @@ struct TextureWindow : public UiWindow {
 
 // todo: write a better one, taken from the demo just added colour
 struct LoggerWindow : public UiWindow {
-  ImGuiTextBuffer     Buf;
-  ImGuiTextFilter     Filter;
-  ImVector<int>       LineOffsets; // Index to lines offset. We maintain this with AddLog() calls.
+  // add_log is called from the logger thread, everything below is guarded by buffer_mutex
+  std::mutex          buffer_mutex;
+  LineStore           Buf{4 * 1024 * 1024};
+  LineSearch          Filter;
+  char                FilterInput[256] = {};
+  char                LogFilePath[256] = "marlin_sim.log";
+  std::size_t         log_file_sink = 0;
   bool                AutoScroll;  // Keep scrolling if already at the bottom.
 
   template<class... Args>
   LoggerWindow(std::string name, Args... args) : UiWindow(name, args...) {
     AutoScroll = true;
+    Buf.set_columns(std::numeric_limits<uint16_t>::max()); // lines are not wrapped, one row each
     clear();
   }
 
   void clear() {
+    std::scoped_lock lock(buffer_mutex);
     Buf.clear();
-    LineOffsets.clear();
-    LineOffsets.push_back(0);
   }
 
   // todo: return span information and colour only the log level indicator?
@@ -571,12 +758,13 @@ struct LoggerWindow : public UiWindow {
   }
 
   void add_log(const std::string_view value) {
-    int old_size = Buf.size();
-    Buf.append(value.cbegin(), value.cend());
-    Buf.append("\n");
-    for (int new_size = Buf.size(); old_size < new_size; old_size++) {
-      if (Buf[old_size] == '\n') LineOffsets.push_back(old_size + 1);
+    std::scoped_lock lock(buffer_mutex);
+    std::size_t start = 0, end = 0;
+    while ((end = value.find('\n', start)) != std::string_view::npos) {
+      Buf.append(value.substr(start, end - start));
+      start = end + 1;
     }
+    Buf.append(value.substr(start));
   }
 
   void show() {
@@ -589,6 +777,28 @@ struct LoggerWindow : public UiWindow {
     // Options menu
     if (ImGui::BeginPopup("Options")) {
       ImGui::Checkbox("Auto-scroll", &AutoScroll);
+      int level = to_integral(logger::level());
+      if (ImGui::Combo("Level", &level, "trace\0debug\0info\0warning\0error\0critical\0")) {
+        logger::set_level(logger::LogLevel(level));
+      }
+      int limit_mb = Buf.limit() / (1024 * 1024);
+      if (ImGui::SliderInt("History (MiB)", &limit_mb, 1, 256)) {
+        std::scoped_lock lock(buffer_mutex);
+        Buf.set_byte_limit(std::size_t(limit_mb) * 1024 * 1024);
+      }
+      ImGui::Text("Dropped records: %llu", (unsigned long long)logger::dropped());
+      ImGui::Separator();
+      ImGui::InputText("##LogFile", LogFilePath, IM_ARRAYSIZE(LogFilePath));
+      ImGui::SameLine();
+      if (log_file_sink) {
+        if (ImGui::Button("Stop")) {
+          logger::remove_sink(log_file_sink);
+          log_file_sink = 0;
+        }
+      } else if (ImGui::Button("Log to File")) {
+        log_file_sink = logger::add_file_sink(LogFilePath);
+        if (!log_file_sink) logger::error("Unable to open log file: %s", LogFilePath);
+      }
       ImGui::EndPopup();
     }
 
@@ -600,44 +810,43 @@ struct LoggerWindow : public UiWindow {
     ImGui::SameLine();
     bool copy_button = ImGui::Button("Copy");
     ImGui::SameLine();
-    Filter.Draw("Filter", -100.0f);
+    ImGui::SetNextItemWidth(-100.0f);
+    ImGui::InputTextWithHint("Filter", "substring", FilterInput, IM_ARRAYSIZE(FilterInput));
 
     ImGui::Separator();
     ImGui::BeginChild("scrolling", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
 
     if (clear_button)
       clear();
-    if (copy_button)
-      ImGui::LogToClipboard();
 
+    std::scoped_lock lock(buffer_mutex);
+    Filter.set_pattern(FilterInput, false);
+    Filter.update(Buf);
+    bool filtered = Filter.active();
+
+    if (copy_button) {
+      std::string text;
+      auto append = [this, &text](uint64_t id) { text.append(Buf.row_text(Buf.line(id), 0)).push_back('\n'); };
+      if (filtered) for (const auto& match : Filter.results()) append(match.id);
+      else for (auto id = Buf.begin_id(); id < Buf.end_id(); id++) append(id);
+      ImGui::SetClipboardText(text.c_str());
+    }
 
     ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
-    const char* buf = Buf.begin();
-    const char* buf_end = Buf.end();
-    if (Filter.IsActive()) {
-      for (int line_no = 0; line_no < LineOffsets.Size; line_no++) {
-        const char* line_start = buf + LineOffsets[line_no];
-        const char* line_end = (line_no + 1 < LineOffsets.Size) ? (buf + LineOffsets[line_no + 1] - 1) : buf_end;
-        if (Filter.PassFilter(line_start, line_end)) {
-          ImGui::PushStyleColor(ImGuiCol_Text, get_color(line_start, line_end));
-          ImGui::TextUnformatted(line_start, line_end);
-          ImGui::PopStyleColor();
-        }
+    ImGuiListClipper clipper;
+    clipper.Begin(filtered ? Filter.size() : Buf.size());
+    while (clipper.Step()) {
+      for (int line_no = clipper.DisplayStart; line_no < clipper.DisplayEnd; line_no++) {
+        auto id = filtered ? Filter.results()[line_no].id : Buf.begin_id() + line_no;
+        auto line = Buf.row_text(Buf.line(id), 0);
+        const char* line_start = line.c_str();
+        const char* line_end = line_start + line.size();
+        ImGui::PushStyleColor(ImGuiCol_Text, get_color(line_start, line_end));
+        ImGui::TextUnformatted(line_start, line_end);
+        ImGui::PopStyleColor();
       }
-    } else {
-      ImGuiListClipper clipper;
-      clipper.Begin(LineOffsets.Size);
-      while (clipper.Step()) {
-        for (int line_no = clipper.DisplayStart; line_no < clipper.DisplayEnd; line_no++) {
-          const char* line_start = buf + LineOffsets[line_no];
-          const char* line_end = (line_no + 1 < LineOffsets.Size) ? (buf + LineOffsets[line_no + 1] - 1) : buf_end;
-          ImGui::PushStyleColor(ImGuiCol_Text, get_color(line_start, line_end));
-          ImGui::TextUnformatted(line_start, line_end);
-          ImGui::PopStyleColor();
-        }
-      }
-      clipper.End();
     }
+    clipper.End();
     ImGui::PopStyleVar();
 
     if (AutoScroll && ImGui::GetScrollY() >= ImGui::GetScrollMaxY())
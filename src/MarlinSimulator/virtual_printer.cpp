@@ -8,6 +8,7 @@
 #include "hardware/print_bed.h"
 #include "hardware/bed_probe.h"
 #include "hardware/ST7796Device.h"
+#include "hardware/FsmcTftDevice.h"
 #include "hardware/HD44780Device.h"
 #include "hardware/ST7920Device.h"
 #include "hardware/SDCard.h"
@@ -20,6 +21,8 @@
 #include "hardware/Buzzer.h"
 
 #include "virtual_printer.h"
+#include "emergency_latency.h"
+#include "gpio_benchmark.h"
 
 #include <src/inc/MarlinConfig.h>
 
@@ -298,6 +301,8 @@ void VirtualPrinter::build() {
 
   #if ENABLED(TFT_INTERFACE_SPI)
     root->add_component<ST7796Device>("ST7796Device Display", spi_bus_by_pins<TFT_SCK_PIN, TFT_MOSI_PIN, TFT_MISO_PIN>(), TFT_CS_PIN, spi_bus_by_pins<TOUCH_SCK_PIN, TOUCH_MOSI_PIN, TOUCH_MISO_PIN>(), TOUCH_CS_PIN, TFT_DC_PIN, BEEPER_PIN, BTN_EN1, BTN_EN2, BTN_ENC, BTN_BACK, KILL_PIN);
+  #elif ENABLED(TFT_INTERFACE_FSMC)
+    root->add_component<FsmcTftDevice>("FSMC TFT Display", FsmcBus0, spi_bus_by_pins<TOUCH_SCK_PIN, TOUCH_MOSI_PIN, TOUCH_MISO_PIN>(), TOUCH_CS_PIN, BEEPER_PIN, BTN_EN1, BTN_EN2, BTN_ENC, BTN_BACK, KILL_PIN);
   #elif defined(HAS_MARLINUI_HD44780)
     root->add_component<HD44780Device>("HD44780Device Display", LCD_PINS_RS, LCD_PINS_EN, LCD_PINS_D4, LCD_PINS_D5, LCD_PINS_D6, LCD_PINS_D7, BEEPER_PIN, BTN_EN1, BTN_EN2, BTN_ENC, BTN_BACK, KILL_PIN);
   #elif defined(HAS_MARLINUI_U8GLIB)
@@ -319,6 +324,17 @@ void VirtualPrinter::build() {
     #endif
   #endif
 
+  std::vector<int16_t> step_pins, enable_pins, heater_pins;
+  for (auto const& component : components) {
+    if (auto stepper = std::dynamic_pointer_cast<StepperDriver>(component)) {
+      step_pins.push_back(stepper->step);
+      enable_pins.push_back(stepper->enable);
+      GpioBenchmark::add_target(stepper->step, stepper->dir);
+    }
+    else if (auto heater = std::dynamic_pointer_cast<Heater>(component)) heater_pins.push_back(heater->heater_pin);
+  }
+  EmergencyLatency::observe(step_pins, enable_pins, heater_pins);
+
   for(auto const& component : components) component->ui_init();
 
   kinematics->kinematic_update();
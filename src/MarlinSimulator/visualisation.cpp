@@ -13,6 +13,8 @@
 #include <implot.h>
 
 #include "resources/resources.h"
+#include "gpio_benchmark.h"
+#include "hardware/Gpio.h"
 
 Visualisation::Visualisation(VirtualPrinter& virtual_printer) : virtual_printer(virtual_printer) {
   virtual_printer.on_kinematic_update = [this](kinematic_state& state){
@@ -547,4 +549,39 @@ void Visualisation::ui_info_callback(UiWindow* w) {
       logger::warning("Shader Reload Failed!\n");
     }
   }
+
+  if (GpioBenchmark::targets().size() && ImGui::CollapsingHeader("GPIO Dispatch Benchmark")) {
+    static int target = 0, pulses = 1000000;
+    auto& targets = GpioBenchmark::targets();
+    target = std::clamp(target, 0, int(targets.size()) - 1);
+    ImGui::PushItemWidth(150);
+    if (ImGui::BeginCombo("Step Pin", std::to_string(targets[target].step).c_str())) {
+      for (int i = 0; i < int(targets.size()); i++) {
+        if (ImGui::Selectable(std::to_string(targets[i].step).c_str(), i == target)) target = i;
+      }
+      ImGui::EndCombo();
+    }
+    ImGui::InputInt("Pulses", &pulses, 100000);
+    pulses = std::max(pulses, 1);
+    ImGui::PopItemWidth();
+
+    bool busy = GpioBenchmark::pending(), logging = Gpio::isLoggingEnabled();
+    ImGui::BeginDisabled(busy || logging);
+    if (ImGui::Button(busy ? "Running..." : "Run")) GpioBenchmark::request(target, pulses);
+    ImGui::EndDisabled();
+    if (logging) {
+      ImGui::SameLine();
+      ImGui::TextDisabled("Disable pin logging to run");
+    }
+
+    auto result = GpioBenchmark::result();
+    if (result.events) {
+      ImGui::Text("Pin %d, %zu listeners, %llu events", result.step, result.listeners, (unsigned long long)result.events);
+      ImGui::Text("Gpio::set    %.1f ns/event (%.1f M events/s)", result.dispatch_ns, 1000.0 / result.dispatch_ns);
+      ImGui::Text("Legacy loop  %.1f ns/event (%.1f M events/s)", result.legacy_ns, 1000.0 / result.legacy_ns);
+      ImGui::Text("%zu steppers round-robin", result.steppers);
+      ImGui::Text("Gpio::set    %.1f ns/event (%.1f M events/s)", result.all_steppers_ns, 1000.0 / result.all_steppers_ns);
+      ImGui::Text("Pin reads    %.1f ns/read", result.read_ns);
+    }
+  }
 }
@@ -0,0 +1,245 @@
+/**
+ * Offline converter for serial captures written by the simulator (Serial Capture window).
+ *
+ *   g++ -std=c++17 -O2 tools/serial_capture_convert.cpp -o serial_capture_convert
+ *   serial_capture_convert [--text | --pcapng] capture.msc [output]
+ *
+ * Text output is one line per captured transfer: simulated time in seconds, port, direction and
+ * the escaped bytes. pcapng output has one interface per serial port (LINKTYPE_USER0) with nanosecond
+ * timestamps, host -> firmware transfers are marked inbound and firmware -> host outbound.
+ */
+#include "../src/MarlinSimulator/serial_capture.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace serial_capture;
+
+struct Transfer {
+  uint64_t tick;
+  uint8_t port;
+  Direction direction;
+  const uint8_t* data;
+  std::size_t length;
+  uint64_t lost;  // bytes dropped by the capture immediately before this transfer
+};
+
+class Output {
+public:
+  virtual ~Output() = default;
+  virtual void begin(uint32_t) {}
+  virtual void transfer(const Transfer& transfer) = 0;
+  virtual void end(uint64_t) {}
+};
+
+class TextOutput : public Output {
+public:
+  TextOutput(FILE* file) : file(file) {}
+
+  void begin(uint32_t tick_frequency) override { frequency = tick_frequency; }
+
+  void transfer(const Transfer& transfer) override {
+    double seconds = double(transfer.tick) / frequency;
+    if (transfer.lost) fprintf(file, "[%.9f] -- %llu bytes lost --\n", seconds, (unsigned long long)transfer.lost);
+    fprintf(file, "[%.9f] %u %s ", seconds, transfer.port, transfer.direction == HOST_TO_FIRMWARE ? "<" : ">");
+    for (std::size_t i = 0; i < transfer.length; i++) {
+      uint8_t value = transfer.data[i];
+      if (value == '\n') fputs("\\n", file);
+      else if (value == '\r') fputs("\\r", file);
+      else if (value == '\\') fputs("\\\\", file);
+      else if (value >= 0x20 && value < 0x7F) fputc(value, file);
+      else fprintf(file, "\\x%02X", value);
+    }
+    fputc('\n', file);
+  }
+
+  void end(uint64_t lost) override {
+    if (lost) fprintf(file, "-- %llu bytes lost at end of capture --\n", (unsigned long long)lost);
+  }
+
+private:
+  FILE* file;
+  uint32_t frequency = 1;
+};
+
+class PcapngOutput : public Output {
+public:
+  static constexpr uint16_t linktype_user0 = 147;
+
+  PcapngOutput(FILE* file) : file(file) {}
+
+  void begin(uint32_t tick_frequency) override {
+    frequency = tick_frequency;
+
+    // Section Header Block
+    std::vector<uint8_t> shb;
+    put32(shb, 0x1A2B3C4D);
+    put16(shb, 1);
+    put16(shb, 0);
+    put32(shb, 0xFFFFFFFF);  // section length unknown
+    put32(shb, 0xFFFFFFFF);
+    block(0x0A0D0D0A, shb);
+
+    // Interface Description Blocks, one per port
+    for (int port = 0; port < 4; port++) {
+      std::vector<uint8_t> idb;
+      put16(idb, linktype_user0);
+      put16(idb, 0);
+      put32(idb, 0);
+      std::string name = "serial" + std::to_string(port);
+      option(idb, 2, (const uint8_t*)name.data(), name.size());   // if_name
+      uint8_t resolution = 9;                                      // nanoseconds
+      option(idb, 9, &resolution, 1);                              // if_tsresol
+      put32(idb, 0);                                               // opt_endofopt
+      block(1, idb);
+    }
+  }
+
+  void transfer(const Transfer& transfer) override {
+    // tick * 10^9 overflows 64 bits, so whole seconds and the remainder are scaled apart
+    uint64_t timestamp = transfer.tick / frequency * 1000000000ull + transfer.tick % frequency * 1000000000ull / frequency;
+    std::vector<uint8_t> epb;
+    put32(epb, transfer.port);
+    put32(epb, uint32_t(timestamp >> 32));
+    put32(epb, uint32_t(timestamp));
+    put32(epb, transfer.length);
+    put32(epb, transfer.length);
+    epb.insert(epb.end(), transfer.data, transfer.data + transfer.length);
+    while (epb.size() % 4) epb.push_back(0);
+
+    uint8_t flags[4] = {};
+    flags[0] = transfer.direction == HOST_TO_FIRMWARE ? 1 : 2;     // inbound / outbound
+    option(epb, 2, flags, sizeof(flags));                          // epb_flags
+    if (transfer.lost) {
+      uint8_t count[8];
+      for (int i = 0; i < 8; i++) count[i] = uint8_t(transfer.lost >> (i * 8));
+      option(epb, 4, count, sizeof(count));                        // epb_dropcount
+    }
+    put32(epb, 0);
+    block(6, epb);
+  }
+
+private:
+  static void put16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(uint8_t(value));
+    out.push_back(uint8_t(value >> 8));
+  }
+
+  static void put32(std::vector<uint8_t>& out, uint32_t value) {
+    put16(out, uint16_t(value));
+    put16(out, uint16_t(value >> 16));
+  }
+
+  static void option(std::vector<uint8_t>& out, uint16_t code, const uint8_t* value, std::size_t length) {
+    put16(out, code);
+    put16(out, uint16_t(length));
+    out.insert(out.end(), value, value + length);
+    while (out.size() % 4) out.push_back(0);
+  }
+
+  void block(uint32_t type, const std::vector<uint8_t>& body) {
+    std::vector<uint8_t> out;
+    uint32_t length = uint32_t(body.size() + 12);
+    put32(out, type);
+    put32(out, length);
+    out.insert(out.end(), body.begin(), body.end());
+    put32(out, length);
+    fwrite(out.data(), 1, out.size(), file);
+  }
+
+  FILE* file;
+  uint32_t frequency = 1;
+};
+
+static int convert(FILE* input, Output& output) {
+  uint8_t header[header_size];
+  if (fread(header, 1, sizeof(header), input) != sizeof(header) || std::memcmp(header, magic, sizeof(magic)) != 0) {
+    fprintf(stderr, "not a serial capture file\n");
+    return 1;
+  }
+  uint16_t file_version = header[8] | (header[9] << 8);
+  if (file_version != version) {
+    fprintf(stderr, "unsupported capture version %u\n", file_version);
+    return 1;
+  }
+  uint32_t frequency = header[12] | (header[13] << 8) | (header[14] << 16) | (uint32_t(header[15]) << 24);
+  output.begin(frequency ? frequency : 1);
+
+  std::vector<uint8_t> chunk;
+  uint64_t tick = 0, lost = 0;
+  uint8_t prefix[4];
+  while (fread(prefix, 1, sizeof(prefix), input) == sizeof(prefix)) {
+    uint32_t length = prefix[0] | (prefix[1] << 8) | (prefix[2] << 16) | (uint32_t(prefix[3]) << 24);
+    chunk.resize(length);
+    if (fread(chunk.data(), 1, length, input) != length) {
+      fprintf(stderr, "warning: capture truncated, last chunk ignored\n");
+      break;
+    }
+
+    const uint8_t* cursor = chunk.data();
+    const uint8_t* end = cursor + chunk.size();
+    while (cursor < end) {
+      uint8_t flags = *cursor++;
+      uint64_t delta = 0, value = 0;
+      if (!decode_varint(cursor, end, delta) || !decode_varint(cursor, end, value)) {
+        fprintf(stderr, "warning: malformed record\n");
+        return 1;
+      }
+      tick += delta;
+      if (flags & GAP) {
+        lost += value;
+        continue;
+      }
+      if (uint64_t(end - cursor) < value) {
+        fprintf(stderr, "warning: malformed record\n");
+        return 1;
+      }
+      output.transfer({tick, uint8_t(flags & PORT_MASK), (flags & DIRECTION) ? FIRMWARE_TO_HOST : HOST_TO_FIRMWARE, cursor, std::size_t(value), lost});
+      cursor += value;
+      lost = 0;
+    }
+  }
+  output.end(lost);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  bool pcapng = false;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--pcapng") == 0) pcapng = true;
+    else if (std::strcmp(argv[i], "--text") == 0) pcapng = false;
+    else files.push_back(argv[i]);
+  }
+  if (files.empty() || files.size() > 2) {
+    fprintf(stderr, "usage: %s [--text | --pcapng] capture.msc [output]\n", argv[0]);
+    return 2;
+  }
+
+  FILE* input = fopen(files[0], "rb");
+  if (input == nullptr) {
+    fprintf(stderr, "unable to open %s\n", files[0]);
+    return 1;
+  }
+  FILE* output = files.size() > 1 ? fopen(files[1], pcapng ? "wb" : "w") : stdout;
+  if (output == nullptr) {
+    fprintf(stderr, "unable to open %s\n", files[1]);
+    fclose(input);
+    return 1;
+  }
+
+  int result = 0;
+  if (pcapng) {
+    PcapngOutput writer(output);
+    result = convert(input, writer);
+  } else {
+    TextOutput writer(output);
+    result = convert(input, writer);
+  }
+
+  fclose(input);
+  if (output != stdout) fclose(output);
+  return result;
+}